@@ -34,6 +34,7 @@
 #include <assert.h>
 #include <inttypes.h>
 #include <stdalign.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -46,6 +47,18 @@
 #define RBPF_STACK_SIZE   (512)
 #define BYTECODE_SIZE_MAX (600)
 #define BUFFER_SIZE_MAX   (362)
+
+/* Run in place, only the pre-decoded instructions and the data section of
+ * the application take RAM, so larger applications fit */
+#define XIP_BYTECODE_SIZE_MAX (2048)
+#define XIP_DATA_SIZE_MAX     (256)
+
+#if defined(RBPF_XIP) && RBPF_XIP
+#define INSNS_MAX         RBPF_INSNS_MAX(XIP_BYTECODE_SIZE_MAX)
+#else
+#define INSNS_MAX         RBPF_INSNS_MAX(BYTECODE_SIZE_MAX)
+#endif
+#define STORE_ENTRIES     (16)
 #define RUN_ONCE          (1)
 
 #define BPF_RUN_N(ctx, size) \
@@ -94,6 +107,23 @@ bpf_run_with_file(rbpf_application_t *rbpf, unsigned n, void *buf,
         .words = buf_size/2,
     };
 
+    /* The file is at most BUFFER_SIZE_MAX bytes, which bounds the loop
+     * over its words */
+    static const rbpf_ctx_bound_t bounds[] = {
+        { offsetof(fletcher32_ctx_t, words), sizeof(uint32_t), BUFFER_SIZE_MAX / 2 },
+    };
+    if ((status = rbpf_application_set_ctx_bounds(rbpf, bounds,
+        sizeof(bounds) / sizeof(bounds[0]))) < 0 ||
+        (status = rbpf_application_verify_preflight(rbpf)) < 0) {
+        return bpf_print_result(0, status);
+    }
+    if (rbpf->flags & RBPF_FLAG_TERMINATES) {
+        printf(PROGNAME": proven to terminate, runs without fuel\n");
+    }
+    else {
+        printf(PROGNAME": not proven to terminate, runs with fuel\n");
+    }
+
     rbpf_memory_region_init(&region, buf, buf_size, RBPF_MEM_REGION_READ);
     rbpf_add_region(rbpf, &region);
 
@@ -131,9 +161,17 @@ main(int argc, char **argv)
 {
     static uint8_t rbpf_stack[RBPF_STACK_SIZE];
     static char buf[BUFFER_SIZE_MAX];
+#if defined(RBPF_XIP) && RBPF_XIP
+    static uint8_t bytecode_data[XIP_DATA_SIZE_MAX] __attribute((aligned(8)));
+    const void *bytecode;
+#else
     static char bytecode[BYTECODE_SIZE_MAX];
+#endif
+    static rbpf_insn_t insns[INSNS_MAX];
+    static rbpf_store_entry_t store_entries[STORE_ENTRIES];
+    static rbpf_store_t store;
     static size_t bytecode_size;
-    rbpf_application_t rbpf;
+    rbpf_application_t rbpf = { 0 };
     rbpf_mem_region_t region;
     uint64_t integer;
     ssize_t result;
@@ -144,6 +182,31 @@ main(int argc, char **argv)
         return 1;
     }
 
+#if defined(RBPF_XIP) && RBPF_XIP
+    if (get_file_address(argv[1], &bytecode) < 0 ||
+        get_file_size(argv[1], &bytecode_size) < 0) {
+        printf(PROGNAME": %s: failed to map bytecode\n", argv[1]);
+        return 1;
+    }
+
+    printf(PROGNAME": \"%s\" bytecode mapped at address %p\n", argv[1],
+        bytecode);
+
+    if (bytecode_size > XIP_BYTECODE_SIZE_MAX) {
+        printf(PROGNAME": %s: bytecode larger than %u bytes\n", argv[1],
+            XIP_BYTECODE_SIZE_MAX);
+        return 1;
+    }
+
+    /* Only the data section is copied to RAM, the rest runs from flash */
+    if ((result = rbpf_application_setup_xip(&rbpf, rbpf_stack, bytecode,
+        bytecode_size, insns, INSNS_MAX,
+        bytecode_data, sizeof(bytecode_data))) < 0) {
+        printf(PROGNAME": %s: failed to set up bytecode (%d)\n", argv[1],
+            (int)result);
+        return 1;
+    }
+#else
     if ((result = copy_file(argv[1], bytecode, BYTECODE_SIZE_MAX)) < 0) {
         printf(PROGNAME": %s: failed to copy bytecode\n", argv[1]);
         return 1;
@@ -154,11 +217,16 @@ main(int argc, char **argv)
         (void *)bytecode);
 
     rbpf_application_setup(&rbpf, rbpf_stack, (void *)bytecode,
-        bytecode_size);
-    rbpf_memory_region_init(&region, bytecode, bytecode_size,
+        bytecode_size, insns, INSNS_MAX);
+#endif
+    rbpf_memory_region_init(&region, (void *)bytecode, bytecode_size,
         RBPF_MEM_REGION_READ);
     rbpf_add_region(&rbpf, &region);
 
+    /* Local key/value store of the application */
+    rbpf_store_table_init(&store, store_entries, STORE_ENTRIES);
+    rbpf_application_set_store(&rbpf, &store);
+
     if (argc < 3) {
         return bpf_run(&rbpf, RUN_ONCE);
     }
@@ -14,7 +14,43 @@
 extern "C" {
 #endif
 
-/* TODO: add headers for system calls */
+#include <stdint.h>
+
+#include "rbpf.h"
+
+/**
+ * @name Key/value store functions, called by the applications
+ *
+ * The key is in r1, the value or the address receiving it in r2.
+ * @{
+ */
+uint32_t rbpf_vm_store_local(rbpf_application_t *rbpf, uint64_t *regs);
+uint32_t rbpf_vm_store_global(rbpf_application_t *rbpf, uint64_t *regs);
+uint32_t rbpf_vm_fetch_local(rbpf_application_t *rbpf, uint64_t *regs);
+uint32_t rbpf_vm_fetch_global(rbpf_application_t *rbpf, uint64_t *regs);
+/** @} */
+
+/**
+ * @brief Check the tail call to the application at the index in r1
+ *
+ * @return  RBPF_TAIL_CALL with the index in r0 when the engine may start the
+ *          application, RBPF_OK with -1 in r0 otherwise
+ */
+uint32_t rbpf_vm_tail_call(rbpf_application_t *rbpf, uint64_t *regs);
+
+/**
+ * @name Bulk memory functions, called by the applications
+ *
+ * The addresses are in r1 and r2, the length in r3. The whole ranges are
+ * checked once, @ref RBPF_ILLEGAL_MEM is returned in r0 when they aren't
+ * allowed.
+ * @{
+ */
+uint32_t rbpf_vm_memcpy(rbpf_application_t *rbpf, uint64_t *regs);
+uint32_t rbpf_vm_memset(rbpf_application_t *rbpf, uint64_t *regs);
+uint32_t rbpf_vm_memcmp(rbpf_application_t *rbpf, uint64_t *regs);
+uint32_t rbpf_vm_memchr(rbpf_application_t *rbpf, uint64_t *regs);
+/** @} */
 
 
 #ifdef __cplusplus
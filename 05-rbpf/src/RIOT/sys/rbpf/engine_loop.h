@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2023 Freie Universität Berlin
+ * Copyright (C) 2023 Inria
+ * Copyright (C) 2023 Koen Zandberg <koen@bergzand.net>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Interpreter loop of the engine, included by engine.c once per register file
+ * width. The includer defines:
+ *
+ *  - RBPF_LOOP_NAME:  name of the generated function
+ *  - RBPF_LOOP_REG_T: type of the registers
+ *  - RBPF_LOOP_CALLS: 1 when the loop runs the calls to helper functions,
+ *                     they take the 64 bit register file
+ *
+ * The generated function runs the pre-decoded application from the entry
+ * instruction with the initialized registers and returns the exit code, r0
+ * holds the result.
+ */
+
+static int RBPF_LOOP_NAME(rbpf_application_t *rbpf, RBPF_LOOP_REG_T *regmap,
+                          const rbpf_insn_t *entry)
+{
+#if (RBPF_ENABLE_COMPUTED_GOTO)
+#define HANDLER_OFFSET(name) [RBPF_HANDLER_ ## name] = &&_rbpf_op_ ## name - &&_rbpf_op_ILLEGAL,
+#define FUSED_OFFSET(name, first, len) HANDLER_OFFSET(name)
+#define BYTESWAP_OFFSET(name, opcode, width) HANDLER_OFFSET(name)
+#define VARIANT_OFFSET(name, opcode) HANDLER_OFFSET(name)
+#define ATOMIC_OFFSET(name, opcode, op) HANDLER_OFFSET(name)
+    static const int32_t _rbpf_ops[RBPF_HANDLER_COUNT] = {
+        RBPF_OPCODE_HANDLERS(HANDLER_OFFSET)
+        RBPF_BYTESWAP_HANDLERS(BYTESWAP_OFFSET)
+        RBPF_VARIANT_HANDLERS(VARIANT_OFFSET)
+        RBPF_ATOMIC_HANDLERS(ATOMIC_OFFSET)
+        RBPF_PROVEN_HANDLERS(HANDLER_OFFSET)
+#if (RBPF_ENABLE_FUSION)
+        RBPF_FUSED_HANDLERS(FUSED_OFFSET)
+#endif
+    };
+#undef HANDLER_OFFSET
+#undef FUSED_OFFSET
+#undef BYTESWAP_OFFSET
+#undef VARIANT_OFFSET
+#undef ATOMIC_OFFSET
+#endif
+    int res = RBPF_OK;
+
+    const rbpf_insn_t *instr = entry;
+    /* The context is large enough for the accesses proven by the verifier */
+    const bool ctx_ok = rbpf->arg_region.len >= rbpf->ctx_len_min;
+    /* Fuel left for the run, kept out of memory */
+    uint32_t fuel = rbpf->fuel;
+    const uint32_t meter = (rbpf->flags & (RBPF_CONFIG_NO_RETURN | RBPF_FLAG_TERMINATES)) ?
+                           0 : UINT32_MAX;
+#if (RBPF_ENABLE_PROFILE)
+    rbpf_profile_t *const profile = rbpf->profile;
+#endif
+#if (RBPF_CALL_DEPTH_MAX > 1)
+    /* Local calls in progress, with the registers r6-r9 of their caller */
+    struct {
+        const rbpf_insn_t *ret;
+        RBPF_LOOP_REG_T regs[4];
+    } frames[RBPF_CALL_DEPTH_MAX - 1];
+    unsigned depth = 0;
+#endif
+
+    DISPATCH_BEGIN
+
+    /* Macros implementing the instruction code for the simple ALU(32|64) based operations */
+    ALU(ADD,  +)
+    ALU(SUB,  -)
+    ALU(AND,  &)
+    ALU(OR,   |)
+    ALU(LSH, <<)
+    ALU(RSH, >>)
+    ALU(XOR,  ^)
+    ALU(MUL,  *)
+
+    /* These need additional checks inside */
+    HANDLER(ALU64_MOD_REG)
+        if (SRC == 0) {
+            EXIT(RBPF_ILLEGAL_DIV);
+        }
+        DST = UMOD(DST, SRC);
+        NEXT;
+    HANDLER(ALU64_MOD_IMM)
+        if (IMM == 0) {
+            EXIT(RBPF_ILLEGAL_DIV);
+        }
+        DST = UMOD(DST, IMM);
+        NEXT;
+#if (RBPF_ENABLE_ALU32)
+    HANDLER(ALU32_MOD_REG)
+        if (SRC == 0) {
+            EXIT(RBPF_ILLEGAL_DIV);
+        }
+        DST = (uint32_t)DST % (uint32_t)SRC;
+        NEXT;
+    HANDLER(ALU32_MOD_IMM)
+        if (IMM == 0) {
+            EXIT(RBPF_ILLEGAL_DIV);
+        }
+        DST = (uint32_t)DST % (uint32_t)IMM;
+        NEXT;
+#endif
+
+    /* These need additional checks inside */
+    HANDLER(ALU64_DIV_REG)
+        if (SRC == 0) {
+            EXIT(RBPF_ILLEGAL_DIV);
+        }
+        DST = UDIV(DST, SRC);
+        NEXT;
+    HANDLER(ALU64_DIV_IMM)
+        if (IMM == 0) {
+            EXIT(RBPF_ILLEGAL_DIV);
+        }
+        DST = UDIV(DST, IMM);
+        NEXT;
+#if (RBPF_ENABLE_ALU32)
+    HANDLER(ALU32_DIV_REG)
+        if (SRC == 0) {
+            EXIT(RBPF_ILLEGAL_DIV);
+        }
+        DST = (uint32_t)DST / (uint32_t)SRC;
+        NEXT;
+    HANDLER(ALU32_DIV_IMM)
+        if (IMM == 0) {
+            EXIT(RBPF_ILLEGAL_DIV);
+        }
+        DST = (uint32_t)DST / (uint32_t)IMM;
+        NEXT;
+#endif
+
+    /* These only have an immediate argument variant */
+    HANDLER(ALU64_NEG_IMM)
+        DST = -(int64_t)DST;
+        NEXT;
+
+#if (RBPF_ENABLE_ALU32)
+    HANDLER(ALU32_NEG_IMM)
+        DST = -(int32_t)DST;
+        NEXT;
+
+    /* MOV doesn't have an operation associated (breaks the pattern) */
+    HANDLER(ALU32_MOV_IMM)
+        DST = (uint32_t)IMM;
+        NEXT;
+    HANDLER(ALU32_MOV_REG)
+        DST = (uint32_t)SRC;
+        NEXT;
+#endif
+    HANDLER(ALU64_MOV_IMM)
+        DST = IMM;
+        NEXT;
+    HANDLER(ALU64_MOV_REG)
+        DST = SRC;
+        NEXT;
+
+    /* Arithmetic shift also don't really fit the pattern */
+    HANDLER(ALU64_ARSH_REG)
+        DST = (int64_t)DST >> SRC;
+        NEXT;
+    HANDLER(ALU64_ARSH_IMM)
+        DST = (int64_t)DST >> IMM;
+        NEXT;
+#if (RBPF_ENABLE_ALU32)
+    HANDLER(ALU32_ARSH_REG)
+        DST = (int32_t)DST >> SRC;
+        NEXT;
+    HANDLER(ALU32_ARSH_IMM)
+        DST =  (int32_t)DST >> IMM;
+        NEXT;
+#endif
+
+    /* Byte swaps of the low 16, 32 or 64 bits, the host is little endian:
+     * converting to little endian only truncates to the width */
+    HANDLER(ALU_LE16)
+        DST = (uint16_t)DST;
+        NEXT;
+    HANDLER(ALU_LE32)
+        DST = (uint32_t)DST;
+        NEXT;
+    HANDLER(ALU_LE64)
+        NEXT;
+    HANDLER(ALU_BE16)
+        DST = __builtin_bswap16(DST);
+        NEXT;
+    HANDLER(ALU_BE32)
+        DST = __builtin_bswap32(DST);
+        NEXT;
+    HANDLER(ALU_BE64)
+        DST = __builtin_bswap64(DST);
+        NEXT;
+
+    /* Double word memory load, takes up two instructions, but acts as one. The
+     * verifier already folded the data and rodata relative variants (LDDWD and
+     * LDDWR) into the immediate */
+    HANDLER(MEM_LDDW)
+        DST = IMM;
+        instr++;
+        NEXT;
+
+/* Regular memory instructions with different sizes */
+        MEM(B, uint8_t)
+        MEM(H, uint16_t)
+        MEM(W, uint32_t)
+        MEM(DW, uint64_t)
+
+/* Atomic memory instructions, the double word ones need lock free 8 bytes
+ * atomics */
+        ATOMIC(W, uint32_t)
+#if (RBPF_ENABLE_ATOMIC64)
+        ATOMIC(DW, uint64_t)
+#endif
+
+    HANDLER(JMP_ALWAYS)
+        JUMP;
+
+    /* The entries were checked by the verifier, the indices past the table
+     * take the default entry after it */
+    HANDLER(JMP_TABLE) {
+        uint64_t index = DST;
+        const rbpf_insn_t *target =
+            rbpf->insns + instr->table[index < (uint64_t)IMM ? index : (uint64_t)IMM];
+        JUMP_TO(target);
+    }
+
+        /* generate jump instructions */
+        COND_JMP(ui, EQ, ==)
+        COND_JMP(ui, GT, >)
+        COND_JMP(ui, GE, >=)
+        COND_JMP(ui, LT, <)
+        COND_JMP(ui, LE, <=)
+        COND_JMP(ui, SET, &)
+        COND_JMP(ui, NE, !=)
+        COND_JMP(i, SGT, >)
+        COND_JMP(i, SGE, >=)
+        COND_JMP(i, SLT, <)
+        COND_JMP(i, SLE, <=)
+
+#if (RBPF_ENABLE_FUSION)
+    /* Fused handlers, each one runs its instructions in order, the memory
+     * checks and the branch budget stay the ones of the instructions */
+    HANDLER(FUSED_ZEXT32)
+        FUSED(2);
+        DST = (uint32_t)DST;
+        NEXT_FUSED(2);
+    HANDLER(FUSED_SEXT32)
+        FUSED(2);
+        DST = (int32_t)DST;
+        NEXT_FUSED(2);
+    HANDLER(FUSED_ADD_SEXT32)
+        FUSED(3);
+        DST = (uint64_t)DST << 32;
+        DST += regmap[instr[1].src];
+        DST = (int64_t)DST >> 32;
+        NEXT_FUSED(3);
+    HANDLER(FUSED_MOV_ZEXT32)
+        FUSED(3);
+        DST = (uint32_t)SRC;
+        NEXT_FUSED(3);
+    HANDLER(FUSED_MOV_SEXT32)
+        FUSED(3);
+        DST = (int32_t)SRC;
+        NEXT_FUSED(3);
+    HANDLER(FUSED_LDXW_SEXT32)
+        FUSED(3);
+        if (!_check_load(rbpf, SRC + instr->offset, sizeof(int32_t))) {
+            EXIT(RBPF_ILLEGAL_MEM);
+        }
+        DST = *(const int32_t *)(uintptr_t)(SRC + instr->offset);
+        NEXT_FUSED(3);
+    HANDLER(FUSED_LDXB_STXB)
+        FUSED(2);
+        if (!_check_load(rbpf, SRC + instr->offset, sizeof(uint8_t))) {
+            EXIT(RBPF_ILLEGAL_MEM);
+        }
+        DST = *(const uint8_t *)(uintptr_t)(SRC + instr->offset);
+        instr++;
+        if (!_check_store(rbpf, DST + instr->offset, sizeof(uint8_t))) {
+            EXIT(RBPF_ILLEGAL_MEM);
+        }
+        *(uint8_t *)(uintptr_t)(DST + instr->offset) = SRC;
+        NEXT;
+
+        FUSED_JMP(ui, EQ, ==)
+        FUSED_JMP(ui, GT, >)
+        FUSED_JMP(ui, GE, >=)
+        FUSED_JMP(ui, LT, <)
+        FUSED_JMP(ui, LE, <=)
+        FUSED_JMP(ui, SET, &)
+        FUSED_JMP(ui, NE, !=)
+        FUSED_JMP(i, SGT, >)
+        FUSED_JMP(i, SGE, >=)
+        FUSED_JMP(i, SLT, <)
+        FUSED_JMP(i, SLE, <=)
+#endif
+
+    /* The verifier resolved the called function */
+    HANDLER(CALL)
+#if (RBPF_LOOP_CALLS)
+        regmap[0] = (*(instr->call))(rbpf, regmap);
+        NEXT;
+#else
+        /* Applications calling functions never run with this register file */
+        EXIT(RBPF_ILLEGAL_CALL);
+#endif
+    /* The verifier bounds the depth, checked again before using a frame */
+    HANDLER(CALL_LOCAL)
+#if (RBPF_CALL_DEPTH_MAX > 1)
+        if (depth == RBPF_CALL_DEPTH_MAX - 1) {
+            EXIT(RBPF_ILLEGAL_CALL);
+        }
+        frames[depth].ret = instr + 1;
+        for (unsigned r = 0; r < 4; r++) {
+            frames[depth].regs[r] = regmap[6 + r];
+        }
+        depth++;
+        regmap[10] -= RBPF_CALL_FRAME_SIZE;
+        instr = instr->target;
+        DISPATCH();
+#else
+        EXIT(RBPF_ILLEGAL_CALL);
+#endif
+    /* The engine starts the next application, r0 holds its index */
+    HANDLER(TAIL_CALL)
+        if (_tail_call_allowed(rbpf, regmap[1])) {
+            regmap[0] = regmap[1];
+            EXIT(RBPF_TAIL_CALL);
+        }
+        regmap[0] = (RBPF_LOOP_REG_T)-1;
+        NEXT;
+    HANDLER(RETURN)
+#if (RBPF_CALL_DEPTH_MAX > 1)
+        if (depth > 0) {
+            depth--;
+            for (unsigned r = 0; r < 4; r++) {
+                regmap[6 + r] = frames[depth].regs[r];
+            }
+            regmap[10] += RBPF_CALL_FRAME_SIZE;
+            instr = frames[depth].ret;
+            DISPATCH();
+        }
+#endif
+        EXIT(RBPF_OK);
+
+    HANDLER(ILLEGAL)
+        EXIT(RBPF_ILLEGAL_INSTRUCTION);
+
+    DISPATCH_END
+
+exit:
+    return res;
+}
+
+#undef RBPF_LOOP_NAME
+#undef RBPF_LOOP_REG_T
+#undef RBPF_LOOP_CALLS
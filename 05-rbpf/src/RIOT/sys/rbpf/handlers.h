@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2023 Inria
+ * Copyright (C) 2023 Koen Zandberg <koen@bergzand.net>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     sys_rbpf
+ * @{
+ *
+ * @file
+ * @brief       Handlers of the pre-decoded rBPF instructions
+ *
+ * The verifier lowers every bytecode instruction into a @ref rbpf_insn_t
+ * carrying the index of the engine handler executing it. This list is shared
+ * between the verifier, which maps the opcodes to the handlers, and the
+ * engine, which implements them.
+ *
+ * @author      Koen Zandberg <koen@bergzand.net>
+ */
+
+#ifndef RBPF_HANDLERS_H
+#define RBPF_HANDLERS_H
+
+#include "rbpf/config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Check if we implement 32 bit instructions */
+#if (RBPF_ENABLE_ALU32)
+#define ALU_HANDLERS(X, OPCODE) \
+    X(ALU64_ ## OPCODE ## _REG) \
+    X(ALU64_ ## OPCODE ## _IMM) \
+    X(ALU32_ ## OPCODE ## _REG) \
+    X(ALU32_ ## OPCODE ## _IMM)
+
+#define ALU32_HANDLERS(X) \
+    X(ALU32_NEG_IMM)
+#else
+#define ALU_HANDLERS(X, OPCODE) \
+    X(ALU64_ ## OPCODE ## _REG) \
+    X(ALU64_ ## OPCODE ## _IMM)
+
+#define ALU32_HANDLERS(X)
+#endif
+
+#define MEM_HANDLERS(X, SIZEOP) \
+    X(MEM_STX ## SIZEOP) \
+    X(MEM_ST ## SIZEOP) \
+    X(MEM_LDX ## SIZEOP)
+
+#define COND_JMP_HANDLERS(X, OPCODE) \
+    X(JMP_ ## OPCODE ## _REG) \
+    X(JMP_ ## OPCODE ## _IMM)
+
+/**
+ * @brief Handlers matching a bytecode opcode one to one
+ *
+ * X(name) is expanded for every handler, the matching opcode is
+ * BPF_INSTRUCTION_ ## name. The LDDWD and LDDWR opcodes are folded into the
+ * LDDW handler by the verifier.
+ */
+#define RBPF_OPCODE_HANDLERS(X) \
+    ALU_HANDLERS(X, ADD) \
+    ALU_HANDLERS(X, SUB) \
+    ALU_HANDLERS(X, AND) \
+    ALU_HANDLERS(X, OR) \
+    ALU_HANDLERS(X, LSH) \
+    ALU_HANDLERS(X, RSH) \
+    ALU_HANDLERS(X, XOR) \
+    ALU_HANDLERS(X, MUL) \
+    ALU_HANDLERS(X, MOD) \
+    ALU_HANDLERS(X, DIV) \
+    ALU_HANDLERS(X, MOV) \
+    ALU_HANDLERS(X, ARSH) \
+    ALU32_HANDLERS(X) \
+    X(ALU64_NEG_IMM) \
+    X(MEM_LDDW) \
+    MEM_HANDLERS(X, B) \
+    MEM_HANDLERS(X, H) \
+    MEM_HANDLERS(X, W) \
+    MEM_HANDLERS(X, DW) \
+    X(JMP_ALWAYS) \
+    COND_JMP_HANDLERS(X, EQ) \
+    COND_JMP_HANDLERS(X, GT) \
+    COND_JMP_HANDLERS(X, GE) \
+    COND_JMP_HANDLERS(X, LT) \
+    COND_JMP_HANDLERS(X, LE) \
+    COND_JMP_HANDLERS(X, SET) \
+    COND_JMP_HANDLERS(X, NE) \
+    COND_JMP_HANDLERS(X, SGT) \
+    COND_JMP_HANDLERS(X, SGE) \
+    COND_JMP_HANDLERS(X, SLT) \
+    COND_JMP_HANDLERS(X, SLE) \
+    X(JMP_TABLE) \
+    X(CALL) \
+    X(RETURN)
+
+/**
+ * @brief Byte swap handlers, one per width of the byte swap opcodes
+ *
+ * X(name, opcode, width) is expanded for every handler. The verifier selects
+ * the handler of a BPF_INSTRUCTION_ ## opcode instruction from the width in
+ * its immediate.
+ */
+#define RBPF_BYTESWAP_HANDLERS(X) \
+    X(ALU_LE16, ALU_END_LE, 16) \
+    X(ALU_LE32, ALU_END_LE, 32) \
+    X(ALU_LE64, ALU_END_LE, 64) \
+    X(ALU_BE16, ALU_END_BE, 16) \
+    X(ALU_BE32, ALU_END_BE, 32) \
+    X(ALU_BE64, ALU_END_BE, 64)
+
+/**
+ * @brief Handlers of the instructions sharing their opcode with another one
+ *
+ * X(name, opcode) is expanded for every handler. The verifier selects the
+ * local call handler for a BPF_INSTRUCTION_CALL with the
+ * BPF_INSTRUCTION_CALL_LOCAL_SRC source register, the tail call one for a call
+ * of BPF_FUNC_BPF_TAIL_CALL.
+ */
+#define RBPF_VARIANT_HANDLERS(X) \
+    X(CALL_LOCAL, CALL) \
+    X(TAIL_CALL, CALL)
+
+#define ATOMIC_HANDLERS(X, SIZEOP) \
+    X(ATOMIC ## SIZEOP ## _ADD, MEM_ATOMIC ## SIZEOP, ADD) \
+    X(ATOMIC ## SIZEOP ## _OR, MEM_ATOMIC ## SIZEOP, OR) \
+    X(ATOMIC ## SIZEOP ## _AND, MEM_ATOMIC ## SIZEOP, AND) \
+    X(ATOMIC ## SIZEOP ## _XOR, MEM_ATOMIC ## SIZEOP, XOR) \
+    X(ATOMIC ## SIZEOP ## _FETCH_ADD, MEM_ATOMIC ## SIZEOP, FETCH_ADD) \
+    X(ATOMIC ## SIZEOP ## _FETCH_OR, MEM_ATOMIC ## SIZEOP, FETCH_OR) \
+    X(ATOMIC ## SIZEOP ## _FETCH_AND, MEM_ATOMIC ## SIZEOP, FETCH_AND) \
+    X(ATOMIC ## SIZEOP ## _FETCH_XOR, MEM_ATOMIC ## SIZEOP, FETCH_XOR) \
+    X(ATOMIC ## SIZEOP ## _XCHG, MEM_ATOMIC ## SIZEOP, XCHG) \
+    X(ATOMIC ## SIZEOP ## _CMPXCHG, MEM_ATOMIC ## SIZEOP, CMPXCHG)
+
+#if (RBPF_ENABLE_ATOMIC64)
+#define ATOMIC64_HANDLERS(X) ATOMIC_HANDLERS(X, DW)
+#else
+#define ATOMIC64_HANDLERS(X)
+#endif
+
+/**
+ * @brief Atomic memory handlers, one per operation of the atomic opcodes
+ *
+ * X(name, opcode, op) is expanded for every handler. The verifier selects the
+ * handler of a BPF_INSTRUCTION_ ## opcode instruction from the
+ * BPF_INSTRUCTION_ATOMIC_ ## op operation in its immediate. The accesses are
+ * always checked, for both a load and a store.
+ */
+#define RBPF_ATOMIC_HANDLERS(X) \
+    ATOMIC_HANDLERS(X, W) \
+    ATOMIC64_HANDLERS(X)
+
+#define MEM_PROVEN_HANDLERS(X, SIZEOP) \
+    X(MEM_STX ## SIZEOP ## _SAFE) \
+    X(MEM_ST ## SIZEOP ## _SAFE) \
+    X(MEM_LDX ## SIZEOP ## _SAFE) \
+    X(MEM_STX ## SIZEOP ## _CTX) \
+    X(MEM_ST ## SIZEOP ## _CTX) \
+    X(MEM_LDX ## SIZEOP ## _CTX)
+
+/**
+ * @brief Memory access handlers selected by the range analysis of the verifier
+ *
+ * No opcode maps to these. The _SAFE variants skip the memory check, their
+ * access is proven to stay inside the stack, the data or the read-only data.
+ * The _CTX variants access the context at an offset proven to be in bounds
+ * for contexts of at least rbpf_application_t::ctx_len_min bytes, they only
+ * fall back to the memory check for smaller contexts.
+ */
+#define RBPF_PROVEN_HANDLERS(X) \
+    MEM_PROVEN_HANDLERS(X, B) \
+    MEM_PROVEN_HANDLERS(X, H) \
+    MEM_PROVEN_HANDLERS(X, W) \
+    MEM_PROVEN_HANDLERS(X, DW)
+
+#define FUSED_JMP_HANDLERS(X, OPCODE) \
+    X(FUSED_ADD_JMP_ ## OPCODE ## _REG, ALU64_ADD_IMM, 2) \
+    X(FUSED_ADD_JMP_ ## OPCODE ## _IMM, ALU64_ADD_IMM, 2)
+
+/**
+ * @brief Fused handlers, running a short sequence of instructions in a single
+ *        dispatch
+ *
+ * X(name, first, len) is expanded for every handler, it replaces the handler
+ * of the first of @p len instructions, starting with a @p first instruction.
+ * The other instructions of the sequence keep their pre-decoded form, the
+ * fused handler reads their fields and jumps can still land on them. No
+ * opcode maps to these:
+ *
+ * - ZEXT32 and SEXT32 are the shifts left and right by 32 extending the low
+ *   half of a register, optionally after a MOV or (sign extension only) a
+ *   word load into it. ADD_SEXT32 adds a register between the two shifts.
+ * - LDXB_STXB stores the byte it just loaded.
+ * - ADD_JMP_* adds an immediate before a conditional jump.
+ */
+#define RBPF_FUSED_HANDLERS(X) \
+    X(FUSED_ZEXT32, ALU64_LSH_IMM, 2) \
+    X(FUSED_SEXT32, ALU64_LSH_IMM, 2) \
+    X(FUSED_ADD_SEXT32, ALU64_LSH_IMM, 3) \
+    X(FUSED_MOV_ZEXT32, ALU64_MOV_REG, 3) \
+    X(FUSED_MOV_SEXT32, ALU64_MOV_REG, 3) \
+    X(FUSED_LDXW_SEXT32, MEM_LDXW, 3) \
+    X(FUSED_LDXB_STXB, MEM_LDXB, 2) \
+    FUSED_JMP_HANDLERS(X, EQ) \
+    FUSED_JMP_HANDLERS(X, GT) \
+    FUSED_JMP_HANDLERS(X, GE) \
+    FUSED_JMP_HANDLERS(X, LT) \
+    FUSED_JMP_HANDLERS(X, LE) \
+    FUSED_JMP_HANDLERS(X, SET) \
+    FUSED_JMP_HANDLERS(X, NE) \
+    FUSED_JMP_HANDLERS(X, SGT) \
+    FUSED_JMP_HANDLERS(X, SGE) \
+    FUSED_JMP_HANDLERS(X, SLT) \
+    FUSED_JMP_HANDLERS(X, SLE)
+
+#define RBPF_HANDLER_ENUM(name) RBPF_HANDLER_ ## name,
+#define RBPF_BYTESWAP_ENUM(name, opcode, width) RBPF_HANDLER_ ## name,
+#define RBPF_VARIANT_ENUM(name, opcode) RBPF_HANDLER_ ## name,
+#define RBPF_ATOMIC_ENUM(name, opcode, op) RBPF_HANDLER_ ## name,
+#define RBPF_FUSED_ENUM(name, first, len) RBPF_HANDLER_ ## name,
+
+/**
+ * @brief Handler indices of the pre-decoded instructions
+ */
+enum {
+    RBPF_HANDLER_ILLEGAL = 0,   /**< Unknown opcode, fails when executed */
+    RBPF_OPCODE_HANDLERS(RBPF_HANDLER_ENUM)
+    RBPF_BYTESWAP_HANDLERS(RBPF_BYTESWAP_ENUM)
+    RBPF_VARIANT_HANDLERS(RBPF_VARIANT_ENUM)
+    RBPF_ATOMIC_HANDLERS(RBPF_ATOMIC_ENUM)
+    RBPF_PROVEN_HANDLERS(RBPF_HANDLER_ENUM)
+    RBPF_FUSED_HANDLERS(RBPF_FUSED_ENUM)
+    RBPF_HANDLER_COUNT,         /**< Number of handlers */
+};
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* RBPF_HANDLERS_H */
+/** @} */
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2023 Inria
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Pools of execution contexts. A pool keeps a bit per free context, taking and
+ * giving back a context are a compare and swap and an atomic or on that word,
+ * exclusive load and store loops on ARMv7-M, so any thread may run an
+ * application without a lock nor an allocation.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "assert.h"
+
+#include "rbpf.h"
+#include "rbpf/config.h"
+
+extern int rbpf_engine_run(rbpf_application_t *rbpf, size_t entry, const void *ctx,
+                           int64_t *result);
+extern void rbpf_application_instance_init(rbpf_application_t *inst,
+                                           const rbpf_application_t *rbpf, uint8_t *stack,
+                                           size_t stack_len);
+
+void rbpf_exec_pool_init(rbpf_exec_pool_t *pool, rbpf_exec_t *execs, size_t len,
+                         uint8_t *stacks, size_t stack_len)
+{
+    assert(len <= RBPF_EXEC_POOL_MAX);
+    assert(stack_len % 8 == 0);
+
+    for (size_t i = 0; i < len; i++) {
+        execs[i].stack = stack_len ? stacks + i * stack_len : NULL;
+        execs[i].stack_len = stack_len;
+    }
+    pool->execs = execs;
+    pool->free = (len == RBPF_EXEC_POOL_MAX) ? UINT32_MAX : ((uint32_t)1 << len) - 1;
+}
+
+rbpf_exec_t *rbpf_exec_acquire(rbpf_exec_pool_t *pool)
+{
+    uint32_t free = __atomic_load_n(&pool->free, __ATOMIC_RELAXED);
+
+    /* Take the lowest free context, a failed exchange reloads the free bits */
+    do {
+        if (free == 0) {
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&pool->free, &free, free & (free - 1), true,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    return &pool->execs[__builtin_ctz(free)];
+}
+
+void rbpf_exec_release(rbpf_exec_pool_t *pool, rbpf_exec_t *exec)
+{
+    __atomic_fetch_or(&pool->free, (uint32_t)1 << (exec - pool->execs), __ATOMIC_RELEASE);
+}
+
+int rbpf_exec_run_ctx(rbpf_exec_t *exec, const rbpf_application_t *rbpf, void *ctx,
+                      size_t ctx_len, int64_t *result)
+{
+    rbpf_application_t *inst = &exec->instance;
+
+    /* Concurrent runs share the pre-decoded text, it must not change */
+    assert(rbpf->flags & RBPF_FLAG_PREFLIGHT_DONE);
+
+    rbpf_application_instance_init(inst, rbpf, exec->stack, exec->stack_len);
+    rbpf_memory_region_init(&inst->arg_region, ctx, ctx_len,
+                            RBPF_MEM_REGION_READ | RBPF_MEM_REGION_WRITE);
+    return rbpf_engine_run(inst, 0, ctx, result);
+}
+
+int rbpf_application_run_pooled(const rbpf_application_t *rbpf, rbpf_exec_pool_t *pool,
+                                void *ctx, size_t ctx_len, int64_t *result)
+{
+    rbpf_exec_t *exec = rbpf_exec_acquire(pool);
+
+    if (!exec) {
+        return RBPF_EXEC_POOL_EMPTY;
+    }
+
+    int res = rbpf_exec_run_ctx(exec, rbpf, ctx, ctx_len, result);
+
+    rbpf_exec_release(pool, exec);
+    return res;
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2023 Inria
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Key/value stores of the applications. Every store is a hash table with
+ * linear probing over entries allocated by its owner, keys are never removed
+ * so a lookup stops at the first free entry.
+ *
+ * The global store and the store of an application run from a pool are
+ * updated by several threads. A new key claims its free entry with a compare
+ * and swap, then publishes the entry once its key is written. Lookups skip
+ * the entries still being claimed rather than wait for a thread that may
+ * have been preempted, so two updates racing on a new key may both insert
+ * it, the first entry in probe order holds it from then on.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "assert.h"
+
+#include "rbpf.h"
+#include "rbpf/builtin_calls.h"
+#include "rbpf/config.h"
+
+static rbpf_store_entry_t _global_entries[RBPF_STORE_GLOBAL_ENTRIES];
+static rbpf_store_t _global_store = {
+    .entries = _global_entries,
+    .mask = RBPF_STORE_GLOBAL_ENTRIES - 1,
+};
+
+/* Single free entry, the local store of the applications without one */
+static rbpf_store_entry_t _no_entry;
+static const rbpf_store_t _no_store = {
+    .entries = &_no_entry,
+};
+
+enum {
+    _ENTRY_FREE = 0,    /* Zero, so a zeroed table is empty */
+    _ENTRY_CLAIMED,     /* Taken by an update, key not yet written */
+    _ENTRY_USED,
+};
+
+static uint32_t _hash(uint32_t key)
+{
+    /* Mix the high bits into the low ones used as index */
+    key ^= key >> 16;
+    key *= 0x45d9f3b;
+    key ^= key >> 16;
+    return key;
+}
+
+/* Entry holding the key, NULL if none */
+static const rbpf_store_entry_t *_lookup(const rbpf_store_t *store, uint32_t key)
+{
+    uint32_t index = _hash(key);
+
+    for (uint32_t probe = 0; probe <= store->mask; probe++, index++) {
+        const rbpf_store_entry_t *entry = &store->entries[index & store->mask];
+        uint8_t state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+
+        if (state == _ENTRY_FREE) {
+            break;
+        }
+        if (state == _ENTRY_USED && entry->key == key) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+void rbpf_store_table_init(rbpf_store_t *store, rbpf_store_entry_t *entries, size_t capacity)
+{
+    assert(capacity && !(capacity & (capacity - 1)));
+
+    store->entries = entries;
+    store->mask = capacity - 1;
+    store->len = 0;
+    for (size_t i = 0; i < capacity; i++) {
+        entries[i].state = _ENTRY_FREE;
+    }
+}
+
+void rbpf_store_init(void)
+{
+    rbpf_store_table_init(&_global_store, _global_entries, RBPF_STORE_GLOBAL_ENTRIES);
+}
+
+int rbpf_store_fetch(const rbpf_store_t *store, uint32_t key, uint32_t *value)
+{
+    const rbpf_store_entry_t *entry = _lookup(store ? store : &_global_store, key);
+
+    *value = entry ? __atomic_load_n(&entry->value, __ATOMIC_RELAXED) : 0;
+    return RBPF_OK;
+}
+
+int rbpf_store_update(rbpf_store_t *store, uint32_t key, uint32_t value)
+{
+    if (!store) {
+        store = &_global_store;
+    }
+
+    uint32_t index = _hash(key);
+
+    for (uint32_t probe = 0; probe <= store->mask; probe++, index++) {
+        rbpf_store_entry_t *entry = &store->entries[index & store->mask];
+        uint8_t state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+
+        /* Claim a free entry, one lost to another update is looked at again */
+        while (state == _ENTRY_FREE &&
+               !__atomic_compare_exchange_n(&entry->state, &state, _ENTRY_CLAIMED, true,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {}
+
+        if (state == _ENTRY_FREE) {
+            entry->key = key;
+            entry->value = value;
+            __atomic_store_n(&entry->state, _ENTRY_USED, __ATOMIC_RELEASE);
+            __atomic_fetch_add(&store->len, 1, __ATOMIC_RELAXED);
+            return RBPF_OK;
+        }
+        if (state == _ENTRY_USED && entry->key == key) {
+            __atomic_store_n(&entry->value, value, __ATOMIC_RELAXED);
+            return RBPF_OK;
+        }
+    }
+    return RBPF_STORE_FULL;
+}
+
+static uint32_t _vm_store(rbpf_store_t *store, uint64_t *regs)
+{
+    return (uint32_t)rbpf_store_update(store, (uint32_t)regs[1], (uint32_t)regs[2]);
+}
+
+static uint32_t _vm_fetch(rbpf_application_t *rbpf, const rbpf_store_t *store, uint64_t *regs)
+{
+    uint32_t *value = (uint32_t *)(uintptr_t)regs[2];
+
+    if (!rbpf_store_allowed(rbpf, value, sizeof(*value))) {
+        return (uint32_t)RBPF_ILLEGAL_MEM;
+    }
+    return (uint32_t)rbpf_store_fetch(store, (uint32_t)regs[1], value);
+}
+
+uint32_t rbpf_vm_store_local(rbpf_application_t *rbpf, uint64_t *regs)
+{
+    /* Without a local store there is no room for any key */
+    if (!rbpf->store) {
+        return (uint32_t)RBPF_STORE_FULL;
+    }
+    return _vm_store(rbpf->store, regs);
+}
+
+uint32_t rbpf_vm_store_global(rbpf_application_t *rbpf, uint64_t *regs)
+{
+    (void)rbpf;
+    return _vm_store(&_global_store, regs);
+}
+
+uint32_t rbpf_vm_fetch_local(rbpf_application_t *rbpf, uint64_t *regs)
+{
+    /* Without a local store every key reads as never stored */
+    return _vm_fetch(rbpf, rbpf->store ? rbpf->store : &_no_store, regs);
+}
+
+uint32_t rbpf_vm_fetch_global(rbpf_application_t *rbpf, uint64_t *regs)
+{
+    return _vm_fetch(rbpf, &_global_store, regs);
+}
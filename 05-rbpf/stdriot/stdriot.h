@@ -54,6 +54,11 @@ extern ssize_t copy_file(const char *name, void *buf, size_t nbyte);
 
 extern int get_file_size(const char *name, size_t *size);
 
+#if defined(STDRIOT_FILE_ADDRESS) && STDRIOT_FILE_ADDRESS
+/* Needs a xipfs exporting the address of the files in its user syscalls */
+extern int get_file_address(const char *name, const void **addr);
+#endif
+
 extern void *memset(void *m, int c, size_t n);
 
 #endif /* STDRIOT_H */
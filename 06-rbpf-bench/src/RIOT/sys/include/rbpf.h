@@ -34,12 +34,20 @@
  *
  * ```
  * static uint8_t _bpf_stack[RBPF_STACK_SIZE];
+ * static rbpf_insn_t _bpf_insns[RBPF_INSNS_MAX(sizeof(test_app))];
  * rbpf_application_t rbpf = { 0 };
- * rbpf_application_setup(&rbpf, _bpf_stack, (const rbpf_application_t*)&test_app, sizeof(test_app));
+ * rbpf_application_setup(&rbpf, _bpf_stack, (const rbpf_application_t*)&test_app, sizeof(test_app),
+ *                        _bpf_insns, ARRAY_SIZE(_bpf_insns));
  * int64_t exec_result;
  * int result = rbpf_application_run_ctx(&rbpf, NULL, 0, &exec_result);
  * ```
  *
+ * The application buffer is written to when the application writes to its
+ * data section. An application stored in read-only memory, such as the memory
+ * mapped flash of a file system, is set up with
+ * @ref rbpf_application_setup_xip instead. It runs from where it is stored and
+ * only its data section is copied to a RAM buffer supplied by the caller.
+ *
  * The result returned from @ref rbpf_application_run_ctx is the return code of
  * the virtual machine itself and indicates whether the application inside
  * executed correctly. The result argument of the function contains the value
@@ -64,6 +72,146 @@
  * } foo;
  *```
  *
+ * ### Fuel
+ *
+ * A run may execute as many instructions as rbpf_application_t::fuel, set to
+ * `RBPF_FUEL_ALLOWED` by the setup and adjustable afterwards. Straight-line
+ * code and forward jumps are free: only a jump going back charges the fuel,
+ * with the number of instructions between its target and itself, once per
+ * loop iteration. A run thus executes at most its fuel plus twice the number
+ * of instructions of the application, it stops with @ref RBPF_OUT_OF_BRANCHES
+ * on the first jump the fuel left can't pay for.
+ *
+ * Applications the verifier proves to terminate run without charging any
+ * fuel, the pre-flight checks set @ref RBPF_FLAG_TERMINATES in
+ * rbpf_application_t::flags for them. Applications without loops are proven,
+ * and so are loops counting a register by a constant step towards a bound
+ * compared unsigned, either a constant or a value of known range such as a
+ * byte, one checked against a maximum beforehand or a context field given a
+ * maximum with @ref rbpf_application_set_ctx_bounds. Each loop must also run
+ * at most `RBPF_LOOP_TRIPS_MAX` iterations, and all the loops together, the
+ * ones inside a loop once per iteration of it, must charge at most
+ * `RBPF_LOOP_WORK_MAX` fuel. The proof needs the range analysis.
+ *
+ * ### Local function calls
+ *
+ * An application built from several C functions calls the ones clang didn't
+ * inline with a `call` instruction whose source register is 1
+ * (`BPF_PSEUDO_CALL`), its immediate is the number of instructions from the
+ * next instruction to the called function, also in a compressed text. The
+ * called function gets the arguments in r1-r5 and returns in r0, r6-r9 are
+ * restored on its return. It runs with its own stack frame of
+ * `RBPF_CALL_FRAME_SIZE` bytes, right below the frame of its caller in the
+ * 512 bytes stack: r10 points to the end of it.
+ *
+ * The pre-flight checks split the text into the functions starting at the
+ * called instructions. Jumps must stay in their function, the instruction
+ * before a function must end the previous one, the stack accesses relative to
+ * r10 must stay in their frame and r10 must never be written. Calls can't
+ * recurse and at most `RBPF_CALL_DEPTH_MAX` frames, the one of the first
+ * function included, may be active at once. The return addresses and the
+ * registers saved by the calls are kept by the engine, out of reach of the
+ * application.
+ *
+ * ### Jump tables
+ *
+ * A `switch` over a dense range of values runs in a single jump with the
+ * `BPF_INSTRUCTION_JMP_TABLE` instruction, indexed by its destination
+ * register. Its immediate is the offset of the table in the read-only data, 4
+ * bytes aligned: a `uint32_t` number of entries, the entries and a last
+ * default entry, taken by the indices past the table. Every entry is the
+ * index of an instruction in the uncompressed text, also with a compressed
+ * one. `gen_rbf.py generate --jump-tables` replaces the comparisons clang
+ * emits for a `switch` with such a table.
+ *
+ * The pre-flight checks verify the table once: it must fit in the read-only
+ * data and every entry must be an instruction of the function of the jump.
+ * The run then only bounds the index. An entry going back charges the fuel
+ * like a jump going back.
+ *
+ * ### Tail calls
+ *
+ * An application ends its run by starting another one with the
+ * `BPF_FUNC_BPF_TAIL_CALL` function of `rbpf/builtin_shared.h`, which takes
+ * the index of the next application in r1. The caller gives every
+ * application of a chain its array of the applications it can start, with
+ * @ref rbpf_application_set_prog_array. The next application runs from its
+ * first instruction with the context of the current one and its registers
+ * freshly initialized, its result is the result of the chain. The
+ * applications of a chain may share one stack, only one of them runs at a
+ * time.
+ *
+ * A chain makes at most `RBPF_TAIL_CALLS_MAX` tail calls and every
+ * application of it charges its own fuel. A tail call to an empty entry, past
+ * the end of the array or past the end of the chain returns -1 in r0 to the
+ * application, which continues.
+ *
+ * ### Stack depth
+ *
+ * The pre-flight checks compute how many bytes below r10 the application
+ * reaches, its stack depth, read with @ref rbpf_application_stack_depth. An
+ * application set up without a stack gets one of at least its depth with
+ * @ref rbpf_application_set_stack, r10 then points to the end of it:
+ *
+ * ```
+ * rbpf_application_setup(&rbpf, NULL, app, app_len, insns, insns_len);
+ * rbpf_application_verify_preflight(&rbpf);
+ * rbpf_application_set_stack(&rbpf, stack, rbpf_application_stack_depth(&rbpf));
+ * ```
+ *
+ * The depth covers the accesses relative to r10 and to the stack addresses
+ * derived from it, including the ones passed to the external functions,
+ * rounded up to 8 bytes. An application passing a stack address to a
+ * function of its own, storing one to memory or keeping one in r6-r9 across
+ * an external call, as well as one the range analysis gives up on, needs the
+ * whole `RBPF_STACK_SIZE` bytes. An application that never touches its stack
+ * has a depth of 0 and runs without any, its memory checks then have one
+ * region less to look at. A run with a stack smaller than the depth fails
+ * with @ref RBPF_ILLEGAL_STACK.
+ *
+ * ### Key/value store
+ *
+ * Applications keep state across runs in key/value stores of 32 bit keys and
+ * values, through the functions of `rbpf/builtin_shared.h`:
+ *
+ * - `BPF_FUNC_BPF_STORE_LOCAL` and `BPF_FUNC_BPF_STORE_GLOBAL` store the value
+ *   in r2 under the key in r1
+ * - `BPF_FUNC_BPF_FETCH_LOCAL` and `BPF_FUNC_BPF_FETCH_GLOBAL` write the value
+ *   of the key in r1 to the address in r2, 0 for a key never stored
+ *
+ * They return 0 on success, @ref RBPF_STORE_FULL when a new key finds no free
+ * entry and @ref RBPF_ILLEGAL_MEM when the application may not write the
+ * fetched value to r2. The global store is shared by all the applications,
+ * it holds `RBPF_STORE_GLOBAL_ENTRIES` keys and @ref rbpf_store_init empties
+ * it. The local store of an application is a table supplied by the caller
+ * with @ref rbpf_application_set_store, an application without one has every
+ * key at 0 and can't store any.
+ *
+ * Both are fixed-capacity hash tables with open addressing: the entries are
+ * allocated once, a key is found in a constant number of probes on average
+ * and keys are never removed.
+ *
+ * ### Memory functions
+ *
+ * Copying, filling, comparing and searching buffers go through functions of
+ * `rbpf/builtin_shared.h` instead of loops of loads and stores, each one
+ * checks the whole ranges it accesses against the memory regions once and
+ * then goes through them natively, a word at a time:
+ *
+ * - `BPF_FUNC_BPF_MEMCPY` copies r3 bytes from the address in r2 to the one
+ *   in r1, the ranges may overlap
+ * - `BPF_FUNC_BPF_MEMSET` fills r3 bytes from the address in r1 with the low
+ *   byte of r2
+ * - `BPF_FUNC_BPF_MEMCMP` compares r3 bytes at the addresses in r1 and r2,
+ *   returns 0 when they are equal, -1 or 1 when the first different byte at
+ *   r1 is lower or higher
+ * - `BPF_FUNC_BPF_MEMCHR` returns the offset of the first byte equal to the
+ *   low byte of r2 in the r3 bytes from the address in r1, -1 if there is none
+ *
+ * They return @ref RBPF_ILLEGAL_MEM when the application may not access one
+ * of the ranges or r3 is over 2 GiB, the run goes on. The memory copy and
+ * fill return 0 otherwise.
+ *
  * ### Memory protection
  *
  * The memory space of the virtual machine is shared with the host system, no
@@ -90,6 +238,11 @@
  * The rbpf engine itself ensures correct memory permissions to the application
  * regions, stack and context struct.
  *
+ * The regions are kept in a table per access kind, sorted on their start
+ * address. A check first tries the region of the previous allowed access of
+ * the same kind, then the context struct and finally does a binary search in
+ * the table. At most @ref RBPF_REGIONS_MAX regions fit in a table.
+ *
  * ### Application format
  *
  * The binary format of a full application consists of:
@@ -110,6 +263,104 @@
  *  the text section. No assumption must be made on the alignment of the other
  *  sections
  *
+ *  With the @ref RBPF_HEADER_COMPRESSED flag, the text section holds every
+ *  instruction with only the fields its class uses, as written by
+ *  `gen_rbf.py generate --compress`: the opcode and the registers bytes,
+ *  followed by the 16 bits offset of the memory accesses and the jumps, and by
+ *  the 32 bits immediate of the instructions using one. Double word loads take
+ *  10 bytes with their 64 bits immediate, jump offsets count bytes from the end
+ *  of the jump, local calls keep their immediate in instructions. The
+ *  pre-flight checks expand it into the same pre-decoded instructions, the
+ *  text section has no alignment constraint then. Opcodes unknown to the
+ *  virtual machine are rejected at load time.
+ *
+ *  The list of functions holds a @ref rbpf_function_t per global function of
+ *  the application, with its name in the read-only data and the byte offset of
+ *  its first instruction in the uncompressed text section, also with a
+ *  compressed one. @ref rbpf_application_function resolves a name once to the
+ *  index of the function, @ref rbpf_application_run_function then runs the
+ *  application from it. One loaded and verified application thereby serves
+ *  several hooks, every function entry is checked by the pre-flight checks
+ *  like the first instruction.
+ *
+ * ### Pre-decoded instructions
+ *
+ * The application text is never executed as is. The pre-flight checks lower
+ * it once into an array of @ref rbpf_insn_t supplied by the caller during the
+ * setup: jump targets and local calls are resolved to absolute pointers,
+ * calls to helpers to the function they invoke, double word loads to a single
+ * 64 bit immediate and byte swaps to the handler of their width.
+ * The engine only runs this pre-decoded form. The array needs one entry per 8
+ * bytes instruction of the text section, @ref RBPF_INSNS_MAX gives an upper
+ * bound from the size of the whole application, @ref RBPF_INSNS_MAX_COMPRESSED
+ * for a compressed one.
+ *
+ * The pre-flight checks also run a range analysis over the application. It
+ * tracks for every register whether it holds a number or points into the
+ * stack, the context, the data or the read-only data, together with the range
+ * of its value or offset. Memory accesses proven to stay inside their memory
+ * region run without the memory check. Accesses to the context are proven
+ * against the largest offset used, and are only unchecked when the context
+ * given to @ref rbpf_application_run_ctx is at least that large. Helpers
+ * called by the application must not modify the r10 register.
+ *
+ * On targets with 32 bit pointers, the analysis also tracks which registers
+ * have their upper 32 bits proven zero. When no instruction reads a non-zero
+ * upper half, the engine runs the application with a register file of
+ * `uint32_t`: most instructions, such as the additions, the 32 bit ALU
+ * instructions, the loads and the memory addresses, only need the low halves.
+ * Comparisons, 64 bit shifts and divisions, double word stores, 64 bit big
+ * endian byte swaps and the returned r0 need upper halves proven zero, calls
+ * keep the application on the 64 bit registers. When such an application
+ * fails, the result only holds the low 32 bits of r0. Setting
+ * `RBPF_ENABLE_REG32` to 0 disables the mode.
+ *
+ * Last, common sequences of two or three instructions, such as the shifts
+ * extending the low half of a register or an addition followed by a
+ * conditional jump, are fused into a single handler and save the dispatches
+ * between them. The memory checks and the fuel are unchanged.
+ * Building with `RBPF_ENABLE_FUSION_STATS` counts the saved dispatches in
+ * rbpf_application_t::dispatches_fused.
+ *
+ * ### Native code
+ *
+ * On ARMv7-M targets built with `RBPF_ENABLE_JIT`, @ref rbpf_jit_compile
+ * translates the pre-decoded instructions to Thumb-2 code in a caller supplied
+ * buffer. The native code keeps the semantics of the interpreter: the memory
+ * accesses are checked against the same regions, the fuel is charged the
+ * same way and errors return the same codes. Every instruction uses about 20 to
+ * 50 bytes of native code, the big endian byte swaps map to the REV and REV16
+ * instructions.
+ *
+ * ```
+ * static uint8_t _bpf_jit[2048] __attribute__((aligned(4)));
+ * if (rbpf_jit_compile(&rbpf, _bpf_jit, sizeof(_bpf_jit)) < 0) {
+ *     // keep interpreting the application
+ * }
+ * ```
+ *
+ * ### Profiling
+ *
+ * Building with `RBPF_ENABLE_PROFILE` counts, for every instruction of an
+ * application given a profile with @ref rbpf_application_set_profile, the
+ * times it ran, the times a jump was taken and the memory checks the region
+ * of the previous access didn't answer. The external function calls are the
+ * runs of their call instruction. The counters are indexed like the
+ * uncompressed text, @ref rbpf_profile_dump hands over the ones of the
+ * instructions that ran, and `gen_rbf.py profile` lays them over the
+ * disassembly of the application with the totals of every opcode.
+ *
+ * ```
+ * static rbpf_profile_entry_t _bpf_counters[RBPF_INSNS_MAX(sizeof(test_app))];
+ * rbpf_profile_t profile;
+ * rbpf_profile_init(&profile, _bpf_counters, ARRAY_SIZE(_bpf_counters));
+ * rbpf_application_set_profile(&rbpf, &profile);
+ * ```
+ *
+ * The applications with a profile are interpreted, the fusion is off by
+ * default so that every instruction is counted on its own. Without
+ * `RBPF_ENABLE_PROFILE` the engine has no trace of the counters.
+ *
  * @{
  *
  * @file
@@ -130,15 +381,38 @@ extern "C" {
 #endif
 
 /**
- * @brief Stack size inside the virtual machine, fixed size per specification
+ * @brief Stack size inside the virtual machine, the largest stack depth of an
+ *        application
  */
 #define RBPF_STACK_SIZE  (512)
 
+/**
+ * @brief Stack frame of every function of an application making local calls
+ */
+#define RBPF_CALL_FRAME_SIZE  (RBPF_STACK_SIZE / RBPF_CALL_DEPTH_MAX)
+
+/**
+ * @brief Upper bound on the number of pre-decoded instructions required for
+ *        an application of @p len bytes
+ */
+#define RBPF_INSNS_MAX(len) ((len) / 8)
+
+/**
+ * @brief Upper bound on the number of pre-decoded instructions required for
+ *        an application of @p len bytes with a compressed text section
+ */
+#define RBPF_INSNS_MAX_COMPRESSED(len) ((len) / 2)
+
 /**
  * @brief Magic number for the header
  */
 #define RBPF_MAGIC_NO (0x72425046)
 
+/**
+ * @brief Header flag of the applications with a compressed text section
+ */
+#define RBPF_HEADER_COMPRESSED  0x01
+
 /**
  * @brief Header for rBPF applications
  */
@@ -165,6 +439,7 @@ typedef struct __attribute__((packed)) {
  * @brief rBPF Virtual Machine exit codes
  */
 enum {
+    RBPF_TAIL_CALL              = 2,    /**< Next application started, never returned to user */
     RBPF_CONTINUE               = 1,    /**< Next instruction, never returned to user */
     RBPF_OK                     = 0,    /**< Successful execution */
     RBPF_ILLEGAL_INSTRUCTION    = -1,   /**< Failed on instruction parsing */
@@ -174,8 +449,15 @@ enum {
     RBPF_ILLEGAL_LEN            = -5,   /**< Invalid length of application */
     RBPF_ILLEGAL_REGISTER       = -6,   /**< Instruction register argument invalid */
     RBPF_NO_RETURN              = -7,   /**< No valid return found in the application code */
-    RBPF_OUT_OF_BRANCHES        = -8,   /**< Number of branches taken is more than allowed */
+    RBPF_OUT_OF_BRANCHES        = -8,   /**< Application ran out of fuel */
     RBPF_ILLEGAL_DIV            = -9,   /**< Divide by zero error in instructions */
+    RBPF_JIT_UNAVAILABLE        = -10,  /**< No native code compiler for this platform */
+    RBPF_STORE_FULL             = -11,  /**< No free entry left in the key/value store */
+    RBPF_ILLEGAL_FUNCTION       = -12,  /**< Function not found in the application */
+    RBPF_EXEC_POOL_EMPTY        = -13,  /**< No free execution context left in the pool */
+    RBPF_ILLEGAL_STACK          = -14,  /**< Stack smaller than the stack depth of the application */
+    RBPF_PROFILE_UNAVAILABLE    = -15,  /**< Engine built without the profiling */
+    RBPF_ILLEGAL_CTX            = -16,  /**< Context field above its declared maximum */
 };
 
 /**
@@ -204,30 +486,193 @@ struct rbpf_mem_region {
     uint8_t flags;              /**< Permission flags */
 };
 
+/**
+ * @brief Maximum number of memory regions in the lookup table of each access
+ *        kind, the context region excluded
+ *
+ * The stack, data and read-only data regions take up to three entries. When
+ * more regions are added the engine falls back to walking the linked list.
+ */
+#ifndef RBPF_REGIONS_MAX
+#define RBPF_REGIONS_MAX    (8)
+#endif
+
+/**
+ * @brief Entry of the memory region lookup table
+ */
+typedef struct {
+    uintptr_t start;    /**< Start address of the region */
+    uintptr_t end;      /**< End address of the region, exclusive */
+    uintptr_t reach;    /**< Highest end address of this entry and the ones before */
+} rbpf_region_entry_t;
+
+/**
+ * @brief Memory regions allowing one kind of access, sorted on start address
+ */
+typedef struct {
+    rbpf_region_entry_t entries[RBPF_REGIONS_MAX];  /**< Regions */
+    uint8_t len;                                    /**< Number of entries used */
+    uint8_t last;                                   /**< Entry of the last allowed access */
+} rbpf_region_table_t;
+
+/**
+ * @brief Maximum of a context field, see @ref rbpf_application_set_ctx_bounds
+ */
+typedef struct {
+    uint16_t offset;    /**< Offset of the field in the context */
+    uint8_t size;       /**< Size of the field in bytes, 1, 2 or 4 */
+    uint32_t max;       /**< Largest value of the field */
+} rbpf_ctx_bound_t;
+
 /**
  * @name Internal rBPF struct flags
  * @{
  */
 #define RBPF_FLAG_SETUP_DONE        0x01    /**< Initial setup of vm done */
 #define RBPF_FLAG_PREFLIGHT_DONE    0x02    /**< Pre-flight checks executed at least once */
+#define RBPF_FLAG_REGIONS_OVERFLOW  0x04    /**< Regions don't fit in the lookup tables */
+#define RBPF_FLAG_REG32             0x08    /**< Application runs with 32 bit registers */
+#define RBPF_FLAG_TERMINATES        0x10    /**< Application is proven to terminate, runs without fuel */
+#define RBPF_FLAG_CALLS             0x20    /**< Application makes local function calls */
+#define RBPF_FLAG_INSTANCE          0x40    /**< Run state of an execution context, see @ref rbpf_exec_t */
 #define RBPF_CONFIG_NO_RETURN       0x0100  /**< Script doesn't need to have a return */
 /** @} */
 
 /**
- * @brief rBPF application
+ * @brief Forward declaration of the pre-decoded instruction
+ */
+typedef struct rbpf_insn rbpf_insn_t;
+
+/**
+ * @brief Forward declaration of the rBPF application
+ */
+struct rbpf_application;
+
+/**
+ * @brief Entry of a key/value store
  */
 typedef struct {
+    uint32_t key;       /**< Key of the entry */
+    uint32_t value;     /**< Value stored under the key */
+    uint8_t state;      /**< Free, being claimed by an update or holding a key */
+} rbpf_store_entry_t;
+
+/**
+ * @brief Key/value store, a hash table with open addressing
+ */
+typedef struct {
+    rbpf_store_entry_t *entries;    /**< Entries of the table */
+    uint32_t mask;                  /**< Number of entries minus one */
+    uint32_t len;                   /**< Number of entries holding a key */
+} rbpf_store_t;
+
+/**
+ * @brief Applications started by the tail calls of an application
+ */
+typedef struct {
+    struct rbpf_application **entries;  /**< Applications, NULL for an empty entry */
+    uint32_t len;                       /**< Number of entries */
+} rbpf_prog_array_t;
+
+/**
+ * @brief Counters of one instruction in a profile
+ */
+typedef struct {
+    uint32_t count;     /**< Runs of the instruction */
+    uint32_t taken;     /**< Runs taking the jump, for a jump */
+    uint32_t misses;    /**< Memory checks missing the region of the previous access */
+} rbpf_profile_entry_t;
+
+/**
+ * @brief Execution profile of an application, see `RBPF_ENABLE_PROFILE`
+ */
+typedef struct {
+    rbpf_profile_entry_t *entries;  /**< Counters, indexed like the instructions */
+    size_t len;                     /**< Number of entries */
+    rbpf_profile_entry_t *current;  /**< Counters of the instruction running */
+} rbpf_profile_t;
+
+/**
+ * @brief Called by @ref rbpf_profile_dump for every instruction that ran
+ *
+ * @param pc    Index of the instruction in the uncompressed text
+ * @param entry Counters of the instruction
+ * @param arg   Argument given to @ref rbpf_profile_dump
+ */
+typedef void (*rbpf_profile_print_t)(size_t pc, const rbpf_profile_entry_t *entry, void *arg);
+
+/**
+ * @brief Entry point of an application compiled to native code
+ *
+ * @param rbpf  rBPF application being run
+ * @param regs  Register state of the virtual machine, initialized by the engine
+ * @param fuel  Fuel of the run
+ * @param entry Pre-decoded instruction the run starts from
+ *
+ * @return  execution result of the virtual machine, negative on error
+ */
+typedef int (*rbpf_jit_fn_t)(struct rbpf_application *rbpf, uint64_t *regs, uint32_t fuel,
+                             uint32_t entry);
+
+/**
+ * @brief rBPF application
+ */
+typedef struct rbpf_application {
     rbpf_mem_region_t stack_region;     /**< Memory permission region for the stack */
     rbpf_mem_region_t rodata_region;    /**< Memory permissions for the application read-only data */
     rbpf_mem_region_t data_region;      /**< Memory permissions for the application data region */
     rbpf_mem_region_t arg_region;       /**< Memory region for the caller-supplied arguments */
+    rbpf_region_table_t load_regions;   /**< Lookup table of the readable regions */
+    rbpf_region_table_t store_regions;  /**< Lookup table of the writable regions */
     const void *application;            /**< Application header */
     size_t application_len;             /**< Application length */
-    uint8_t *stack;                     /**< VM stack, must be  and aligned */
+    uint8_t *data;                      /**< Data section used by the application */
+    uint8_t *stack;                     /**< VM stack, 8 bytes aligned */
+    uint32_t stack_len;                 /**< Size of the VM stack in bytes */
+    uint32_t stack_depth;               /**< Stack bytes the application needs, from the pre-flight checks */
+    rbpf_insn_t *insns;                 /**< Pre-decoded application text */
+    size_t insns_len;                   /**< Number of entries in the insns array */
+    size_t num_insns;                   /**< Number of pre-decoded instructions in use */
+    rbpf_jit_fn_t jit;                  /**< Native code of the application, NULL if none */
+    uint32_t ctx_len_min;               /**< Context length the proven context accesses need */
+    const rbpf_ctx_bound_t *ctx_bounds; /**< Maxima of the context fields, NULL if none */
+    uint8_t ctx_bounds_len;             /**< Number of entries in ctx_bounds */
     uint16_t flags;                     /**< State flags for the virtual machine */
-    uint32_t branches_remaining;        /**< Number of allowed branch instructions remaining */
+    uint32_t fuel;                      /**< Instructions a run may charge, see RBPF_FUEL_ALLOWED */
+    uint32_t dispatches_fused;          /**< Dispatches saved by fused handlers, if counted */
+    rbpf_store_t *store;                /**< Local key/value store, NULL if none */
+    const rbpf_prog_array_t *progs;     /**< Applications of the tail calls, NULL if none */
+    uint8_t tail_calls;                 /**< Tail calls left to the chain being run */
+    rbpf_profile_t *profile;            /**< Counters of the runs, NULL if none */
 } rbpf_application_t;
 
+/**
+ * @brief Execution context, the state of one run of an application
+ *
+ * The instance holds the context and the memory regions of the run and
+ * points to its stack, it shares the pre-decoded text, the native code and the
+ * data section of the application it runs. Several threads can so run the
+ * same application at once, each in its own execution context.
+ */
+typedef struct {
+    rbpf_application_t instance;    /**< Run state */
+    uint8_t *stack;                 /**< Stack of the run, NULL if none */
+    size_t stack_len;               /**< Size of the stack in bytes */
+} rbpf_exec_t;
+
+/**
+ * @brief Maximum number of execution contexts in a pool
+ */
+#define RBPF_EXEC_POOL_MAX  (32)
+
+/**
+ * @brief Fixed size pool of execution contexts, safe to use from any thread
+ */
+typedef struct {
+    rbpf_exec_t *execs;     /**< Execution contexts */
+    uint32_t free;          /**< Bit set for every free context */
+} rbpf_exec_pool_t;
+
 /**
  * @brief rBPF syscall interface function
  *
@@ -236,26 +681,180 @@ typedef struct {
  */
 typedef uint32_t (*rbpf_call_t)(rbpf_application_t *rbpf, uint64_t *regs);
 
+/**
+ * @name Flags of the pre-decoded instructions
+ * @{
+ */
+#define RBPF_INSN_TARGET            0x01    /**< Targeted by a jump */
+#define RBPF_INSN_DATA              0x02    /**< Double word load of a data address */
+#define RBPF_INSN_RODATA            0x04    /**< Double word load of a read-only data address */
+#define RBPF_INSN_FUNCTION          0x08    /**< First instruction of a function called locally */
+/** @} */
+
+/**
+ * @brief Pre-decoded instruction, produced by the pre-flight checks
+ *
+ * Every bytecode instruction maps to one entry, at the same index. The
+ * second half of a double word load is kept as an illegal instruction, with the
+ * upper half of the immediate.
+ */
+struct rbpf_insn {
+    uint8_t handler;                /**< Index of the engine handler */
+    uint8_t dst;                    /**< Destination register */
+    uint8_t src;                    /**< Source register */
+    uint8_t flags;                  /**< Instruction flags, see @ref RBPF_INSN_TARGET */
+    union {
+        int32_t offset;             /**< Memory access offset */
+        const rbpf_insn_t *target;  /**< Resolved jump target */
+        const uint32_t *table;      /**< Entries of a jump table, in the read-only data */
+        rbpf_call_t call;           /**< Resolved called function */
+    };
+    int64_t immediate;              /**< Sign extended immediate, double word load value or
+                                         number of entries of a jump table */
+};
+
 /**
  * @brief Initialize a new rBPF application
  *
  * @param rbpf              rBPF application to initialize
- * @param stack             Stack space to use for this application, must be 512 bytes
+ * @param stack             Stack space to use for this application, must be 512 bytes,
+ *                          NULL when given later with @ref rbpf_application_set_stack
  * @param application       Application to load
  * @param application_len   Size of the whole application (including header) in bytes
+ * @param insns             Storage for the pre-decoded application text
+ * @param insns_len         Number of entries in @p insns, see @ref RBPF_INSNS_MAX
  */
 void rbpf_application_setup(rbpf_application_t *rbpf, uint8_t *stack,
-                            const rbpf_application_t *application, size_t application_len);
+                            const rbpf_application_t *application, size_t application_len,
+                            rbpf_insn_t *insns, size_t insns_len);
+
+/**
+ * @brief Initialize a new rBPF application executed in place
+ *
+ * The application is left where it is stored, for example in the memory
+ * mapped flash of a file system, only its data section is copied to @p data.
+ *
+ * @param rbpf              rBPF application to initialize
+ * @param stack             Stack space to use for this application, must be 512 bytes,
+ *                          NULL when given later with @ref rbpf_application_set_stack
+ * @param application       Application to load
+ * @param application_len   Size of the whole application (including header) in bytes
+ * @param insns             Storage for the pre-decoded application text
+ * @param insns_len         Number of entries in @p insns, see @ref RBPF_INSNS_MAX
+ * @param data              RAM receiving the data section of the application
+ * @param data_len          Size of @p data in bytes
+ *
+ * @return  RBPF_OK on success
+ * @return  RBPF_ILLEGAL_LEN when the data section doesn't fit in @p data
+ */
+int rbpf_application_setup_xip(rbpf_application_t *rbpf, uint8_t *stack,
+                               const rbpf_application_t *application, size_t application_len,
+                               rbpf_insn_t *insns, size_t insns_len,
+                               uint8_t *data, size_t data_len);
 
 /**
  * @brief Manually run the pre-flight checks for an application
  *
+ * Also lowers the application text into the pre-decoded instructions.
+ *
  * @param   rbpf    rBPF application to run the checks for
  *
  * @return  Negative on error
  */
 int rbpf_application_verify_preflight(rbpf_application_t *rbpf);
 
+/**
+ * @brief Give an application a stack sized after its stack depth
+ *
+ * Runs the pre-flight checks if not yet done, they compute the depth. The
+ * regions added to the application are kept.
+ *
+ * @param   rbpf        rBPF application
+ * @param   stack       Stack of the application, 8 bytes aligned, NULL if none
+ * @param   stack_len   Size of @p stack in bytes, a multiple of 8
+ *
+ * @return  RBPF_OK on success, negative on error of the pre-flight checks
+ * @return  RBPF_ILLEGAL_STACK when @p stack_len is below the stack depth
+ */
+int rbpf_application_set_stack(rbpf_application_t *rbpf, uint8_t *stack, size_t stack_len);
+
+/**
+ * @brief Declare the maximum of context fields
+ *
+ * The range analysis then bounds the loops by these fields, but for the loads
+ * that may follow a store of the application to one of them. Every run checks
+ * the fields of its context first and stops with @ref RBPF_ILLEGAL_CTX when a
+ * field is missing or above its maximum. The context must not overlap the
+ * stack or the data of the application.
+ *
+ * The pre-flight checks run again on the next run, compile the native code
+ * again afterwards.
+ *
+ * @param   rbpf        rBPF application
+ * @param   bounds      Maxima of the fields, kept by the application, NULL if none
+ * @param   len         Number of entries in @p bounds
+ *
+ * @return  RBPF_OK on success
+ * @return  RBPF_ILLEGAL_LEN when a field isn't 1, 2 or 4 bytes or @p len is
+ *          above 255
+ */
+int rbpf_application_set_ctx_bounds(rbpf_application_t *rbpf, const rbpf_ctx_bound_t *bounds,
+                                    size_t len);
+
+/**
+ * @brief Count the runs of the application in a profile
+ *
+ * Runs the pre-flight checks if not yet done. The counters are incremented
+ * without atomics, the concurrent runs of @ref rbpf_exec_run_ctx share the
+ * profile of the application and may lose counts.
+ *
+ * @param   rbpf        rBPF application
+ * @param   profile     Profile to count the runs in, NULL to stop counting
+ *
+ * @return  RBPF_OK on success, negative on error of the pre-flight checks
+ * @return  RBPF_ILLEGAL_LEN when @p profile has less entries than instructions
+ * @return  RBPF_PROFILE_UNAVAILABLE when built without `RBPF_ENABLE_PROFILE`
+ */
+int rbpf_application_set_profile(rbpf_application_t *rbpf, rbpf_profile_t *profile);
+
+/**
+ * @brief Initialize a profile with all its counters at zero
+ *
+ * @param   profile     The profile to initialize
+ * @param   entries     Counters of the profile
+ * @param   len         Number of @p entries, see @ref RBPF_INSNS_MAX
+ */
+void rbpf_profile_init(rbpf_profile_t *profile, rbpf_profile_entry_t *entries, size_t len);
+
+/**
+ * @brief Hand over the counters of the instructions that ran
+ *
+ * @param   profile     The profile
+ * @param   print       Called for every instruction that ran, in text order
+ * @param   arg         Passed to @p print
+ *
+ * @return  Number of instructions that ran
+ */
+size_t rbpf_profile_dump(const rbpf_profile_t *profile, rbpf_profile_print_t print, void *arg);
+
+/**
+ * @brief Compile the pre-decoded application to native code
+ *
+ * Runs the pre-flight checks if not yet done. On success the engine executes
+ * the native code instead of interpreting the application. The buffer must be
+ * executable and stay valid as long as the application is run, the code
+ * inside doesn't depend on its location.
+ *
+ * @param   rbpf    rBPF application to compile
+ * @param   buf     Buffer receiving the native code
+ * @param   len     Size of @p buf in bytes
+ *
+ * @return  RBPF_OK on success
+ * @return  RBPF_ILLEGAL_LEN when @p buf is too small
+ * @return  RBPF_JIT_UNAVAILABLE when not supported on this platform
+ */
+int rbpf_jit_compile(rbpf_application_t *rbpf, void *buf, size_t len);
+
 /**
  * @brief Execute the rBPF virtual machine with a supplied context.
  *
@@ -270,6 +869,145 @@ int rbpf_application_verify_preflight(rbpf_application_t *rbpf);
  */
 int rbpf_application_run_ctx(rbpf_application_t *rbpf, void *ctx, size_t ctx_size, int64_t *result);
 
+/**
+ * @brief Execute the rBPF virtual machine once per context of a batch
+ *
+ * Same as calling @ref rbpf_application_run_ctx on every context, the
+ * pre-flight checks and the setup of the context region are only done once
+ * for the whole batch. The contexts are all @p ctx_size bytes long and start
+ * every @p stride bytes from @p ctxs, a stride of 0 runs the application
+ * @p count times over the same context.
+ *
+ * The runs stop at the first one failing, the results of the runs before it
+ * are stored. The instance of an execution context can't run a batch when
+ * its application has tail calls, a tail call turns it into the next
+ * application.
+ *
+ * @param   rbpf        rBPF application to launch
+ * @param   ctxs        First context of the batch
+ * @param   ctx_size    Size of a context in bytes
+ * @param   stride      Distance in bytes between two contexts
+ * @param   count       Number of contexts
+ * @param   results     Results of the application, one per context
+ *
+ * @returns RBPF_OK when every run succeeded, the negative error of the first
+ *          failing run otherwise
+ * @returns RBPF_ILLEGAL_CALL for the instance of an execution context with
+ *          tail calls
+ */
+int rbpf_application_run_batch(rbpf_application_t *rbpf, void *ctxs, size_t ctx_size,
+                               size_t stride, size_t count, int64_t *results);
+
+/**
+ * @brief Find a function of the application by name
+ *
+ * Also runs the pre-flight checks if not yet done, the returned index stays
+ * valid as long as the application is.
+ *
+ * @param   rbpf    rBPF application
+ * @param   name    Name of the function
+ *
+ * @return  Index of the function in the list of functions of the application
+ * @return  RBPF_ILLEGAL_FUNCTION when no function has this name
+ * @return  A negative error code of the pre-flight checks
+ */
+int rbpf_application_function(rbpf_application_t *rbpf, const char *name);
+
+/**
+ * @brief Execute the rBPF virtual machine from a function with a supplied context
+ *
+ * Same as @ref rbpf_application_run_ctx, starting from the first instruction
+ * of a function instead of the first one of the text.
+ *
+ * @param   rbpf        rBPF application to launch
+ * @param   function    Index of the function, from @ref rbpf_application_function
+ * @param   ctx         Context struct to supply to the virtual machine
+ * @param   ctx_size    Size of the context in bytes
+ * @param   result      Result returned by the application inside the virtual machine
+ *
+ * @returns execution result of the virtual machine, negative on error
+ * @returns RBPF_ILLEGAL_FUNCTION when @p function is not in the list
+ */
+int rbpf_application_run_function(rbpf_application_t *rbpf, unsigned function, void *ctx,
+                                  size_t ctx_size, int64_t *result);
+
+/**
+ * @brief Initialize a pool of execution contexts, all of them free
+ *
+ * Every context gets @p stack_len bytes of @p stacks, at least the stack depth
+ * of the applications run in the pool.
+ *
+ * @param   pool        The pool to initialize
+ * @param   execs       Execution contexts of the pool
+ * @param   len         Number of @p execs, at most @ref RBPF_EXEC_POOL_MAX
+ * @param   stacks      Stacks of the contexts, @p len times @p stack_len bytes,
+ *                      8 bytes aligned, NULL if @p stack_len is 0
+ * @param   stack_len   Stack size of a context, a multiple of 8
+ */
+void rbpf_exec_pool_init(rbpf_exec_pool_t *pool, rbpf_exec_t *execs, size_t len,
+                         uint8_t *stacks, size_t stack_len);
+
+/**
+ * @brief Take a free execution context from a pool
+ *
+ * Lock free, may be called from any thread.
+ *
+ * @param   pool    The pool
+ *
+ * @return  The execution context, NULL when none is free
+ */
+rbpf_exec_t *rbpf_exec_acquire(rbpf_exec_pool_t *pool);
+
+/**
+ * @brief Give an execution context back to its pool
+ *
+ * @param   pool    The pool @p exec was taken from
+ * @param   exec    The execution context
+ */
+void rbpf_exec_release(rbpf_exec_pool_t *pool, rbpf_exec_t *exec);
+
+/**
+ * @brief Execute an application in an execution context
+ *
+ * Same as @ref rbpf_application_run_ctx, the run state is kept in @p exec and
+ * @p rbpf is only read. The application must have gone through the pre-flight
+ * checks, and through @ref rbpf_jit_compile if it is to run natively, as must
+ * the applications its tail calls start. Its regions must not change while it
+ * runs.
+ *
+ * The runs share the data section of the application, the updates other runs
+ * must see are made with the atomic instructions. The key/value stores are
+ * not safe to update from concurrent runs.
+ *
+ * @param   exec        Execution context of the run
+ * @param   rbpf        rBPF application to launch
+ * @param   ctx         Context struct to supply to the virtual machine
+ * @param   ctx_size    Size of the context in bytes
+ * @param   result      Result returned by the application inside the virtual machine
+ *
+ * @returns execution result of the virtual machine, negative on error
+ */
+int rbpf_exec_run_ctx(rbpf_exec_t *exec, const rbpf_application_t *rbpf, void *ctx,
+                      size_t ctx_size, int64_t *result);
+
+/**
+ * @brief Execute an application in an execution context taken from a pool
+ *
+ * Same as @ref rbpf_exec_run_ctx, the execution context is given back to
+ * @p pool after the run.
+ *
+ * @param   rbpf        rBPF application to launch
+ * @param   pool        Pool of execution contexts
+ * @param   ctx         Context struct to supply to the virtual machine
+ * @param   ctx_size    Size of the context in bytes
+ * @param   result      Result returned by the application inside the virtual machine
+ *
+ * @returns execution result of the virtual machine, negative on error
+ * @returns RBPF_EXEC_POOL_EMPTY when no execution context is free
+ */
+int rbpf_application_run_pooled(const rbpf_application_t *rbpf, rbpf_exec_pool_t *pool,
+                                void *ctx, size_t ctx_size, int64_t *result);
+
 /**
  * @brief Initialize a memory region
  *
@@ -291,6 +1029,9 @@ static inline void rbpf_memory_region_init(rbpf_mem_region_t *region, void *star
 /**
  * @brief Add a memory region to the virtual machine
  *
+ * The region is also copied to the lookup tables used by the memory checks,
+ * changes to @p region after adding it are not taken into account.
+ *
  * @param   rbpf    The Application to add the memory region for
  * @param   region  The memory region to add
  */
@@ -305,7 +1046,7 @@ void rbpf_add_region(rbpf_application_t *rbpf, rbpf_mem_region_t *region);
  *
  * @return True if allowed, false if not allowed
  */
-bool rbpf_store_allowed(const rbpf_application_t *rbpf, void *addr, size_t size);
+bool rbpf_store_allowed(rbpf_application_t *rbpf, void *addr, size_t size);
 
 /**
  * @brief   Check if a load/read operation is allowed by the virtual machine with an address and size
@@ -316,7 +1057,7 @@ bool rbpf_store_allowed(const rbpf_application_t *rbpf, void *addr, size_t size)
  *
  * @return True if allowed, false if not allowed
  */
-bool rbpf_load_allowed(const rbpf_application_t *rbpf, void *addr, size_t size);
+bool rbpf_load_allowed(rbpf_application_t *rbpf, void *addr, size_t size);
 
 static inline const rbpf_header_t *rbpf_header(const rbpf_application_t *rbpf)
 {
@@ -334,7 +1075,7 @@ static inline void *rbpf_application_rodata(const rbpf_application_t *rbpf)
 {
     const rbpf_header_t *header = rbpf_header(rbpf);
 
-    return (uint8_t *)header + sizeof(rbpf_application_t) + header->data_len;
+    return (uint8_t *)header + sizeof(rbpf_header_t) + header->data_len;
 }
 
 /**
@@ -360,9 +1101,7 @@ static inline size_t rbpf_application_rodata_len(const rbpf_application_t *rbpf)
  */
 static inline void *rbpf_application_data(const rbpf_application_t *rbpf)
 {
-    const rbpf_header_t *header = rbpf_header(rbpf);
-
-    return (uint8_t *)header + sizeof(rbpf_application_t);
+    return rbpf->data;
 }
 
 /**
@@ -407,9 +1146,115 @@ static inline size_t rbpf_application_text_len(const rbpf_application_t *rbpf)
     return header->text_len;
 }
 
-/* to be implemented by platform specifc code. */
+/**
+ * @brief Get the list of functions of the rBPF application
+ *
+ * @param   rBPF    The rBPF application
+ *
+ * @return  The pointer of the rBPF applications list of functions
+ */
+static inline const rbpf_function_t *rbpf_application_functions(const rbpf_application_t *rbpf)
+{
+    return (const rbpf_function_t *)((const uint8_t *)rbpf_application_text(rbpf) +
+                                     rbpf_application_text_len(rbpf));
+}
+
+/**
+ * @brief Get the number of functions of the rBPF application
+ *
+ * @param   rBPF    The rBPF application
+ *
+ * @return  The number of entries in the rBPF applications list of functions
+ */
+static inline size_t rbpf_application_functions_len(const rbpf_application_t *rbpf)
+{
+    const rbpf_header_t *header = rbpf_header(rbpf);
+
+    return header->functions;
+}
+
+/**
+ * @brief Get the stack depth of the rBPF application
+ *
+ * Valid once the pre-flight checks are done.
+ *
+ * @param   rBPF    The rBPF application
+ *
+ * @return  The stack bytes the application needs below r10, a multiple of 8
+ */
+static inline size_t rbpf_application_stack_depth(const rbpf_application_t *rbpf)
+{
+    return rbpf->stack_depth;
+}
+
+/**
+ * @brief Empty the global key/value store shared by the applications
+ */
 void rbpf_store_init(void);
 
+/**
+ * @brief Initialize an empty key/value store
+ *
+ * @param   store       The store to initialize
+ * @param   entries     Entries of the store
+ * @param   capacity    Number of @p entries, a power of two
+ */
+void rbpf_store_table_init(rbpf_store_t *store, rbpf_store_entry_t *entries, size_t capacity);
+
+/**
+ * @brief Give an application its local key/value store
+ *
+ * The store is kept across the setups of the application, NULL removes it.
+ *
+ * @param   rbpf    The rBPF application
+ * @param   store   The local store of @p rbpf, initialized with
+ *                  @ref rbpf_store_table_init
+ */
+static inline void rbpf_application_set_store(rbpf_application_t *rbpf, rbpf_store_t *store)
+{
+    rbpf->store = store;
+}
+
+/**
+ * @brief Give an application the applications its tail calls start
+ *
+ * The array is kept across the setups of the application, NULL removes it.
+ *
+ * @param   rbpf    The rBPF application
+ * @param   progs   The applications started by the tail calls of @p rbpf
+ */
+static inline void rbpf_application_set_prog_array(rbpf_application_t *rbpf,
+                                                   const rbpf_prog_array_t *progs)
+{
+    rbpf->progs = progs;
+}
+
+/**
+ * @brief Fetch the value of a key from a key/value store
+ *
+ * @param   store   The store, NULL for the global store
+ * @param   key     The key
+ * @param[out] value    The value of @p key, 0 if it was never stored
+ *
+ * @return  RBPF_OK
+ */
+int rbpf_store_fetch(const rbpf_store_t *store, uint32_t key, uint32_t *value);
+
+/**
+ * @brief Store the value of a key in a key/value store
+ *
+ * Several threads may update and fetch the same store at once, as the
+ * applications sharing the global store or the runs of a pool do.
+ *
+ * @param   store   The store, NULL for the global store
+ * @param   key     The key
+ * @param   value   The value to store under @p key
+ *
+ * @return  RBPF_OK on success
+ * @return  RBPF_STORE_FULL when @p key is new and the store has no free entry
+ */
+int rbpf_store_update(rbpf_store_t *store, uint32_t key, uint32_t value);
+
 #ifdef __cplusplus
 }
 #endif
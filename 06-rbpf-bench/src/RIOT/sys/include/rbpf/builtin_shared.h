@@ -20,6 +20,15 @@ enum {
     BPF_FUNC_BPF_STORE_GLOBAL   = 0x11,
     BPF_FUNC_BPF_FETCH_LOCAL    = 0x12,
     BPF_FUNC_BPF_FETCH_GLOBAL   = 0x13,
+
+    /* Chaining of applications */
+    BPF_FUNC_BPF_TAIL_CALL      = 0x14,
+
+    /* Bulk memory functions */
+    BPF_FUNC_BPF_MEMCPY         = 0x20,
+    BPF_FUNC_BPF_MEMSET         = 0x21,
+    BPF_FUNC_BPF_MEMCMP         = 0x22,
+    BPF_FUNC_BPF_MEMCHR         = 0x23,
 };
 
 #ifdef __cplusplus
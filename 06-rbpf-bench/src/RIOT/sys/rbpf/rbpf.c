@@ -15,7 +15,10 @@
 #include "rbpf/instruction.h"
 #include "rbpf/config.h"
 
-extern int rbpf_engine_run(rbpf_application_t *rbpf, const void *ctx, int64_t *result);
+extern int rbpf_engine_run(rbpf_application_t *rbpf, size_t entry, const void *ctx,
+                           int64_t *result);
+extern int rbpf_engine_run_batch(rbpf_application_t *rbpf, uint8_t *ctxs, size_t stride,
+                                 size_t count, int64_t *results);
 
 int rbpf_application_run_ctx(rbpf_application_t *rbpf, void *ctx, size_t ctx_len, int64_t *result)
 {
@@ -23,19 +26,126 @@ int rbpf_application_run_ctx(rbpf_application_t *rbpf, void *ctx, size_t ctx_len
                             RBPF_MEM_REGION_READ | RBPF_MEM_REGION_WRITE);
 
     assert(rbpf->flags & RBPF_FLAG_SETUP_DONE);
-    return rbpf_engine_run(rbpf, ctx, result);
+    return rbpf_engine_run(rbpf, 0, ctx, result);
 }
 
-void rbpf_application_setup(rbpf_application_t *rbpf, uint8_t *stack,
-                            const rbpf_application_t *application, size_t application_len)
+int rbpf_application_run_batch(rbpf_application_t *rbpf, void *ctxs, size_t ctx_len,
+                               size_t stride, size_t count, int64_t *results)
 {
-    rbpf->stack = stack;
-    rbpf->application = application;
-    rbpf->application_len = application_len;
+    rbpf_memory_region_init(&rbpf->arg_region, ctxs, ctx_len,
+                            RBPF_MEM_REGION_READ | RBPF_MEM_REGION_WRITE);
+
+    assert(rbpf->flags & RBPF_FLAG_SETUP_DONE);
+    return rbpf_engine_run_batch(rbpf, ctxs, stride, count, results);
+}
+
+int rbpf_application_function(rbpf_application_t *rbpf, const char *name)
+{
+    int res = rbpf_application_verify_preflight(rbpf);
+
+    if (res < 0) {
+        return res;
+    }
+
+    const char *rodata = rbpf_application_rodata(rbpf);
+    const size_t rodata_len = rbpf_application_rodata_len(rbpf);
+    const rbpf_function_t *functions = rbpf_application_functions(rbpf);
+
+    for (size_t function = 0; function < rbpf_application_functions_len(rbpf); function++) {
+        size_t pos = functions[function].name_offset;
+        size_t i = 0;
+
+        while (pos + i < rodata_len && rodata[pos + i] == name[i] && name[i] != '\0') {
+            i++;
+        }
+        if (pos + i < rodata_len && rodata[pos + i] == '\0' && name[i] == '\0') {
+            return function;
+        }
+    }
+    return RBPF_ILLEGAL_FUNCTION;
+}
+
+int rbpf_application_run_function(rbpf_application_t *rbpf, unsigned function, void *ctx,
+                                  size_t ctx_len, int64_t *result)
+{
+    rbpf_memory_region_init(&rbpf->arg_region, ctx, ctx_len,
+                            RBPF_MEM_REGION_READ | RBPF_MEM_REGION_WRITE);
 
+    assert(rbpf->flags & RBPF_FLAG_SETUP_DONE);
+    int res = rbpf_application_verify_preflight(rbpf);
+    if (res < 0) {
+        return res;
+    }
+    if (function >= rbpf_application_functions_len(rbpf)) {
+        return RBPF_ILLEGAL_FUNCTION;
+    }
+    /* Checked against the number of instructions by the pre-flight checks */
+    return rbpf_engine_run(rbpf, rbpf_application_functions(rbpf)[function].location_offset / 8,
+                           ctx, result);
+}
+
+/* The memory checks try the entry of the last allowed access before looking
+ * at the length, an empty table keeps one that no access can match */
+static void _region_table_clear(rbpf_region_table_t *table)
+{
+    table->len = 0;
+    table->last = 0;
+    table->entries[0].start = UINTPTR_MAX;
+    table->entries[0].end = 0;
+    table->entries[0].reach = 0;
+}
+
+static void _region_table_insert(rbpf_application_t *rbpf, rbpf_region_table_t *table,
+                                 const rbpf_mem_region_t *region)
+{
+    const uintptr_t start = (uintptr_t)region->start;
+    unsigned pos = table->len;
+
+    if (table->len == RBPF_REGIONS_MAX) {
+        rbpf->flags |= RBPF_FLAG_REGIONS_OVERFLOW;
+        return;
+    }
+
+    /* Keep the table sorted on the start address */
+    while (pos > 0 && table->entries[pos - 1].start > start) {
+        table->entries[pos] = table->entries[pos - 1];
+        pos--;
+    }
+    table->entries[pos].start = start;
+    table->entries[pos].end = start + region->len;
+    table->len++;
+
+    for (unsigned i = pos; i < table->len; i++) {
+        uintptr_t reach = i ? table->entries[i - 1].reach : 0;
+        if (table->entries[i].end > reach) {
+            reach = table->entries[i].end;
+        }
+        table->entries[i].reach = reach;
+    }
+    table->last = 0;
+}
+
+static void _region_tables_add(rbpf_application_t *rbpf, const rbpf_mem_region_t *region)
+{
+    /* Empty regions never allow an access */
+    if (region->len == 0) {
+        return;
+    }
+    if (region->flags & RBPF_MEM_REGION_READ) {
+        _region_table_insert(rbpf, &rbpf->load_regions, region);
+    }
+    if (region->flags & RBPF_MEM_REGION_WRITE) {
+        _region_table_insert(rbpf, &rbpf->store_regions, region);
+    }
+}
+
+/* Regions of the stack and of the sections followed by the added ones, in the
+ * list and in the tables */
+static void _application_regions_init(rbpf_application_t *rbpf, rbpf_mem_region_t *added)
+{
     rbpf_memory_region_init(&rbpf->stack_region,
                             rbpf->stack,
-                            RBPF_STACK_SIZE,
+                            rbpf->stack_len,
                             RBPF_MEM_REGION_READ | RBPF_MEM_REGION_WRITE);
 
     rbpf_memory_region_init(&rbpf->data_region, rbpf_application_data(rbpf),
@@ -48,12 +158,183 @@ void rbpf_application_setup(rbpf_application_t *rbpf, uint8_t *stack,
     rbpf->stack_region.next = &rbpf->data_region;
     rbpf->data_region.next = &rbpf->rodata_region;
     rbpf->rodata_region.next = &rbpf->arg_region;
+    rbpf->arg_region.next = added;
+
+    /* The context changes on every run, the engine checks it separately */
+    _region_table_clear(&rbpf->load_regions);
+    _region_table_clear(&rbpf->store_regions);
+    rbpf->flags &= ~RBPF_FLAG_REGIONS_OVERFLOW;
+    _region_tables_add(rbpf, &rbpf->stack_region);
+    _region_tables_add(rbpf, &rbpf->data_region);
+    _region_tables_add(rbpf, &rbpf->rodata_region);
+    for (rbpf_mem_region_t *region = added; region; region = region->next) {
+        _region_tables_add(rbpf, region);
+    }
+}
+
+/* Moves r10 to the end of the stack */
+static void _application_stack(rbpf_application_t *rbpf, uint8_t *stack, size_t stack_len)
+{
+    rbpf->stack = stack;
+    rbpf->stack_len = stack_len;
+
+#if UINTPTR_MAX > UINT32_MAX
+    /* The 32 bit registers were proven with the stack the application had,
+     * they only hold a stack address below 4 GiB */
+    if ((uintptr_t)stack + stack_len > UINT32_MAX) {
+        rbpf->flags &= ~RBPF_FLAG_REG32;
+    }
+#endif
+}
+
+static void _application_setup(rbpf_application_t *rbpf, uint8_t *stack,
+                               const rbpf_application_t *application, size_t application_len,
+                               rbpf_insn_t *insns, size_t insns_len, uint8_t *data)
+{
+    rbpf->stack = stack;
+    rbpf->stack_len = stack ? RBPF_STACK_SIZE : 0;
+    rbpf->application = application;
+    rbpf->application_len = application_len;
+    rbpf->data = data;
+    rbpf->insns = insns;
+    rbpf->insns_len = insns_len;
+    rbpf->jit = NULL;
+    rbpf->dispatches_fused = 0;
+    rbpf->fuel = RBPF_FUEL_ALLOWED;
+    rbpf->ctx_bounds = NULL;
+    rbpf->ctx_bounds_len = 0;
+    /* The counters of a profile are indexed like the previous application */
+    rbpf->profile = NULL;
+    /* A new application must go through the pre-flight checks again */
+    rbpf->flags &= ~(RBPF_FLAG_PREFLIGHT_DONE | RBPF_FLAG_INSTANCE);
+
+    _application_regions_init(rbpf, NULL);
 
     rbpf->flags |= RBPF_FLAG_SETUP_DONE;
 }
 
+int rbpf_application_set_stack(rbpf_application_t *rbpf, uint8_t *stack, size_t stack_len)
+{
+    int res = rbpf_application_verify_preflight(rbpf);
+
+    if (res < 0) {
+        return res;
+    }
+    if (stack_len < rbpf->stack_depth) {
+        return RBPF_ILLEGAL_STACK;
+    }
+    _application_stack(rbpf, stack, stack_len);
+    _application_regions_init(rbpf, rbpf->arg_region.next);
+    return RBPF_OK;
+}
+
+int rbpf_application_set_ctx_bounds(rbpf_application_t *rbpf, const rbpf_ctx_bound_t *bounds,
+                                    size_t len)
+{
+    if (len > UINT8_MAX) {
+        return RBPF_ILLEGAL_LEN;
+    }
+    for (size_t k = 0; k < len; k++) {
+        if (bounds[k].size != 1 && bounds[k].size != 2 && bounds[k].size != 4) {
+            return RBPF_ILLEGAL_LEN;
+        }
+    }
+    rbpf->ctx_bounds = len ? bounds : NULL;
+    rbpf->ctx_bounds_len = len;
+    /* The analysis proved the application with the previous maxima */
+    rbpf->jit = NULL;
+    rbpf->flags &= ~RBPF_FLAG_PREFLIGHT_DONE;
+    return RBPF_OK;
+}
+
+int rbpf_application_set_profile(rbpf_application_t *rbpf, rbpf_profile_t *profile)
+{
+#if (RBPF_ENABLE_PROFILE)
+    int res = rbpf_application_verify_preflight(rbpf);
+
+    if (res < 0) {
+        return res;
+    }
+    if (profile && profile->len < rbpf->num_insns) {
+        return RBPF_ILLEGAL_LEN;
+    }
+    rbpf->profile = profile;
+    return RBPF_OK;
+#else
+    (void)rbpf;
+    (void)profile;
+    return RBPF_PROFILE_UNAVAILABLE;
+#endif
+}
+
+void rbpf_application_instance_init(rbpf_application_t *inst, const rbpf_application_t *rbpf,
+                                    uint8_t *stack, size_t stack_len)
+{
+    /*
+     * Copied field by field, a structure assignment makes the compiler
+     * generate a memcpy call, which the FAE builds don't link with.
+     */
+    inst->application = rbpf->application;
+    inst->application_len = rbpf->application_len;
+    inst->data = rbpf->data;
+    inst->insns = rbpf->insns;
+    inst->insns_len = rbpf->insns_len;
+    inst->num_insns = rbpf->num_insns;
+    inst->jit = rbpf->jit;
+    inst->ctx_len_min = rbpf->ctx_len_min;
+    inst->ctx_bounds = rbpf->ctx_bounds;
+    inst->ctx_bounds_len = rbpf->ctx_bounds_len;
+    inst->stack_depth = rbpf->stack_depth;
+    inst->flags = rbpf->flags | RBPF_FLAG_INSTANCE;
+    inst->fuel = rbpf->fuel;
+    inst->dispatches_fused = 0;
+    inst->store = rbpf->store;
+    inst->progs = rbpf->progs;
+    inst->profile = rbpf->profile;
+
+    _application_stack(inst, stack, stack_len);
+    /* The regions added to the application are shared, the engine only
+     * reads them */
+    _application_regions_init(inst, rbpf->arg_region.next);
+}
+
+void rbpf_application_setup(rbpf_application_t *rbpf, uint8_t *stack,
+                            const rbpf_application_t *application, size_t application_len,
+                            rbpf_insn_t *insns, size_t insns_len)
+{
+    /* The application is in RAM, its data section is used in place */
+    uint8_t *data = (uint8_t *)application + sizeof(rbpf_header_t);
+
+    _application_setup(rbpf, stack, application, application_len, insns, insns_len, data);
+}
+
+int rbpf_application_setup_xip(rbpf_application_t *rbpf, uint8_t *stack,
+                               const rbpf_application_t *application, size_t application_len,
+                               rbpf_insn_t *insns, size_t insns_len,
+                               uint8_t *data, size_t data_len)
+{
+    const rbpf_header_t *header = (const rbpf_header_t *)application;
+    const uint8_t *src = (const uint8_t *)header + sizeof(rbpf_header_t);
+
+    if (application_len < sizeof(rbpf_header_t) ||
+        header->data_len > application_len - sizeof(rbpf_header_t) ||
+        header->data_len > data_len) {
+        return RBPF_ILLEGAL_LEN;
+    }
+
+    /* Only the data section is written by the application, the other sections
+     * are read from where they are stored */
+    for (size_t i = 0; i < header->data_len; i++) {
+        data[i] = src[i];
+    }
+
+    _application_setup(rbpf, stack, application, application_len, insns, insns_len, data);
+    return RBPF_OK;
+}
+
 void rbpf_add_region(rbpf_application_t *rbpf, rbpf_mem_region_t *region)
 {
     region->next = rbpf->arg_region.next;
     rbpf->arg_region.next = region;
+    _region_tables_add(rbpf, region);
 }
@@ -64,6 +64,9 @@ typedef enum xipfs_user_syscall_e {
     XIPFS_USER_SYSCALL_COPY_FILE,
     XIPFS_USER_SYSCALL_GET_FILE_SIZE,
     XIPFS_USER_SYSCALL_MEMSET,
+#if defined(STDRIOT_FILE_ADDRESS) && STDRIOT_FILE_ADDRESS
+    XIPFS_USER_SYSCALL_GET_FILE_ADDRESS,
+#endif
     XIPFS_USER_SYSCALL_MAX
 } xipfs_user_syscall_t;
 
@@ -79,6 +82,10 @@ typedef ssize_t (*xipfs_user_syscall_copy_file_t)(
 typedef int (*xipfs_user_syscall_get_file_size_t)(
     const char *name, size_t *size);
 typedef void *(*xipfs_user_syscall_memset_t)(void *m, int c, size_t n);
+#if defined(STDRIOT_FILE_ADDRESS) && STDRIOT_FILE_ADDRESS
+typedef int (*xipfs_user_syscall_get_file_address_t)(
+    const char *name, const void **addr);
+#endif
 
 /**
  * @brief An enumeration describing the index of xipfs functions.
@@ -255,6 +262,15 @@ static const void **user_syscall_table;
 
 static int *syscall_result_ptr;
 
+/**
+ * @internal
+ *
+ * @brief Bounds of the free RAM left by CRT0 after the
+ * relocation of the program
+ */
+static void *free_ram_start;
+static void *free_ram_end;
+
 /**
  * @brief Wrapper that branches to the xipfs_exit(3) function
  *
@@ -490,6 +506,32 @@ extern int get_file_size(const char *name, size_t *size) {
     return res;
 }
 
+#if defined(STDRIOT_FILE_ADDRESS) && STDRIOT_FILE_ADDRESS
+extern int get_file_address(const char *name, const void **addr) {
+    int res;
+
+    if (is_safe_call) {
+        asm volatile(
+            "mov r0, %0                            \n"
+            "mov r1, %1                            \n"
+            "mov r2, %2                            \n"
+            "svc #" STR(XIPFS_SYSCALL_SVC_NUMBER) "\n"
+            :
+            : "r"(XIPFS_USER_SYSCALL_GET_FILE_ADDRESS), "r"(name), "r"(addr)
+            : "r0", "r1", "r2"
+        );
+        res = *syscall_result_ptr;
+    } else {
+        xipfs_user_syscall_get_file_address_t func;
+
+        func = user_syscall_table[XIPFS_USER_SYSCALL_GET_FILE_ADDRESS];
+        res  = (*func)(name, addr);
+    }
+
+    return res;
+}
+#endif
+
 extern void *memset(void *m, int c, size_t n) {
     xipfs_user_syscall_memset_t func;
     void *res;
@@ -512,6 +554,19 @@ extern void *memset(void *m, int c, size_t n) {
     return res;
 }
 
+/**
+ * @brief Returns the free RAM left to the program
+ *
+ * @param size Receives the size of the free RAM in bytes
+ *
+ * @return The start address of the free RAM
+ */
+extern void *get_free_ram(size_t *size)
+{
+    *size = (size_t)((uintptr_t)free_ram_end - (uintptr_t)free_ram_start);
+    return free_ram_start;
+}
+
 /**
  * @internal
  *
@@ -539,6 +594,10 @@ int start(crt0_ctx_t *crt0_ctx)
         syscall_result_ptr  = NULL;
     }
 
+    /* keep track of the RAM left after the relocation */
+    free_ram_start = crt0_ctx->ram_start;
+    free_ram_end   = crt0_ctx->ram_end;
+
     /* initialize the arguments passed to the program */
     argc = crt0_ctx->argc;
     argv = crt0_ctx->argv;
@@ -34,6 +34,7 @@
 #include <assert.h>
 #include <inttypes.h>
 #include <stdalign.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -50,6 +51,8 @@
 static uint8_t rbpf_stack[RBPF_STACK_SIZE];
 static uint8_t buf[BUFFER_SIZE_MAX];
 static uint8_t bytecode[BYTECODE_SIZE_MAX];
+static rbpf_insn_t insns[RBPF_INSNS_MAX(BYTECODE_SIZE_MAX)];
+static rbpf_mem_region_t bytecode_region;
 
 
 #define BPF_RUN_N(ctx, size) \
@@ -61,6 +64,28 @@ static uint8_t bytecode[BYTECODE_SIZE_MAX];
         } \
     } while (0)
 
+/* The n runs over the same context through the batch API, which only checks
+ * the application and sets the context region up once per batch. Used by the
+ * benchmarks of a single context when built with RBPF_BATCH=1 */
+#define BPF_RUN_BATCH_LEN   (16)
+
+#define BPF_RUN_BATCH_N(ctx, size) \
+    do { \
+        int64_t results[BPF_RUN_BATCH_LEN]; \
+        unsigned batch; \
+        status = RBPF_OK; \
+        result = 0; \
+        for (i = 0; i < n && status == RBPF_OK; i += batch) { \
+            batch = n - i < BPF_RUN_BATCH_LEN ? n - i : BPF_RUN_BATCH_LEN; \
+            status = rbpf_application_run_batch(rbpf, ctx, \
+                size, 0, batch, results); \
+            if (status == RBPF_OK) { \
+                result = results[batch - 1]; \
+            } \
+        } \
+        printf(PROGNAME": ran in batches of %u contexts\n", BPF_RUN_BATCH_LEN); \
+    } while (0)
+
 static int
 bpf_print_result(int64_t result, int status)
 {
@@ -95,6 +120,12 @@ bpf_print_result(int64_t result, int status)
     case RBPF_ILLEGAL_DIV :
         printf(PROGNAME": illegal div\n");
         return 1;
+    case RBPF_ILLEGAL_STACK :
+        printf(PROGNAME": illegal stack\n");
+        return 1;
+    case RBPF_ILLEGAL_CTX :
+        printf(PROGNAME": illegal context\n");
+        return 1;
     default:
         printf(PROGNAME": error\n");
         return 1;
@@ -107,7 +138,11 @@ static int bpf_run_with_context(rbpf_application_t *rbpf, unsigned n, void *cont
     int status;
     unsigned i;
 
+#if defined(RBPF_BATCH) && RBPF_BATCH
+    BPF_RUN_BATCH_N(context, context_size);
+#else
     BPF_RUN_N(context, context_size);
+#endif
 
     return bpf_print_result(result, status);
 }
@@ -119,7 +154,11 @@ bpf_run_with_integer(rbpf_application_t *rbpf, unsigned n, uint64_t integer)
     int status;
     unsigned i;
 
+#if defined(RBPF_BATCH) && RBPF_BATCH
+    BPF_RUN_BATCH_N(&integer, sizeof(integer));
+#else
     BPF_RUN_N(&integer, sizeof(integer));
+#endif
 
     return bpf_print_result(result, status);
 }
@@ -137,9 +176,17 @@ typedef enum bench_cases_e {
     BENCH_CASE_SOCKBUF,
     BENCH_CASE_MEMCPY,
     BENCH_CASE_BUBBLE_SORT,
+    BENCH_CASE_HDRPARSE,
+    BENCH_CASE_FLETCHER32_CALLS,
+    BENCH_CASE_CHAIN,
+    BENCH_CASE_HISTOGRAM,
+    BENCH_CASE_DIVIDE,
+    BENCH_CASE_STATEMACHINE,
+    BENCH_CASE_MEMCPY_LEN,
+    BENCH_CASE_MEMCPY_HELPER,
 
     BENCH_CASE_FIRST = BENCH_CASE_ARITHMETIC_FIRST,
-    BENCH_CASE_LAST  = BENCH_CASE_BUBBLE_SORT
+    BENCH_CASE_LAST  = BENCH_CASE_MEMCPY_HELPER
 } bench_cases_t;
 
 #define BENCH_CASES_COUNT ((BENCH_CASE_LAST - BENCH_CASE_FIRST) + 1)
@@ -169,6 +216,14 @@ static const bench_case_info_t bench_case_infos[BENCH_CASES_COUNT] = {
     [    BENCH_CASE_SOCKBUF] = BENCH_CASE_INFO_INIT("sockbuf", DIRECTORY "sockbuf.rbpf", ""),
     [     BENCH_CASE_MEMCPY] = BENCH_CASE_INFO_INIT("memcpy", DIRECTORY "memcpy.rbpf", ""),
     [BENCH_CASE_BUBBLE_SORT] = BENCH_CASE_INFO_INIT("bubble_sort", DIRECTORY "bsort.rbpf", ""),
+    [   BENCH_CASE_HDRPARSE] = BENCH_CASE_INFO_INIT("hdrparse", DIRECTORY "hdrparse.rbpf", ""),
+    [BENCH_CASE_FLETCHER32_CALLS] = BENCH_CASE_INFO_INIT("fletcher32_calls", DIRECTORY "fletcher32_calls.rbpf", "filename"),
+    [      BENCH_CASE_CHAIN] = BENCH_CASE_INFO_INIT("chain", DIRECTORY "chain.rbpf", "stages"),
+    [  BENCH_CASE_HISTOGRAM] = BENCH_CASE_INFO_INIT("histogram", DIRECTORY "histogram.rbpf", "filename"),
+    [     BENCH_CASE_DIVIDE] = BENCH_CASE_INFO_INIT("divide", DIRECTORY "divide.rbpf", ""),
+    [BENCH_CASE_STATEMACHINE] = BENCH_CASE_INFO_INIT("statemachine", DIRECTORY "statemachine.rbpf", ""),
+    [ BENCH_CASE_MEMCPY_LEN] = BENCH_CASE_INFO_INIT("memcpy_len", DIRECTORY "memcpy.rbpf", "len"),
+    [BENCH_CASE_MEMCPY_HELPER] = BENCH_CASE_INFO_INIT("memcpy_helper", DIRECTORY "memcpy_helper.rbpf", "len"),
 };
 
 static void usage(void) {
@@ -195,10 +250,24 @@ static int bpf_load_file_to_buffer(const char *filename) {
     return result;
 }
 
+static void bpf_jit_compile(rbpf_application_t *rbpf) {
+#if defined(RBPF_ENABLE_JIT) && RBPF_ENABLE_JIT
+    /* The native code goes to the free RAM left by CRT0 */
+    size_t jit_size;
+    void *jit_code = get_free_ram(&jit_size);
+    int result;
+
+    if ((result = rbpf_jit_compile(rbpf, jit_code, jit_size)) < 0) {
+        printf(PROGNAME": failed to compile bytecode (%d), interpreting it\n", result);
+    }
+#else
+    (void)rbpf;
+#endif
+}
+
 int init_rbpf(rbpf_application_t *rbpf, const char *bytecode_filename) {
     int result;
     size_t bytecode_size;
-    rbpf_mem_region_t region;
 
     if ((result = copy_file(bytecode_filename, bytecode, BYTECODE_SIZE_MAX)) < 0) {
         printf(PROGNAME": %s: failed to copy bytecode\n", bytecode_filename);
@@ -209,13 +278,44 @@ int init_rbpf(rbpf_application_t *rbpf, const char *bytecode_filename) {
     printf(PROGNAME": \"%s\" bytecode loaded at address %p\n", bytecode_filename,
         (void *)bytecode);
 
-    rbpf_application_setup(rbpf, rbpf_stack, (void *)bytecode, bytecode_size);
-    rbpf_memory_region_init(&region, bytecode, bytecode_size,
+    rbpf_application_setup(rbpf, rbpf_stack, (void *)bytecode, bytecode_size,
+        insns, RBPF_INSNS_MAX(BYTECODE_SIZE_MAX));
+    /* The region stays linked to the application after returning */
+    rbpf_memory_region_init(&bytecode_region, bytecode, bytecode_size,
         RBPF_MEM_REGION_READ);
-    rbpf_add_region(rbpf, &region);
+    rbpf_add_region(rbpf, &bytecode_region);
+
+    /* The application only gets the stack depth the pre-flight checks
+     * found, no stack region at all when it doesn't use its stack */
+    if ((result = rbpf_application_set_stack(rbpf, rbpf_stack,
+        rbpf_application_stack_depth(rbpf))) < 0) {
+        return bpf_print_result(0, result);
+    }
+
+    bpf_jit_compile(rbpf);
 
     return 0;
 }
+
+/* Maxima of context fields, the loops they bound can then be proven to
+ * terminate. The analysis is run again, the native code compiled again */
+static int bpf_set_ctx_bounds(rbpf_application_t *rbpf, const rbpf_ctx_bound_t *bounds,
+                              size_t len) {
+    int result;
+
+    if ((result = rbpf_application_set_ctx_bounds(rbpf, bounds, len)) < 0 ||
+        (result = rbpf_application_verify_preflight(rbpf)) < 0) {
+        return bpf_print_result(0, result);
+    }
+    if (rbpf->flags & RBPF_FLAG_TERMINATES) {
+        printf(PROGNAME": proven to terminate, runs without fuel\n");
+    }
+    else {
+        printf(PROGNAME": not proven to terminate, runs with fuel\n");
+    }
+    bpf_jit_compile(rbpf);
+    return 0;
+}
 ///////////////////////////////////////////////////////////////////////////////
 typedef struct {
     __bpf_shared_ptr(const uint16_t *, data);
@@ -239,6 +339,12 @@ static int bpf_run_fletcher32(rbpf_application_t *rbpf,unsigned n, int argc, con
     ctx.data = (const uint16_t *)buf;
     ctx.words = buf_size/2;
 
+    static const rbpf_ctx_bound_t bounds[] = {
+        { offsetof(fletcher32_ctx_t, words), sizeof(uint32_t), BUFFER_SIZE_MAX / 2 },
+    };
+    if (bpf_set_ctx_bounds(rbpf, bounds, sizeof(bounds) / sizeof(bounds[0])) != 0)
+        return 1;
+
     rbpf_memory_region_init(&region, buf, buf_size, RBPF_MEM_REGION_READ);
     rbpf_add_region(rbpf, &region);
 
@@ -298,6 +404,12 @@ static int bpf_run_sockbuf(rbpf_application_t *rbpf,unsigned n, int argc, const
         .array      = sockbuf_array
     };
 
+    static const rbpf_ctx_bound_t bounds[] = {
+        { offsetof(sockbuf_ctx_t, len), sizeof(uint32_t), ARRAY_LENGTH },
+    };
+    if (bpf_set_ctx_bounds(rbpf, bounds, sizeof(bounds) / sizeof(bounds[0])) != 0)
+        return 1;
+
     rbpf_memory_region_init(&region, sockbuf_array, sizeof(sockbuf_array), RBPF_MEM_REGION_READ | RBPF_MEM_REGION_WRITE);
     rbpf_add_region(rbpf, &region);
 
@@ -332,6 +444,12 @@ static int bpf_run_memcpy(rbpf_application_t *rbpf, unsigned n, int argc, const
         .dst = dst_data
     };
 
+    static const rbpf_ctx_bound_t bounds[] = {
+        { offsetof(memcpy_ctx_t, len), sizeof(uint32_t), sizeof(dst_data) },
+    };
+    if (bpf_set_ctx_bounds(rbpf, bounds, sizeof(bounds) / sizeof(bounds[0])) != 0)
+        return 1;
+
     rbpf_mem_region_t src_region;
     rbpf_memory_region_init(&src_region, buf, data_loading_result, RBPF_MEM_REGION_READ);
     rbpf_add_region(rbpf, &src_region);
@@ -343,6 +461,67 @@ static int bpf_run_memcpy(rbpf_application_t *rbpf, unsigned n, int argc, const
     return bpf_run_with_context(rbpf, n, &ctx, sizeof(memcpy_ctx_t));
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/* The bytecode loop of memcpy.rbpf and the memory copy function called by
+ * memcpy_helper.rbpf copy the same buffers, run both at a few lengths up to
+ * MEMCPY_LEN_MAX to compare them */
+#define MEMCPY_LEN_MAX 512
+
+static uint8_t memcpy_src[MEMCPY_LEN_MAX] __attribute((aligned(4)));
+static uint8_t memcpy_dst[MEMCPY_LEN_MAX] __attribute((aligned(4)));
+
+static int bpf_run_memcpy_len(rbpf_application_t *rbpf, unsigned n, int argc, const char *argv[]) {
+    char *endptr;
+    unsigned len;
+    int ret;
+
+    if (argc < 4) {
+        usage();
+        return 1;
+    }
+
+    len = (unsigned)strtol(argv[3], &endptr, 10);
+    if (argv[3] == endptr || *endptr != '\0' || len > MEMCPY_LEN_MAX) {
+        printf(PROGNAME": %s: failed to parse len, at most %u\n", argv[3], MEMCPY_LEN_MAX);
+        return 1;
+    }
+
+    for (unsigned i = 0; i < len; i++) {
+        memcpy_src[i] = (uint8_t)(i * 7 + 1);
+        memcpy_dst[i] = 0;
+    }
+
+    memcpy_ctx_t ctx = {
+        .len = (uint32_t)len,
+        .src = (char *)memcpy_src,
+        .dst = (char *)memcpy_dst
+    };
+
+    static const rbpf_ctx_bound_t bounds[] = {
+        { offsetof(memcpy_ctx_t, len), sizeof(uint32_t), MEMCPY_LEN_MAX },
+    };
+    if (bpf_set_ctx_bounds(rbpf, bounds, sizeof(bounds) / sizeof(bounds[0])) != 0)
+        return 1;
+
+    rbpf_mem_region_t src_region;
+    rbpf_memory_region_init(&src_region, memcpy_src, sizeof(memcpy_src), RBPF_MEM_REGION_READ);
+    rbpf_add_region(rbpf, &src_region);
+
+    rbpf_mem_region_t dst_region;
+    rbpf_memory_region_init(&dst_region, memcpy_dst, sizeof(memcpy_dst), RBPF_MEM_REGION_WRITE);
+    rbpf_add_region(rbpf, &dst_region);
+
+    ret = bpf_run_with_context(rbpf, n, &ctx, sizeof(memcpy_ctx_t));
+
+    for (unsigned i = 0; i < len; i++) {
+        if (memcpy_dst[i] != memcpy_src[i]) {
+            printf(PROGNAME": copy differs at byte %u\n", i);
+            return 1;
+        }
+    }
+    return ret;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 typedef struct bsort_context_s
 {
@@ -373,11 +552,204 @@ static int bpf_run_bubble_sort(rbpf_application_t *rbpf,unsigned n, int argc, co
     return bpf_run_with_context(rbpf, n, &ctx, sizeof(bsort_context_t));
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/* Ethernet, IPv4 and UDP frame, two bytes into the buffer so that the IPv4
+ * header is word aligned */
+static const uint8_t hdrparse_buffer[64] __attribute((aligned(4))) = {
+    0x00, 0x00,
+    0x02, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x00, 0x00, 0x00, 0x00, 0x02,
+    0x08, 0x00,
+    0x45, 0x00, 0x00, 0x2e, 0x1c, 0x46, 0x40, 0x00, 0x40, 0x11, 0x9c, 0x60,
+    0xc0, 0xa8, 0x00, 0x01, 0xc0, 0xa8, 0x00, 0xc7,
+    0xc0, 0x00, 0x16, 0x33, 0x00, 0x1a, 0x00, 0x00,
+    'r', 'B', 'P', 'F', ' ', 'h', 'e', 'a', 'd', 'e', 'r', ' ', 'p', 'a', 'r', 's', 'e', '!',
+};
+
+#define HDRPARSE_FRAME_LEN (sizeof(hdrparse_buffer) - 4)
+
+typedef struct hdrparse_ctx_s
+{
+    uint32_t len;
+    __bpf_shared_ptr(const uint8_t *, frame);
+} hdrparse_ctx_t;
+
+static int bpf_run_hdrparse(rbpf_application_t *rbpf, unsigned n, int argc, const char *argv[]) {
+    (void)argv;
+    if(argc != 3) {
+        usage();
+        return 1;
+    }
+
+    hdrparse_ctx_t ctx = {
+        .len   = HDRPARSE_FRAME_LEN,
+        .frame = hdrparse_buffer + 2
+    };
+
+    rbpf_mem_region_t region;
+    rbpf_memory_region_init(&region, (void *)(hdrparse_buffer + 2), HDRPARSE_FRAME_LEN, RBPF_MEM_REGION_READ);
+    rbpf_add_region(rbpf, &region);
+
+    return bpf_run_with_context(rbpf, n, &ctx, sizeof(hdrparse_ctx_t));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+typedef struct chain_ctx_s
+{
+    uint32_t stages;
+    uint32_t sum;
+} chain_ctx_t;
+
+static int bpf_run_chain(rbpf_application_t *rbpf, unsigned n, uint32_t stages) {
+    /* Every stage is the same application, its tail calls start it again */
+    rbpf_application_t *entries[] = { rbpf };
+    rbpf_prog_array_t progs = { .entries = entries, .len = 1 };
+    chain_ctx_t ctx;
+    int64_t result = 0;
+    int status = RBPF_OK;
+    unsigned i;
+
+    rbpf_application_set_prog_array(rbpf, &progs);
+
+    /* The stages consume the context, it is reset before every run */
+    for (i = 0; i < n && status == RBPF_OK; i++) {
+        ctx.stages = stages;
+        ctx.sum = 0;
+        status = rbpf_application_run_ctx(rbpf, &ctx, sizeof(ctx), &result);
+    }
+
+    return bpf_print_result(result, status);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+#define HISTOGRAM_BINS 8
+
+#define HISTOGRAM_EXECS 2
+
+/* Bins followed by the total, only updated with atomic instructions */
+static uint32_t histogram_bins[HISTOGRAM_BINS + 1];
+
+/* The runs take their stack from the pool instead of rbpf_stack, as the
+ * threads sharing the histogram would, sized after the stack depth */
+static rbpf_exec_t histogram_execs[HISTOGRAM_EXECS];
+static uint8_t histogram_stacks[HISTOGRAM_EXECS * RBPF_STACK_SIZE] __attribute__((aligned(8)));
+static rbpf_exec_pool_t histogram_pool;
+
+typedef struct histogram_ctx_s
+{
+    __bpf_shared_ptr(const uint8_t *, data);
+    uint32_t len;
+    __bpf_shared_ptr(uint32_t *, bins);
+} histogram_ctx_t;
+
+static int bpf_run_histogram(rbpf_application_t *rbpf, unsigned n, int argc, const char *argv[]) {
+    rbpf_mem_region_t data_region, bins_region;
+    histogram_ctx_t ctx;
+    int64_t result = 0;
+    int buf_size;
+    int status;
+    unsigned i;
+
+    if (argc < 4) {
+        usage();
+        return 1;
+    }
+
+    buf_size = bpf_load_file_to_buffer(argv[3]);
+    if (buf_size <= 0)
+        return 1;
+
+    for (unsigned int i = 0; i < HISTOGRAM_BINS + 1; ++i) {
+        histogram_bins[i] = 0;
+    }
+
+    ctx.data = buf;
+    ctx.len = buf_size;
+    ctx.bins = histogram_bins;
+
+    rbpf_memory_region_init(&data_region, buf, buf_size, RBPF_MEM_REGION_READ);
+    rbpf_add_region(rbpf, &data_region);
+
+    /* The atomic instructions both read and write the bins */
+    rbpf_memory_region_init(&bins_region, histogram_bins, sizeof(histogram_bins),
+        RBPF_MEM_REGION_READ | RBPF_MEM_REGION_WRITE);
+    rbpf_add_region(rbpf, &bins_region);
+
+    /* The pooled runs only read the checked application */
+    status = rbpf_application_verify_preflight(rbpf);
+    rbpf_exec_pool_init(&histogram_pool, histogram_execs, HISTOGRAM_EXECS, histogram_stacks,
+        rbpf_application_stack_depth(rbpf));
+    for (i = 0; i < n && status == RBPF_OK; i++) {
+        status = rbpf_application_run_pooled(rbpf, &histogram_pool, &ctx, sizeof(ctx),
+            &result);
+    }
+
+    return bpf_print_result(result, status);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+#define DIVIDE_VALUES 16
+
+typedef struct divide_ctx_s {
+    uint64_t base;
+    uint64_t values[DIVIDE_VALUES];
+} divide_ctx_t;
+
+static int bpf_run_divide(rbpf_application_t *rbpf, unsigned n, int argc, const char *argv[]) {
+    if (argc != 3) {
+        usage();
+        return 1;
+    }
+
+    divide_ctx_t ctx;
+    ctx.base = 10;
+    /* Only the last two values need the full 64 bit division */
+    for (unsigned i = 0; i < DIVIDE_VALUES - 2; i++) {
+        ctx.values[i] = 4000000000U - i * 271828183U;
+    }
+    ctx.values[DIVIDE_VALUES - 2] = 0x123456789abcdefULL;
+    ctx.values[DIVIDE_VALUES - 1] = 0xfedcba987654321ULL;
+
+    return bpf_run_with_context(rbpf, n, (void *)&ctx, sizeof(ctx));
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+#define STATEMACHINE_DATA_LEN 256
+
+typedef struct statemachine_ctx_s {
+    uint32_t len;
+    uint8_t data[STATEMACHINE_DATA_LEN];
+} statemachine_ctx_t;
+
+static const char statemachine_records[] =
+    "# sensor report\n"
+    "id=4096;temp=2315;hum=$3f;name=\"node \\\"a\\\"\";"
+    "pres=101325;mode=auto;mask=$ff00;count=17;"
+    "# calibration\n"
+    "offset=42;gain=$1a2b;label=\"xipfs\";uptime=86400;"
+    "id=4097;temp=2298;hum=$40;pres=101298;count=18;";
+
+static int bpf_run_statemachine(rbpf_application_t *rbpf, unsigned n, int argc, const char *argv[]) {
+    if (argc != 3) {
+        usage();
+        return 1;
+    }
+
+    statemachine_ctx_t ctx;
+    ctx.len = sizeof(statemachine_records) - 1;
+    for (unsigned i = 0; i < ctx.len; i++) {
+        ctx.data[i] = statemachine_records[i];
+    }
+
+    return bpf_run_with_context(rbpf, n, (void *)&ctx, sizeof(ctx));
+}
+
 
 int
 main(int argc, const char *argv[])
 {
-    rbpf_application_t rbpf;
+    rbpf_application_t rbpf = { 0 };
     uint64_t integer;
     char *endptr;
     unsigned n, bench_case_id;
@@ -423,7 +795,8 @@ main(int argc, const char *argv[])
             return bpf_run_with_integer(&rbpf, n, integer);
         }
 
-        case BENCH_CASE_FLETCHER32 : {
+        case BENCH_CASE_FLETCHER32 :
+        case BENCH_CASE_FLETCHER32_CALLS : {
             ret = init_rbpf(&rbpf, bench_case_infos[bench_case_id].filename);
             if (ret != 0)
                 return ret;
@@ -447,12 +820,60 @@ main(int argc, const char *argv[])
                 return ret;
             return bpf_run_memcpy(&rbpf, n, argc, argv);
         }
+        case BENCH_CASE_MEMCPY_LEN :
+        case BENCH_CASE_MEMCPY_HELPER : {
+            ret = init_rbpf(&rbpf, bench_case_infos[bench_case_id].filename);
+            if (ret != 0)
+                return ret;
+            return bpf_run_memcpy_len(&rbpf, n, argc, argv);
+        }
         case BENCH_CASE_BUBBLE_SORT : {
             ret = init_rbpf(&rbpf, bench_case_infos[bench_case_id].filename);
             if (ret != 0)
                 return ret;
             return bpf_run_bubble_sort(&rbpf, n, argc, argv);
         }
+        case BENCH_CASE_HDRPARSE : {
+            ret = init_rbpf(&rbpf, bench_case_infos[bench_case_id].filename);
+            if (ret != 0)
+                return ret;
+            return bpf_run_hdrparse(&rbpf, n, argc, argv);
+        }
+        case BENCH_CASE_CHAIN : {
+            if (argc < 4) {
+                usage();
+                return 1;
+            }
+
+            ret = init_rbpf(&rbpf, bench_case_infos[bench_case_id].filename);
+            if (ret != 0)
+                return ret;
+
+            integer = (unsigned)strtol(argv[3], &endptr, 10);
+            if (argv[3] == endptr ||  *endptr != '\0') {
+                printf(PROGNAME": %s: failed to parse integer\n", argv[3]);
+                return 1;
+            }
+            return bpf_run_chain(&rbpf, n, integer);
+        }
+        case BENCH_CASE_HISTOGRAM : {
+            ret = init_rbpf(&rbpf, bench_case_infos[bench_case_id].filename);
+            if (ret != 0)
+                return ret;
+            return bpf_run_histogram(&rbpf, n, argc, argv);
+        }
+        case BENCH_CASE_DIVIDE : {
+            ret = init_rbpf(&rbpf, bench_case_infos[bench_case_id].filename);
+            if (ret != 0)
+                return ret;
+            return bpf_run_divide(&rbpf, n, argc, argv);
+        }
+        case BENCH_CASE_STATEMACHINE : {
+            ret = init_rbpf(&rbpf, bench_case_infos[bench_case_id].filename);
+            if (ret != 0)
+                return ret;
+            return bpf_run_statemachine(&rbpf, n, argc, argv);
+        }
         default :
             usage();
             return 1;
@@ -14,10 +14,127 @@
 #define RBPF_ENABLE_ALU32 (1)
 #endif
 
+/* Dispatch the instructions with computed goto (GNU labels as values)
+ * instead of the switch based loop */
+#ifndef RBPF_ENABLE_COMPUTED_GOTO
+#if defined(__GNUC__)
+#define RBPF_ENABLE_COMPUTED_GOTO (1)
+#else
+#define RBPF_ENABLE_COMPUTED_GOTO (0)
+#endif
+#endif
+
+/* Compile applications to native code with rbpf_jit_compile(), only
+ * available on ARMv7-M (Thumb-2) targets */
+#ifndef RBPF_ENABLE_JIT
+#define RBPF_ENABLE_JIT (0)
+#endif
+
+/* Prove memory accesses safe during the pre-flight checks, the engine skips
+ * the memory check of the proven ones */
+#ifndef RBPF_ENABLE_RANGE_ANALYSIS
+#define RBPF_ENABLE_RANGE_ANALYSIS (1)
+#endif
+
+/* Number of jump targets for which the range analysis keeps the register
+ * state, every state takes 136 bytes of stack during the analysis. Other
+ * jump targets start from unknown registers */
+#ifndef RBPF_ANALYSIS_STATES
+#define RBPF_ANALYSIS_STATES (8)
+#endif
+
+/* Most iterations of a loop for the range analysis to prove it terminates.
+ * Applications with all their loops proven run without fuel */
+#ifndef RBPF_LOOP_TRIPS_MAX
+#define RBPF_LOOP_TRIPS_MAX (RBPF_BRANCHES_ALLOWED)
+#endif
+
+/* Most fuel the proven loops of an application would charge in a run, the
+ * loops inside a loop counted on every iteration of it. Above it the
+ * application runs with fuel, the default never lets a proven application
+ * run longer than the fuel of a run allows */
+#ifndef RBPF_LOOP_WORK_MAX
+#define RBPF_LOOP_WORK_MAX (RBPF_FUEL_ALLOWED)
+#endif
+
+/* Run the applications proven to only need the low 32 bits of their
+ * registers with a 32 bit register file. Needs the range analysis and is only
+ * available on targets with 32 bit pointers */
+#ifndef RBPF_ENABLE_REG32
+#if (RBPF_ENABLE_RANGE_ANALYSIS) && (UINTPTR_MAX == UINT32_MAX)
+#define RBPF_ENABLE_REG32 (1)
+#else
+#define RBPF_ENABLE_REG32 (0)
+#endif
+#endif
+
+/* Run the double word atomic instructions. Only available on targets with lock
+ * free 8 bytes atomics, ARMv7-M has no double word exclusive access: the
+ * pre-flight checks reject these instructions there */
+#ifndef RBPF_ENABLE_ATOMIC64
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_8)
+#define RBPF_ENABLE_ATOMIC64 (1)
+#else
+#define RBPF_ENABLE_ATOMIC64 (0)
+#endif
+#endif
+
+/* Count the runs of every instruction, the jumps taken and the memory checks
+ * missing the region of the previous access in the profile given with
+ * rbpf_application_set_profile(). Costs a few memory increments per
+ * instruction of the applications with a profile and a test per instruction
+ * of the others */
+#ifndef RBPF_ENABLE_PROFILE
+#define RBPF_ENABLE_PROFILE (0)
+#endif
+
+/* Fuse common sequences of instructions into a single handler during the
+ * pre-flight checks, saving the dispatches between them. Off by default when
+ * profiling, a fused handler counts as its first instruction */
+#ifndef RBPF_ENABLE_FUSION
+#if (RBPF_ENABLE_PROFILE)
+#define RBPF_ENABLE_FUSION (0)
+#else
+#define RBPF_ENABLE_FUSION (1)
+#endif
+#endif
+
+/* Count the dispatches saved by the fused handlers in
+ * rbpf_application_t::dispatches_fused, costs a memory increment per fused
+ * handler run */
+#ifndef RBPF_ENABLE_FUSION_STATS
+#define RBPF_ENABLE_FUSION_STATS (0)
+#endif
+
 #ifndef RBPF_BRANCHES_ALLOWED
 #define RBPF_BRANCHES_ALLOWED 10000
 #endif
 
+/* Default fuel of an application run, in instructions charged at the jumps
+ * going back. Covers RBPF_BRANCHES_ALLOWED loop iterations of 16 instructions */
+#ifndef RBPF_FUEL_ALLOWED
+#define RBPF_FUEL_ALLOWED (RBPF_BRANCHES_ALLOWED * 16)
+#endif
+
+/* Most stack frames of local function calls active at once, the first
+ * function included. Splits the stack into frames of RBPF_STACK_SIZE divided by
+ * this bytes, 1 disables the local calls. Every frame past the first one
+ * takes 36 bytes of the host stack during a run, 40 in native code */
+#ifndef RBPF_CALL_DEPTH_MAX
+#define RBPF_CALL_DEPTH_MAX (4)
+#endif
+
+/* Most tail calls made by a chain of applications started by one run */
+#ifndef RBPF_TAIL_CALLS_MAX
+#define RBPF_TAIL_CALLS_MAX (8)
+#endif
+
+/* Number of entries of the global key/value store shared by the
+ * applications, a power of two. Every entry takes 12 bytes */
+#ifndef RBPF_STORE_GLOBAL_ENTRIES
+#define RBPF_STORE_GLOBAL_ENTRIES (16)
+#endif
+
 
 #ifndef RBPF_EXTERNAL_CALLS
 static inline rbpf_call_t rbpf_get_external_call(uint32_t num)
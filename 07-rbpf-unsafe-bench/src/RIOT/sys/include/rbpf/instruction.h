@@ -135,6 +135,11 @@ extern "C" {
 #define BPF_INSTRUCTION_ALU32_MOV_IMM    (0xb4)
 #define BPF_INSTRUCTION_ALU32_ARSH_IMM   (0xc4)
 
+/* Byte swaps, converting the low 16, 32 or 64 bits given by the immediate to
+ * little or big endian */
+#define BPF_INSTRUCTION_ALU_END_LE       (0xd4)
+#define BPF_INSTRUCTION_ALU_END_BE       (0xdc)
+
 
 #define BPF_INSTRUCTION_JMP_ALWAYS  (0x05)
 #define BPF_INSTRUCTION_JMP_EQ_IMM  (0x15)
@@ -161,6 +166,12 @@ extern "C" {
 #define BPF_INSTRUCTION_JMP_SLT_REG (0xcd)
 #define BPF_INSTRUCTION_JMP_SLE_REG (0xdd)
 
+/* Jump through the table at the immediate offset in the read-only data,
+ * indexed by the destination register. The table is a 32 bit number of
+ * entries followed by that many instruction indices and a last, default,
+ * index taken by the indices past the table */
+#define BPF_INSTRUCTION_JMP_TABLE   (0x0d)
+
 #define BPF_INSTRUCTION_MEM_LDDW    (0x18)
 #define BPF_INSTRUCTION_MEM_LDDWD   (0xB8)
 #define BPF_INSTRUCTION_MEM_LDDWR   (0xD8)
@@ -180,7 +191,29 @@ extern "C" {
 #define BPF_INSTRUCTION_MEM_LDXB    (0x71)
 #define BPF_INSTRUCTION_MEM_LDXDW   (0x79)
 
+/* Atomic read-modify-write of a word or a double word, the operation is in
+ * the immediate */
+#define BPF_INSTRUCTION_MEM_ATOMICW     (0xc3)
+#define BPF_INSTRUCTION_MEM_ATOMICDW    (0xdb)
+
+/* Operations of the atomic instructions. The FETCH ones also load the
+ * previous value in the source register, CMPXCHG only stores the source
+ * register when the memory holds r0 and always loads the previous value in r0 */
+#define BPF_INSTRUCTION_ATOMIC_FETCH        (0x01)
+#define BPF_INSTRUCTION_ATOMIC_ADD          (0x00)
+#define BPF_INSTRUCTION_ATOMIC_OR           (0x40)
+#define BPF_INSTRUCTION_ATOMIC_AND          (0x50)
+#define BPF_INSTRUCTION_ATOMIC_XOR          (0xa0)
+#define BPF_INSTRUCTION_ATOMIC_FETCH_ADD    (0x01)
+#define BPF_INSTRUCTION_ATOMIC_FETCH_OR     (0x41)
+#define BPF_INSTRUCTION_ATOMIC_FETCH_AND    (0x51)
+#define BPF_INSTRUCTION_ATOMIC_FETCH_XOR    (0xa1)
+#define BPF_INSTRUCTION_ATOMIC_XCHG         (0xe1)
+#define BPF_INSTRUCTION_ATOMIC_CMPXCHG      (0xf1)
+
 #define BPF_INSTRUCTION_CALL        (0x85)
+/* Source register of the calls to a function of the application */
+#define BPF_INSTRUCTION_CALL_LOCAL_SRC  (1)
 #define BPF_INSTRUCTION_RETURN      (0x95)
 
 /**
@@ -18,40 +18,131 @@
 #include "rbpf/builtin_calls.h"
 #include "rbpf/instruction.h"
 #include "rbpf/config.h"
+#include "handlers.h"
 
-static bool _check_mem(const rbpf_application_t *rbpf, const intptr_t addr, size_t size,
-                       uint8_t type)
+extern void rbpf_application_instance_init(rbpf_application_t *inst,
+                                           const rbpf_application_t *rbpf, uint8_t *stack,
+                                           size_t stack_len);
+
+static inline bool _check_list(const rbpf_application_t *rbpf, const intptr_t addr, size_t size,
+                               uint8_t type)
+{
+    const intptr_t end = addr + size;
+
+    for (const rbpf_mem_region_t *region = &rbpf->stack_region; region; region = region->next) {
+        if ((addr >= (intptr_t)(region->start)) &&
+            (end <= (intptr_t)(region->start + region->len)) &&
+            (region->flags & type)) {
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static inline bool _check_table(rbpf_region_table_t *table, uintptr_t start, uintptr_t end)
+{
+    unsigned low = 0;
+    unsigned high = table->len;
+
+    /* Find the first entry starting after the access */
+    while (low < high) {
+        unsigned mid = (low + high) / 2;
+        if (table->entries[mid].start <= start) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    /* Walk back over the entries starting before it, while any can still
+     * cover the end of the access */
+    while (low-- > 0 && table->entries[low].reach >= end) {
+        if (table->entries[low].end >= end) {
+            table->last = low;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static inline bool _check_slow(rbpf_application_t *rbpf, rbpf_region_table_t *table,
+                               uintptr_t start, uintptr_t end, uint8_t type)
+{
+    if (end < start) {
+        return false;
+    }
+#if (RBPF_ENABLE_PROFILE)
+    /* Counted on the instruction running, the fast path hit the region of
+     * the previous access */
+    if (rbpf->profile) {
+        rbpf->profile->current->misses++;
+    }
+#endif
+    if (rbpf->flags & RBPF_FLAG_REGIONS_OVERFLOW) {
+        return _check_list(rbpf, start, end - start, type);
+    }
+    if ((rbpf->arg_region.flags & type) &&
+        start >= (uintptr_t)rbpf->arg_region.start &&
+        end <= (uintptr_t)rbpf->arg_region.start + rbpf->arg_region.len) {
+        return true;
+    }
+    return _check_table(table, start, end);
+}
+
+static inline bool _check_mem(rbpf_application_t *rbpf, const intptr_t addr, size_t size,
+                              uint8_t type)
 {
     /* no more checks */
     return true;
 }
 
-static bool _check_load(const rbpf_application_t *rbpf, const intptr_t addr, size_t size)
+static inline bool _check_load(rbpf_application_t *rbpf, const intptr_t addr, size_t size)
 {
     return _check_mem(rbpf, addr, size, RBPF_MEM_REGION_READ);
 }
 
-static bool _check_store(const rbpf_application_t *rbpf, const intptr_t addr, size_t size)
+static inline bool _check_store(rbpf_application_t *rbpf, const intptr_t addr, size_t size)
 {
     return _check_mem(rbpf, addr, size, RBPF_MEM_REGION_WRITE);
 }
 
-bool rbpf_store_allowed(const rbpf_application_t *rbpf, void *addr, size_t size)
+/* Atomic accesses both load and store, and the exclusive accesses they are
+ * made of fault on unaligned addresses */
+static inline bool _check_atomic(rbpf_application_t *rbpf, const intptr_t addr, size_t size)
+{
+    return !(addr & (size - 1)) && _check_load(rbpf, addr, size) &&
+           _check_store(rbpf, addr, size);
+}
+
+bool rbpf_store_allowed(rbpf_application_t *rbpf, void *addr, size_t size)
 {
     return _check_store(rbpf, (intptr_t)addr, size);
 }
 
-bool rbpf_load_allowed(const rbpf_application_t *rbpf, void *addr, size_t size)
+bool rbpf_load_allowed(rbpf_application_t *rbpf, void *addr, size_t size)
 {
     return _check_load(rbpf, (intptr_t)addr, size);
 }
 
-static rbpf_call_t _rbpf_get_call(uint32_t num)
+/* The tail call to the application at index can be made */
+static inline bool _tail_call_allowed(const rbpf_application_t *rbpf, uint64_t index)
 {
-    switch (num) {
-    default:
-        return rbpf_get_external_call(num);
+    return rbpf->tail_calls > 0 && rbpf->progs && index < rbpf->progs->len &&
+           rbpf->progs->entries[index];
+}
+
+uint32_t rbpf_vm_tail_call(rbpf_application_t *rbpf, uint64_t *regs)
+{
+    if (_tail_call_allowed(rbpf, regs[1])) {
+        regs[0] = regs[1];
+        return RBPF_TAIL_CALL;
     }
+    regs[0] = (uint64_t)-1;
+    return RBPF_OK;
 }
 
 /**
@@ -59,15 +150,98 @@ static rbpf_call_t _rbpf_get_call(uint32_t num)
  */
 
 /* Macro for the destination, source and immediate value */
-#define DST regmap[(*instr)->dst]   /* DST is the register targeted by the instruction */
-#define SRC regmap[(*instr)->src]   /* SRC is the source register from the instruction */
-#define IMM (*instr)->immediate     /* And this one matches the immediate value in the instruction */
+#define DST regmap[instr->dst]      /* DST is the register targeted by the instruction */
+#define SRC regmap[instr->src]      /* SRC is the source register from the instruction */
+#define IMM instr->immediate        /* And this one matches the (sign extended) immediate value */
+
+/* Count the run of the instruction about to be dispatched and the jumps it
+ * takes, profile is the profile of the application in the interpreter loop */
+#if (RBPF_ENABLE_PROFILE)
+#define PROFILE_INSN() \
+    if (profile) { \
+        profile->current = &profile->entries[instr - rbpf->insns]; \
+        profile->current->count++; \
+    }
+#define PROFILE_TAKEN() \
+    if (profile) { \
+        profile->entries[instr - rbpf->insns].taken++; \
+    }
+#define PROFILING(rbpf)     ((rbpf)->profile != NULL)
+#else
+#define PROFILE_INSN()
+#define PROFILE_TAKEN()
+#define PROFILING(rbpf)     false
+#endif
+
+/*
+ * Dispatch helpers. With computed goto every handler ends with its own
+ * indirect jump to the next handler (direct threading). The table holds label
+ * offsets relative to the illegal instruction handler instead of absolute
+ * label addresses, this keeps it in .rodata and free of relocations, which
+ * matters for position independent builds such as the FAE ones.
+ *
+ * Without computed goto, the handlers are the cases of a switch in a loop.
+ */
+#if (RBPF_ENABLE_COMPUTED_GOTO)
+#define HANDLER(name)       _rbpf_op_ ## name:
+#define DISPATCH()          PROFILE_INSN() goto *(&&_rbpf_op_ILLEGAL + _rbpf_ops[instr->handler])
+#define DISPATCH_BEGIN      DISPATCH();
+#define DISPATCH_END
+#else
+#define HANDLER(name)       case RBPF_HANDLER_ ## name:
+#define DISPATCH()          continue
+#define DISPATCH_BEGIN      for (;;) { PROFILE_INSN() switch (instr->handler) {
+#define DISPATCH_END        } }
+#endif
+
+/* Continue with the next instruction */
+#define NEXT \
+    instr++; \
+    DISPATCH()
+
+/* Continue after the instructions run by a fused handler */
+#define NEXT_FUSED(n) \
+    instr += (n); \
+    DISPATCH()
 
-#define CONT_JUMP \
-    if (jump_cond) { \
-        return _rbpf_jump(rbpf, instr); \
+/* Account the dispatches saved by a fused handler of n instructions */
+#if (RBPF_ENABLE_FUSION_STATS)
+#define FUSED(n)            rbpf->dispatches_fused += (n) - 1
+#else
+#define FUSED(n)            (void)0
+#endif
+
+/* Stop the virtual machine with the supplied exit code */
+#define EXIT(code) \
+    res = (code); \
+    goto exit
+
+/* Continue with the jump target. Only the jumps going back can run
+ * instructions again, they charge the fuel with the number of instructions up
+ * to their target, which bounds the work of a loop iteration. The meter mask
+ * clears the charge of the applications running unmetered */
+#define JUMP_TO(target) \
+    if ((target) <= instr) { \
+        uint32_t cost = (uint32_t)(instr - (target) + 1) & meter; \
+        if (cost > fuel) { \
+            EXIT(RBPF_OUT_OF_BRANCHES); \
+        } \
+        fuel -= cost; \
     } \
-    break;
+    PROFILE_TAKEN() \
+    instr = (target); \
+    DISPATCH()
+
+/* Continue with the resolved jump target */
+#define JUMP                JUMP_TO(instr->target)
+
+/* Unsigned division and modulo using the hardware divide when the upper
+ * halves of both operands are zero, which they nearly always are. A division
+ * of two uint64_t otherwise calls __aeabi_uldivmod, a software routine */
+#define UDIV(a, b) \
+    ((((uint64_t)(a) | (uint64_t)(b)) >> 32) ? (a) / (b) : (uint32_t)(a) / (uint32_t)(b))
+#define UMOD(a, b) \
+    ((((uint64_t)(a) | (uint64_t)(b)) >> 32) ? (a) % (b) : (uint32_t)(a) % (uint32_t)(b))
 
 /* Check if we implement 32 bit instructions */
 #if (RBPF_ENABLE_ALU32)
@@ -76,297 +250,334 @@ static rbpf_call_t _rbpf_get_call(uint32_t num)
  * itself. ALU(ADD, +) generates the 2 or 4 instructions implementing the add
  * instruction, using '+' in C. Generates both the DST += SRC and DST += IMM */
 #define ALU(OPCODE, OP)         \
-    case BPF_INSTRUCTION_ALU64_ ## OPCODE ## _REG:         \
+    HANDLER(ALU64_ ## OPCODE ## _REG)         \
         DST = DST OP SRC;       \
-        break;                   \
-    case BPF_INSTRUCTION_ALU64_ ## OPCODE ## _IMM:       \
+        NEXT;                   \
+    HANDLER(ALU64_ ## OPCODE ## _IMM)       \
         DST = DST OP IMM;       \
-        break;                   \
-    case BPF_INSTRUCTION_ALU32_ ## OPCODE ## _REG:         \
+        NEXT;                   \
+    HANDLER(ALU32_ ## OPCODE ## _REG)         \
         DST = (uint32_t)DST OP(uint32_t) SRC;   \
-        break;                   \
-    case BPF_INSTRUCTION_ALU32_ ## OPCODE ## _IMM:           \
+        NEXT;                   \
+    HANDLER(ALU32_ ## OPCODE ## _IMM)           \
         DST = (uint32_t)DST OP(uint32_t) IMM;   \
-        break;
+        NEXT;
 #else
 #define ALU(OPCODE, OP)         \
-    case BPF_INSTRUCTION_ALU64_ ## OPCODE ## _REG:         \
+    HANDLER(ALU64_ ## OPCODE ## _REG)         \
         DST = DST OP SRC;       \
-        break;                   \
-    case BPF_INSTRUCTION_ALU64_ ## OPCODE ## _IMM:       \
+        NEXT;                   \
+    HANDLER(ALU64_ ## OPCODE ## _IMM)       \
         DST = DST OP IMM;       \
-        break;
+        NEXT;
 #endif
 
 /* Generate jump type instructions, similar to the ALU instructions */
 #define COND_JMP(SIGN, OPCODE, CMP_OP)              \
-    case BPF_INSTRUCTION_JMP_ ## OPCODE ## _REG:                  \
-        { \
-            bool jump_cond = (SIGN ## nt64_t)DST CMP_OP(SIGN ## nt64_t) SRC; \
-            CONT_JUMP;                           \
+    HANDLER(JMP_ ## OPCODE ## _REG)               \
+        if ((SIGN ## nt64_t)DST CMP_OP(SIGN ## nt64_t) SRC) { \
+            JUMP;                           \
         } \
-    case BPF_INSTRUCTION_JMP_ ## OPCODE ## _IMM:                 \
-        { \
-            bool jump_cond = (SIGN ## nt64_t)DST CMP_OP(SIGN ## nt64_t) IMM; \
-            CONT_JUMP;                           \
+        NEXT; \
+    HANDLER(JMP_ ## OPCODE ## _IMM)              \
+        if ((SIGN ## nt64_t)DST CMP_OP(SIGN ## nt64_t) IMM) { \
+            JUMP;                           \
+        } \
+        NEXT;
+
+/* Generate the fused handlers adding an immediate before a conditional jump,
+ * the jump is the next instruction */
+#define FUSED_JMP(SIGN, OPCODE, CMP_OP)              \
+    HANDLER(FUSED_ADD_JMP_ ## OPCODE ## _REG)     \
+        FUSED(2); \
+        DST += IMM; \
+        instr++; \
+        if ((SIGN ## nt64_t)DST CMP_OP(SIGN ## nt64_t) SRC) { \
+            JUMP;                           \
         } \
+        NEXT; \
+    HANDLER(FUSED_ADD_JMP_ ## OPCODE ## _IMM)     \
+        FUSED(2); \
+        DST += IMM; \
+        instr++; \
+        if ((SIGN ## nt64_t)DST CMP_OP(SIGN ## nt64_t) IMM) { \
+            JUMP;                           \
+        } \
+        NEXT;
 
-/* Generate all the different regular load variants */
+/* Generate all the different regular load variants, with the variants of the
+ * accesses proven in bounds by the verifier */
 #define MEM(SIZEOP, SIZE)                     \
-    case BPF_INSTRUCTION_MEM_STX ## SIZEOP:                       \
-        if (!_check_store(rbpf, DST + (*instr)->offset, sizeof(SIZE))) { \
-            return RBPF_ILLEGAL_MEM; \
+    HANDLER(MEM_STX ## SIZEOP)                    \
+        if (!_check_store(rbpf, DST + instr->offset, sizeof(SIZE))) { \
+            EXIT(RBPF_ILLEGAL_MEM); \
+        } \
+        *(SIZE *)(uintptr_t)(DST + instr->offset) = SRC;   \
+        NEXT;                               \
+    HANDLER(MEM_ST ## SIZEOP)                   \
+        if (!_check_store(rbpf, DST + instr->offset, sizeof(SIZE))) { \
+            EXIT(RBPF_ILLEGAL_MEM); \
+        } \
+        *(SIZE *)(uintptr_t)(DST + instr->offset) = IMM;   \
+        NEXT;                               \
+    HANDLER(MEM_LDX ## SIZEOP)                   \
+        if (!_check_load(rbpf, SRC + instr->offset, sizeof(SIZE))) { \
+            EXIT(RBPF_ILLEGAL_MEM); \
         } \
-        *(SIZE *)(uintptr_t)(DST + (*instr)->offset) = SRC;   \
-        break;                               \
-    case BPF_INSTRUCTION_MEM_ST ## SIZEOP:                      \
-        if (!_check_store(rbpf, DST + (*instr)->offset, sizeof(SIZE))) { \
-            return RBPF_ILLEGAL_MEM; \
+        DST = *(const SIZE *)(uintptr_t)(SRC + instr->offset);   \
+        NEXT;                               \
+    HANDLER(MEM_STX ## SIZEOP ## _CTX)            \
+        if (!ctx_ok && !_check_store(rbpf, DST + instr->offset, sizeof(SIZE))) { \
+            EXIT(RBPF_ILLEGAL_MEM); \
         } \
-        *(SIZE *)(uintptr_t)(DST + (*instr)->offset) = IMM;   \
-        break;                               \
-    case BPF_INSTRUCTION_MEM_LDX ## SIZEOP:                      \
-        if (!_check_load(rbpf, SRC + (*instr)->offset, sizeof(SIZE))) { \
-            return RBPF_ILLEGAL_MEM; \
+        *(SIZE *)(uintptr_t)(DST + instr->offset) = SRC;   \
+        NEXT;                               \
+    HANDLER(MEM_STX ## SIZEOP ## _SAFE)           \
+        *(SIZE *)(uintptr_t)(DST + instr->offset) = SRC;   \
+        NEXT;                               \
+    HANDLER(MEM_ST ## SIZEOP ## _CTX)             \
+        if (!ctx_ok && !_check_store(rbpf, DST + instr->offset, sizeof(SIZE))) { \
+            EXIT(RBPF_ILLEGAL_MEM); \
         } \
-        DST = *(const SIZE *)(uintptr_t)(SRC + (*instr)->offset);   \
-        break;
+        *(SIZE *)(uintptr_t)(DST + instr->offset) = IMM;   \
+        NEXT;                               \
+    HANDLER(MEM_ST ## SIZEOP ## _SAFE)            \
+        *(SIZE *)(uintptr_t)(DST + instr->offset) = IMM;   \
+        NEXT;                               \
+    HANDLER(MEM_LDX ## SIZEOP ## _CTX)            \
+        if (!ctx_ok && !_check_load(rbpf, SRC + instr->offset, sizeof(SIZE))) { \
+            EXIT(RBPF_ILLEGAL_MEM); \
+        } \
+        DST = *(const SIZE *)(uintptr_t)(SRC + instr->offset);   \
+        NEXT;                               \
+    HANDLER(MEM_LDX ## SIZEOP ## _SAFE)           \
+        DST = *(const SIZE *)(uintptr_t)(SRC + instr->offset);   \
+        NEXT;
+
+/* Generate the atomic instructions of a width. The compiler builtins are
+ * exclusive load and store loops on ARMv7-M, the FETCH variants keep the
+ * previous value zero extended in the source register */
+#define ATOMIC_CHECK(SIZE) \
+    if (!_check_atomic(rbpf, DST + instr->offset, sizeof(SIZE))) { \
+        EXIT(RBPF_ILLEGAL_MEM); \
+    }
 
-static inline int _rbpf_over_max_jumps(const rbpf_application_t *rbpf)
-{
-    return !(rbpf->flags & RBPF_CONFIG_NO_RETURN) && rbpf->branches_remaining == 0;
-}
+#define ATOMIC_OP(SIZEOP, SIZE, OPCODE, BUILTIN)   \
+    HANDLER(ATOMIC ## SIZEOP ## _ ## OPCODE)        \
+        ATOMIC_CHECK(SIZE) \
+        BUILTIN((SIZE *)(uintptr_t)(DST + instr->offset), (SIZE)SRC, __ATOMIC_SEQ_CST); \
+        NEXT; \
+    HANDLER(ATOMIC ## SIZEOP ## _FETCH_ ## OPCODE)  \
+        ATOMIC_CHECK(SIZE) \
+        SRC = BUILTIN((SIZE *)(uintptr_t)(DST + instr->offset), (SIZE)SRC, __ATOMIC_SEQ_CST); \
+        NEXT;
+
+#define ATOMIC(SIZEOP, SIZE)                    \
+    ATOMIC_OP(SIZEOP, SIZE, ADD, __atomic_fetch_add) \
+    ATOMIC_OP(SIZEOP, SIZE, OR, __atomic_fetch_or) \
+    ATOMIC_OP(SIZEOP, SIZE, AND, __atomic_fetch_and) \
+    ATOMIC_OP(SIZEOP, SIZE, XOR, __atomic_fetch_xor) \
+    HANDLER(ATOMIC ## SIZEOP ## _XCHG)          \
+        ATOMIC_CHECK(SIZE) \
+        SRC = __atomic_exchange_n((SIZE *)(uintptr_t)(DST + instr->offset), (SIZE)SRC, \
+                                  __ATOMIC_SEQ_CST); \
+        NEXT; \
+    HANDLER(ATOMIC ## SIZEOP ## _CMPXCHG)       \
+        ATOMIC_CHECK(SIZE) \
+        { \
+            SIZE expected = (SIZE)regmap[0]; \
+            __atomic_compare_exchange_n((SIZE *)(uintptr_t)(DST + instr->offset), &expected, \
+                                        (SIZE)SRC, false, __ATOMIC_SEQ_CST, \
+                                        __ATOMIC_SEQ_CST); \
+            regmap[0] = expected; \
+        } \
+        NEXT;
+
+/* The interpreter loop with the 64 bit registers of the virtual machine */
+#define RBPF_LOOP_NAME  _rbpf_run64
+#define RBPF_LOOP_REG_T uint64_t
+#define RBPF_LOOP_CALLS 1
+#include "engine_loop.h"
+
+#if (RBPF_ENABLE_REG32)
+/* The interpreter loop with 32 bit registers, for the applications the
+ * verifier proved to never need the upper halves */
+#define RBPF_LOOP_NAME  _rbpf_run32
+#define RBPF_LOOP_REG_T uint32_t
+#define RBPF_LOOP_CALLS 0
+#include "engine_loop.h"
+#endif
 
-/* Asking the compiler to really inline this call is the easiest way to speed up the VM */
-static inline int __attribute__((always_inline)) _rbpf_jump(rbpf_application_t *rbpf, const bpf_instruction_t **instr)
+/* The registers at the start of a run, the verifier relies on all of them
+ * being zero but the context and the frame pointer */
+static inline void _rbpf_regmap_init(const rbpf_application_t *rbpf, uint64_t *regmap,
+                                     const void *ctx)
 {
-    *instr += (*instr)->offset;
-    rbpf->branches_remaining--;
-    if (_rbpf_over_max_jumps(rbpf)) {
-        return RBPF_OUT_OF_BRANCHES;
-    }
-    return RBPF_CONTINUE;
+    /*
+     * Assigned one by one because `uint64_t regmap[11] = { 0 };` makes the compiler generates a
+     * memset call, which would be triggering either a direct call to RIOT's memset or a syscall
+     * to it. It can badly damage the performance and introduce false results.
+     */
+    regmap[0] = 0;
+    regmap[1] = (uint64_t)(uintptr_t)ctx;
+    regmap[2] = 0;
+    regmap[3] = 0;
+    regmap[4] = 0;
+    regmap[5] = 0;
+    regmap[6] = 0;
+    regmap[7] = 0;
+    regmap[8] = 0;
+    regmap[9] = 0;
+    regmap[10] = (uint64_t)(uintptr_t)(rbpf->stack + rbpf->stack_len);
 }
 
-/* Asking the compiler to really inline this call is the easiest way to speed up the VM */
-static inline int __attribute__((always_inline)) _rbpf_instruction(rbpf_application_t *rbpf,
-                                    const bpf_instruction_t **instr, uint64_t regmap[11])
+/* The context holds the declared fields, none above its maximum */
+static bool _rbpf_ctx_bounded(const rbpf_application_t *rbpf)
 {
-    switch ((*instr)->opcode) {
-
-    /* Macros implementing the instruction code for the simple ALU(32|64) based operations */
-    ALU(ADD,  +)
-    ALU(SUB,  -)
-    ALU(AND,  &)
-    ALU(OR,   |)
-    ALU(LSH, <<)
-    ALU(RSH, >>)
-    ALU(XOR,  ^)
-    ALU(MUL,  *)
-
-    /* These need additional checks inside */
-    case BPF_INSTRUCTION_ALU64_MOD_REG:
-        if (SRC == 0) {
-            return RBPF_ILLEGAL_DIV;
-        }
-        DST = DST % SRC;
-        break;
-    case BPF_INSTRUCTION_ALU64_MOD_IMM:
-        if (IMM == 0) {
-            return RBPF_ILLEGAL_DIV;
-        }
-        DST = DST % IMM;
-        break;
-#if (RBPF_ENABLE_ALU32)
-    case BPF_INSTRUCTION_ALU32_MOD_REG:
-        if (SRC == 0) {
-            return RBPF_ILLEGAL_DIV;
-        }
-        DST = (uint32_t)DST % (uint32_t)SRC;
-        break;
-    case BPF_INSTRUCTION_ALU32_MOD_IMM:
-        if (IMM == 0) {
-            return RBPF_ILLEGAL_DIV;
-        }
-        DST = (uint32_t)DST % (uint32_t)IMM;
-        break;
-#endif
+    const uint8_t *ctx = rbpf->arg_region.start;
 
-    /* These need additional checks inside */
-    case BPF_INSTRUCTION_ALU64_DIV_REG:
-        if (SRC == 0) {
-            return RBPF_ILLEGAL_DIV;
-        }
-        DST = DST / SRC;
-        break;
-    case BPF_INSTRUCTION_ALU64_DIV_IMM:
-        if (IMM == 0) {
-            return RBPF_ILLEGAL_DIV;
+    for (size_t k = 0; k < rbpf->ctx_bounds_len; k++) {
+        const rbpf_ctx_bound_t *bound = &rbpf->ctx_bounds[k];
+        const uint8_t *field = ctx + bound->offset;
+        uint32_t value = 0;
+
+        if ((size_t)bound->offset + bound->size > rbpf->arg_region.len) {
+            return false;
         }
-        DST = DST / IMM;
-        break;
-#if (RBPF_ENABLE_ALU32)
-    case BPF_INSTRUCTION_ALU32_DIV_REG:
-        if (SRC == 0) {
-            return RBPF_ILLEGAL_DIV;
+        /* Little endian like the loads of the application, a byte at a
+         * time as the field may not be aligned */
+        for (unsigned b = bound->size; b--;) {
+            value = (value << 8) | field[b];
         }
-        DST = (uint32_t)DST / (uint32_t)SRC;
-        break;
-    case BPF_INSTRUCTION_ALU32_DIV_IMM:
-        if (IMM == 0) {
-            return RBPF_ILLEGAL_DIV;
+        if (value > bound->max) {
+            return false;
         }
-        DST = (uint32_t)DST / (uint32_t)IMM;
-        break;
-#endif
+    }
+    return true;
+}
 
-    /* These only have an immediate argument variant */
-    case BPF_INSTRUCTION_ALU64_NEG_IMM:
-        DST = -(int64_t)DST;
-        break;
+/* Runs the checked application from the entry with the initialized registers */
+static int _rbpf_engine_exec(rbpf_application_t *rbpf, size_t entry, uint64_t *regmap,
+                             int64_t *result)
+{
+    int res;
 
-#if (RBPF_ENABLE_ALU32)
-    case BPF_INSTRUCTION_ALU32_NEG_IMM:
-        DST = -(int32_t)DST;
-        break;
-
-    /* MOV doesn't have an operation associated (breaks the pattern) */
-    case BPF_INSTRUCTION_ALU32_MOV_IMM:
-        DST = (uint32_t)IMM;
-        break;
-    case BPF_INSTRUCTION_ALU32_MOV_REG:
-        DST = (uint32_t)SRC;
-        break;
-#endif
-    case BPF_INSTRUCTION_ALU64_MOV_IMM:
-        DST = IMM;
-        break;
-    case BPF_INSTRUCTION_ALU64_MOV_REG:
-        DST = SRC;
-        break;
-
-    /* Arithmetic shift also don't really fit the pattern */
-    case BPF_INSTRUCTION_ALU64_ARSH_REG:
-        (*(int64_t *)&DST) >>= SRC;
-        break;
-    case BPF_INSTRUCTION_ALU64_ARSH_IMM:
-        (*(int64_t *)&DST) >>= IMM;
-        break;
-#if (RBPF_ENABLE_ALU32)
-    case BPF_INSTRUCTION_ALU32_ARSH_REG:
-        DST = (int32_t)DST >> SRC;
-        break;
-    case BPF_INSTRUCTION_ALU32_ARSH_IMM:
-        DST =  (int32_t)DST >> IMM;
-        break;
+    /* The pre-flight checks relied on the maxima of the context fields */
+    if (rbpf->ctx_bounds_len && !_rbpf_ctx_bounded(rbpf)) {
+        return RBPF_ILLEGAL_CTX;
+    }
+
+#if (RBPF_ENABLE_JIT)
+    /* The native code has no counters, the profiled applications are
+     * interpreted */
+    if (rbpf->jit && !PROFILING(rbpf)) {
+        res = rbpf->jit(rbpf, regmap, rbpf->fuel, entry);
+        *result = regmap[0];
+        return res;
+    }
 #endif
 
-    /* Double word memory load, takes up two instructions, but acts as one */
-    case BPF_INSTRUCTION_MEM_LDDW:
-        DST = (uint64_t)(*instr)->immediate;
-        DST |= ((uint64_t)(((*instr) + 1)->immediate)) << 32;
-        (*instr)++;
-        break;
-
-    /* Custom instruction to load an address as double word relative to the application data.
-     * Takes up two instructions, but acts as one */
-    case BPF_INSTRUCTION_MEM_LDDWD:
-        DST = (intptr_t)rbpf_application_data(rbpf);
-        DST += (uint64_t)(*instr)->immediate;
-        DST += ((uint64_t)(((*instr) + 1)->immediate)) << 32;
-        (*instr)++;
-        break;
-
-    /* Custom instruction to load an address as double word relative to the application rodata.
-     * Takes up two instructions, but acts as one */
-    case BPF_INSTRUCTION_MEM_LDDWR:
-        DST = (intptr_t)rbpf_application_rodata(rbpf);
-        DST += (uint64_t)(*instr)->immediate;
-        DST += ((uint64_t)(((*instr) + 1)->immediate)) << 32;
-        (*instr)++;
-        break;
-
-/* Regular memory instructions with different sizes */
-        MEM(B, uint8_t)
-        MEM(H, uint16_t)
-        MEM(W, uint32_t)
-        MEM(DW, uint64_t)
-
-    case BPF_INSTRUCTION_JMP_ALWAYS:
-        return _rbpf_jump(rbpf, instr);
-
-        /* generate jump instructions */
-        COND_JMP(ui, EQ, ==)
-        COND_JMP(ui, GT, >)
-        COND_JMP(ui, GE, >=)
-        COND_JMP(ui, LT, <)
-        COND_JMP(ui, LE, <=)
-        COND_JMP(ui, SET, &)
-        COND_JMP(ui, NE, !=)
-        COND_JMP(i, SGT, >)
-        COND_JMP(i, SGE, >=)
-        COND_JMP(i, SLT, <)
-        COND_JMP(i, SLE, <=)
-
-    case BPF_INSTRUCTION_CALL:
-    {
-        rbpf_call_t call = _rbpf_get_call((*instr)->immediate);
-        if (call) {
-            regmap[0] = (*(call))(rbpf,
-                                  regmap);
-            break;
-        }
-        else {
-            return RBPF_ILLEGAL_CALL;
+#if (RBPF_ENABLE_REG32)
+    if (rbpf->flags & RBPF_FLAG_REG32) {
+        uint32_t regmap32[11];
+
+        for (unsigned r = 0; r < 11; r++) {
+            regmap32[r] = regmap[r];
         }
+        res = _rbpf_run32(rbpf, regmap32, &rbpf->insns[entry]);
+        *result = regmap32[0];
+        return res;
     }
-    case BPF_INSTRUCTION_RETURN:
-        return RBPF_OK;
+#endif
 
-    default:
-        return RBPF_ILLEGAL_INSTRUCTION;
-    }
-    return RBPF_CONTINUE;
+    res = _rbpf_run64(rbpf, regmap, &rbpf->insns[entry]);
+    *result = regmap[0];
+    return res;
 }
 
-int rbpf_engine_run(rbpf_application_t *rbpf, const void *ctx, int64_t *result)
+/* The pre-flight checks, the proven stack accesses also need a stack of the
+ * depth they computed */
+static int _rbpf_engine_ready(rbpf_application_t *rbpf)
 {
-    int res = RBPF_OK;
-
-    rbpf->branches_remaining = RBPF_BRANCHES_ALLOWED;
-    /*
-     * This expression is commented because it makes the compiler generates a memset call,
-     * which would be triggering either a direct call to RIOT's memset or a syscall to it.
-     * It can badly damage the performance and introduce false results.
-     *
-     * uint64_t regmap[11] = { 0 };
-     */
-    uint64_t regmap[11];
+    int res = rbpf_application_verify_preflight(rbpf);
 
-    regmap[0] = 0;
-    regmap[1] = (uint64_t)(uintptr_t)ctx;
-    regmap[2] = 0;
-    regmap[3] = 0;
-    regmap[4] = 0;
-    regmap[5] = 0;
-    regmap[6] = 0;
-    regmap[7] = 0;
-    regmap[8] = 0;
-    regmap[9] = 0;
-    regmap[10] = (uint64_t)(uintptr_t)(rbpf->stack + RBPF_STACK_SIZE);
+    if (res < 0) {
+        return res;
+    }
+    return rbpf->stack_len < rbpf->stack_depth ? RBPF_ILLEGAL_STACK : RBPF_OK;
+}
 
-    const bpf_instruction_t *instr = (const bpf_instruction_t *)rbpf_application_text(rbpf);
+static int _rbpf_engine_run(rbpf_application_t *rbpf, size_t entry, const void *ctx,
+                            int64_t *result)
+{
+    uint64_t regmap[11];
+    int res = _rbpf_engine_ready(rbpf);
 
-    res = rbpf_application_verify_preflight(rbpf);
     if (res < 0) {
         return res;
     }
+    _rbpf_regmap_init(rbpf, regmap, ctx);
+    return _rbpf_engine_exec(rbpf, entry, regmap, result);
+}
 
-    do {
-        res = _rbpf_instruction(rbpf, &instr, regmap);
-        instr++;
-    } while (res > 0);
-    *result = regmap[0];
+/* Follows the tail calls of a run until an application of the chain exits */
+static int _rbpf_engine_chain(rbpf_application_t *rbpf, int res, const void *ctx,
+                              int64_t *result)
+{
+    /* The tail call checked the index in the result and the chain, the next
+     * application takes over the context */
+    while (res == RBPF_TAIL_CALL) {
+        rbpf_application_t *next = rbpf->progs->entries[*result];
+        const uint8_t tail_calls = rbpf->tail_calls - 1;
+        const size_t ctx_len = rbpf->arg_region.len;
+        const uint8_t ctx_flags = rbpf->arg_region.flags;
+
+        /* An execution context keeps its stack and takes the state of the
+         * next application, which other runs may share */
+        if (rbpf->flags & RBPF_FLAG_INSTANCE) {
+            rbpf_application_instance_init(rbpf, next, rbpf->stack, rbpf->stack_len);
+            next = rbpf;
+        }
+        rbpf_memory_region_init(&next->arg_region, (void *)(uintptr_t)ctx, ctx_len, ctx_flags);
+        next->tail_calls = tail_calls;
+        rbpf = next;
+        res = _rbpf_engine_run(rbpf, 0, ctx, result);
+    }
     return res;
 }
 
+int rbpf_engine_run(rbpf_application_t *rbpf, size_t entry, const void *ctx, int64_t *result)
+{
+    rbpf->tail_calls = RBPF_TAIL_CALLS_MAX;
+    return _rbpf_engine_chain(rbpf, _rbpf_engine_run(rbpf, entry, ctx, result), ctx, result);
+}
+
+int rbpf_engine_run_batch(rbpf_application_t *rbpf, uint8_t *ctxs, size_t stride, size_t count,
+                          int64_t *results)
+{
+    uint64_t regmap[11];
+    int res;
+
+    /* A tail call turns an execution context into the next application, the
+     * next runs of the batch would start from that one */
+    if ((rbpf->flags & RBPF_FLAG_INSTANCE) && rbpf->progs) {
+        return RBPF_ILLEGAL_CALL;
+    }
+    res = _rbpf_engine_ready(rbpf);
+    if (res < 0) {
+        return res;
+    }
+    /* Only the start of the context region moves from one run to the next,
+     * its length and permissions were set by the caller */
+    for (size_t k = 0; k < count; k++, ctxs += stride) {
+        rbpf->arg_region.start = ctxs;
+        rbpf->tail_calls = RBPF_TAIL_CALLS_MAX;
+        _rbpf_regmap_init(rbpf, regmap, ctxs);
+        res = _rbpf_engine_chain(rbpf, _rbpf_engine_exec(rbpf, 0, regmap, &results[k]), ctxs,
+                                 &results[k]);
+        if (res < 0) {
+            return res;
+        }
+    }
+    return RBPF_OK;
+}
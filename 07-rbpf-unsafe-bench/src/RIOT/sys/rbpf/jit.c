@@ -0,0 +1,1295 @@
+/*
+ * Copyright (C) 2023 Inria
+ * Copyright (C) 2023 Koen Zandberg <koen@bergzand.net>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Thumb-2 (ARMv7-M) compiler for the pre-decoded rBPF instructions.
+ *
+ * The virtual machine registers stay in the regmap array of the engine, every
+ * instruction loads its operands in r0-r3, computes and stores the result
+ * back. Memory accesses go through the same permission checks as the
+ * interpreter and the fuel lives in r6. The generated code is
+ * position independent, it only embeds the absolute address of the functions
+ * it calls. Local calls keep their return address and the registers r6-r9 of
+ * the caller on the native stack, r8 holds its level at entry.
+ *
+ * Layout of the generated code:
+ *
+ *      epilogue    mov sp, r8; pop {r4-r8, pc}
+ *      stubs       mov r0, #RBPF_<error>; b epilogue, one per error code
+ *      entry       push {r4-r8, lr}, r4 = rbpf, r5 = regmap, r6 = fuel, r8 = sp
+ *      functions   cmp r3, #pc; b.w body, one per function not starting at 0
+ *      body        one sequence per pre-decoded instruction
+ *
+ * The epilogue and the stubs come first so that every exit is a backward
+ * branch with a known offset. Jumps between instructions always end their
+ * sequence with a 32 bit B.W which is patched once the whole body is emitted,
+ * so do local calls. A jump table is a TBH over one such B.W per entry. Word
+ * atomics are exclusive load and store loops, the Cortex-M cores run a single
+ * thread in order and need no barrier around them.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "rbpf.h"
+#include "rbpf/builtin_calls.h"
+#include "rbpf/instruction.h"
+#include "rbpf/config.h"
+#include "handlers.h"
+
+#if (RBPF_ENABLE_JIT) && defined(__thumb2__)
+
+/* ARM registers */
+#define R0      0
+#define R1      1
+#define R2      2
+#define R3      3
+#define R4      4   /* rbpf application */
+#define R5      5   /* regmap */
+#define R6      6   /* fuel */
+#define R7      7   /* memory access address */
+#define R8      8   /* native stack pointer at entry */
+#define IP      12
+#define LR      14
+
+/* Condition codes */
+#define COND_EQ 0x0
+#define COND_NE 0x1
+#define COND_HS 0x2
+#define COND_LO 0x3
+#define COND_CC COND_LO
+#define COND_HI 0x8
+#define COND_LS 0x9
+#define COND_GE 0xa
+#define COND_LT 0xb
+
+/* Data processing (shifted register) opcodes */
+#define DP_AND  0x0
+#define DP_ORR  0x2
+#define DP_ORN  0x3
+#define DP_EOR  0x4
+#define DP_ADD  0x8
+#define DP_ADC  0xa
+#define DP_SBC  0xb
+#define DP_SUB  0xd
+
+/* Shift types */
+#define SHIFT_LSL   0x0
+#define SHIFT_LSR   0x1
+#define SHIFT_ASR   0x2
+
+/* Error stubs, in the order they are emitted */
+enum {
+    STUB_ILLEGAL_INSTRUCTION,
+    STUB_ILLEGAL_MEM,
+    STUB_OUT_OF_BRANCHES,
+    STUB_ILLEGAL_DIV,
+    STUB_ILLEGAL_CALL,
+    STUB_COUNT,
+};
+
+static const int8_t _stub_codes[STUB_COUNT] = {
+    [STUB_ILLEGAL_INSTRUCTION] = RBPF_ILLEGAL_INSTRUCTION,
+    [STUB_ILLEGAL_MEM] = RBPF_ILLEGAL_MEM,
+    [STUB_OUT_OF_BRANCHES] = RBPF_OUT_OF_BRANCHES,
+    [STUB_ILLEGAL_DIV] = RBPF_ILLEGAL_DIV,
+    [STUB_ILLEGAL_CALL] = RBPF_ILLEGAL_CALL,
+};
+
+/* Native stack used by a local call: the return address, padded to keep the
+ * stack 8 byte aligned, and r6-r9 */
+#define CALL_FRAME_LEN  (8 + 4 * 8)
+
+typedef struct {
+    uint16_t *code;             /**< Start of the code buffer */
+    size_t len;                 /**< Halfwords available for code */
+    size_t pos;                 /**< Current position in halfwords */
+    size_t stubs[STUB_COUNT];   /**< Position of the error stubs */
+    uint16_t *offsets;          /**< Position of every instruction, stored after the code */
+    bool check_budget;          /**< Whether the fuel is charged */
+    bool calls;                 /**< Whether the application makes local calls */
+    const rbpf_insn_t *insns;   /**< Pre-decoded instructions being compiled */
+    size_t pc;                  /**< Index of the instruction being compiled */
+} _jit_t;
+
+/* 64 bit operations left to the C compiler, identical to the interpreter ones */
+static uint64_t _jit_lsh(uint64_t a, uint64_t b)
+{
+    return a << b;
+}
+
+static uint64_t _jit_rsh(uint64_t a, uint64_t b)
+{
+    return a >> b;
+}
+
+static uint64_t _jit_arsh(uint64_t a, uint64_t b)
+{
+    return (int64_t)a >> b;
+}
+
+static uint64_t _jit_div(uint64_t a, uint64_t b)
+{
+    return a / b;
+}
+
+static uint64_t _jit_mod(uint64_t a, uint64_t b)
+{
+    return a % b;
+}
+
+static void _emit16(_jit_t *jit, uint16_t hw)
+{
+    if (jit->pos < jit->len) {
+        jit->code[jit->pos] = hw;
+    }
+    jit->pos++;
+}
+
+static void _emit32(_jit_t *jit, uint16_t hw1, uint16_t hw2)
+{
+    _emit16(jit, hw1);
+    _emit16(jit, hw2);
+}
+
+/* B.W (T4) from the halfword at pos to target, both in halfwords */
+static void _patch_b(_jit_t *jit, size_t pos, size_t target)
+{
+    int32_t offset = ((int32_t)target - (int32_t)(pos + 2)) * 2;
+    uint32_t s = (offset >> 24) & 1;
+    uint32_t j1 = (~((offset >> 23) ^ s)) & 1;
+    uint32_t j2 = (~((offset >> 22) ^ s)) & 1;
+
+    if (pos + 1 >= jit->len) {
+        return;
+    }
+    jit->code[pos] = 0xf000 | (s << 10) | ((offset >> 12) & 0x3ff);
+    jit->code[pos + 1] = 0x9000 | (j1 << 13) | (j2 << 11) | ((offset >> 1) & 0x7ff);
+}
+
+/* 16 bit B<cond> (T1) from the halfword at pos to a close target after it */
+static void _patch_bcond16(_jit_t *jit, size_t pos, uint8_t cond, size_t target)
+{
+    if (pos < jit->len) {
+        jit->code[pos] = 0xd000 | (cond << 8) | ((target - (pos + 2)) & 0xff);
+    }
+}
+
+/* 16 bit B (T2) from the halfword at pos to a close target after it */
+static void _patch_b16(_jit_t *jit, size_t pos, size_t target)
+{
+    if (pos < jit->len) {
+        jit->code[pos] = 0xe000 | ((target - (pos + 2)) & 0x7ff);
+    }
+}
+
+static void _emit_b(_jit_t *jit, size_t target)
+{
+    size_t pos = jit->pos;
+
+    _emit32(jit, 0, 0);
+    _patch_b(jit, pos, target);
+}
+
+/* Length of a function dispatch: MOVW, CMP.W, IT EQ and B.W */
+#define FUNCTION_LEN    (7)
+
+/* B<cond>.W (T3) to an already emitted target */
+static void _emit_bcond(_jit_t *jit, uint8_t cond, size_t target)
+{
+    int32_t offset = ((int32_t)target - (int32_t)(jit->pos + 2)) * 2;
+    uint32_t s = (offset >> 20) & 1;
+    uint32_t j1 = (offset >> 18) & 1;
+    uint32_t j2 = (offset >> 19) & 1;
+
+    _emit32(jit, 0xf000 | (s << 10) | (cond << 6) | ((offset >> 12) & 0x3f),
+            0x8000 | (j1 << 13) | (j2 << 11) | ((offset >> 1) & 0x7ff));
+}
+
+static void _emit_movw(_jit_t *jit, uint8_t rd, uint16_t imm)
+{
+    _emit32(jit, 0xf240 | ((imm >> 1) & 0x400) | (imm >> 12),
+            ((imm << 4) & 0x7000) | (rd << 8) | (imm & 0xff));
+}
+
+static void _emit_movt(_jit_t *jit, uint8_t rd, uint16_t imm)
+{
+    _emit32(jit, 0xf2c0 | ((imm >> 1) & 0x400) | (imm >> 12),
+            ((imm << 4) & 0x7000) | (rd << 8) | (imm & 0xff));
+}
+
+static void _emit_imm32(_jit_t *jit, uint8_t rd, uint32_t imm)
+{
+    _emit_movw(jit, rd, imm & 0xffff);
+    if (imm >> 16) {
+        _emit_movt(jit, rd, imm >> 16);
+    }
+}
+
+static void _emit_imm64(_jit_t *jit, uint8_t rlo, uint8_t rhi, uint64_t imm)
+{
+    _emit_imm32(jit, rlo, (uint32_t)imm);
+    _emit_imm32(jit, rhi, (uint32_t)(imm >> 32));
+}
+
+/* Data processing, register operand optionally shifted by an immediate */
+static void _emit_dp(_jit_t *jit, uint8_t op, bool setflags, uint8_t rd, uint8_t rn,
+                     uint8_t rm, uint8_t type, uint8_t amount)
+{
+    _emit32(jit, 0xea00 | (op << 5) | (setflags << 4) | rn,
+            ((amount & 0x1c) << 10) | (rd << 8) | ((amount & 0x3) << 6) | (type << 4) | rm);
+}
+
+static void _emit_op(_jit_t *jit, uint8_t op, bool setflags, uint8_t rd, uint8_t rn, uint8_t rm)
+{
+    _emit_dp(jit, op, setflags, rd, rn, rm, SHIFT_LSL, 0);
+}
+
+static void _emit_mov(_jit_t *jit, uint8_t rd, uint8_t rm)
+{
+    _emit_dp(jit, DP_ORR, false, rd, 0xf, rm, SHIFT_LSL, 0);
+}
+
+/* Shift by an immediate, amount in 1..31 */
+static void _emit_shift_imm(_jit_t *jit, uint8_t type, uint8_t rd, uint8_t rm, uint8_t amount)
+{
+    _emit_dp(jit, DP_ORR, false, rd, 0xf, rm, type, amount);
+}
+
+/* Shift by a register */
+static void _emit_shift_reg(_jit_t *jit, uint8_t type, uint8_t rd, uint8_t rn, uint8_t rm)
+{
+    _emit32(jit, 0xfa00 | (type << 5) | rn, 0xf000 | (rd << 8) | rm);
+}
+
+static void _emit_mla(_jit_t *jit, uint8_t rd, uint8_t rn, uint8_t rm, uint8_t ra)
+{
+    _emit32(jit, 0xfb00 | rn, (ra << 12) | (rd << 8) | rm);
+}
+
+static void _emit_mls(_jit_t *jit, uint8_t rd, uint8_t rn, uint8_t rm, uint8_t ra)
+{
+    _emit32(jit, 0xfb00 | rn, (ra << 12) | (rd << 8) | 0x10 | rm);
+}
+
+static void _emit_umull(_jit_t *jit, uint8_t rdlo, uint8_t rdhi, uint8_t rn, uint8_t rm)
+{
+    _emit32(jit, 0xfba0 | rn, (rdlo << 12) | (rdhi << 8) | rm);
+}
+
+static void _emit_udiv(_jit_t *jit, uint8_t rd, uint8_t rn, uint8_t rm)
+{
+    _emit32(jit, 0xfbb0 | rn, 0xf0f0 | (rd << 8) | rm);
+}
+
+static void _emit_rev(_jit_t *jit, uint8_t rd, uint8_t rm)
+{
+    _emit32(jit, 0xfa90 | rm, 0xf080 | (rd << 8) | rm);
+}
+
+static void _emit_rev16(_jit_t *jit, uint8_t rd, uint8_t rm)
+{
+    _emit32(jit, 0xfa90 | rm, 0xf090 | (rd << 8) | rm);
+}
+
+static void _emit_uxth(_jit_t *jit, uint8_t rd, uint8_t rm)
+{
+    _emit32(jit, 0xfa1f, 0xf080 | (rd << 8) | rm);
+}
+
+/* Exclusive load and store of a word, status is 0 when the store happened */
+static void _emit_ldrex(_jit_t *jit, uint8_t rt, uint8_t rn)
+{
+    _emit32(jit, 0xe850 | rn, (rt << 12) | 0x0f00);
+}
+
+static void _emit_strex(_jit_t *jit, uint8_t status, uint8_t rt, uint8_t rn)
+{
+    _emit32(jit, 0xe840 | rn, (rt << 12) | (status << 8));
+}
+
+/* 16 bit compare of two low registers */
+static void _emit_cmp(_jit_t *jit, uint8_t rn, uint8_t rm)
+{
+    _emit16(jit, 0x4280 | (rm << 3) | rn);
+}
+
+static void _emit_it_eq(_jit_t *jit)
+{
+    _emit16(jit, 0xbf08);
+}
+
+/* Load or store with a 12 bit positive offset, op selects the size */
+#define LDST_STRB   0xf880
+#define LDST_LDRB   0xf890
+#define LDST_STRH   0xf8a0
+#define LDST_LDRH   0xf8b0
+#define LDST_STR    0xf8c0
+#define LDST_LDR    0xf8d0
+
+static void _emit_ldst(_jit_t *jit, uint16_t op, uint8_t rt, uint8_t rn, uint16_t offset)
+{
+    _emit32(jit, op | rn, (rt << 12) | offset);
+}
+
+/* Virtual machine register access, the registers are 8 bytes apart in regmap */
+static void _emit_load64(_jit_t *jit, uint8_t rlo, uint8_t rhi, uint8_t reg)
+{
+    /* LDRD rlo, rhi, [r5, #8 * reg] */
+    _emit32(jit, 0xe9d0 | R5, (rlo << 12) | (rhi << 8) | (reg * 2));
+}
+
+static void _emit_store64(_jit_t *jit, uint8_t rlo, uint8_t rhi, uint8_t reg)
+{
+    /* STRD rlo, rhi, [r5, #8 * reg] */
+    _emit32(jit, 0xe9c0 | R5, (rlo << 12) | (rhi << 8) | (reg * 2));
+}
+
+static void _emit_load32(_jit_t *jit, uint8_t rt, uint8_t reg)
+{
+    _emit_ldst(jit, LDST_LDR, rt, R5, reg * 8);
+}
+
+/* Store a zero extended 32 bit result */
+static void _emit_store32(_jit_t *jit, uint8_t rt, uint8_t reg)
+{
+    _emit_movw(jit, R1, 0);
+    _emit_store64(jit, rt, R1, reg);
+}
+
+/* Store a sign extended 32 bit result */
+static void _emit_store32s(_jit_t *jit, uint8_t rt, uint8_t reg)
+{
+    _emit_shift_imm(jit, SHIFT_ASR, R1, rt, 31);
+    _emit_store64(jit, rt, R1, reg);
+}
+
+static void _emit_call(_jit_t *jit, const void *func)
+{
+    _emit_imm32(jit, IP, (uint32_t)(uintptr_t)func);
+    /* BLX ip */
+    _emit16(jit, 0x4780 | (IP << 3));
+}
+
+static void _emit_exit(_jit_t *jit, unsigned stub)
+{
+    _emit_b(jit, jit->stubs[stub]);
+}
+
+/* Fuel charged by a jump taken to the instruction at target, the
+ * instructions up to it when it goes back, like the interpreter */
+static uint32_t _target_cost(const _jit_t *jit, size_t target)
+{
+    if (!jit->check_budget || target > jit->pc) {
+        return 0;
+    }
+    return jit->pc - target + 1;
+}
+
+static uint32_t _jump_cost(const _jit_t *jit, const rbpf_insn_t *insn)
+{
+    return _target_cost(jit, insn->target - jit->insns);
+}
+
+/* Halfwords emitted by _emit_budget() */
+static unsigned _budget_len(uint32_t cost)
+{
+    if (cost == 0) {
+        return 0;
+    }
+    return cost < 256 ? 3 : 6;
+}
+
+/* Charge a taken jump on the fuel, exits when not enough is left */
+static void _emit_budget(_jit_t *jit, uint32_t cost)
+{
+    if (cost == 0) {
+        return;
+    }
+    if (cost < 256) {
+        /* SUBS r6, #cost */
+        _emit16(jit, 0x3800 | (R6 << 8) | cost);
+    }
+    else {
+        /* SUBS.W r6, r6, ip */
+        _emit_movw(jit, IP, cost);
+        _emit32(jit, 0xebb0 | R6, (R6 << 8) | IP);
+    }
+    /* The subtraction borrowed, not enough fuel */
+    _emit_bcond(jit, COND_CC, jit->stubs[STUB_OUT_OF_BRANCHES]);
+}
+
+/* Second operand in r2 (and r3 for 64 bit), from a register or the immediate */
+static void _emit_operand64(_jit_t *jit, const rbpf_insn_t *insn, bool imm)
+{
+    if (imm) {
+        _emit_imm64(jit, R2, R3, insn->immediate);
+    }
+    else {
+        _emit_load64(jit, R2, R3, insn->src);
+    }
+}
+
+static void _emit_operand32(_jit_t *jit, const rbpf_insn_t *insn, bool imm)
+{
+    if (imm) {
+        _emit_imm32(jit, R2, (uint32_t)insn->immediate);
+    }
+    else {
+        _emit_load32(jit, R2, insn->src);
+    }
+}
+
+/* Division by zero check on the full 64 bit operand, as the interpreter does */
+static void _emit_div_check(_jit_t *jit, const rbpf_insn_t *insn, bool imm)
+{
+    if (imm) {
+        if (insn->immediate == 0) {
+            _emit_exit(jit, STUB_ILLEGAL_DIV);
+        }
+        return;
+    }
+    _emit_op(jit, DP_ORR, true, IP, R2, R3);
+    _emit_bcond(jit, COND_EQ, jit->stubs[STUB_ILLEGAL_DIV]);
+}
+
+/* 64 bit shift of r0:r1 by a constant amount in 0..63 */
+static void _emit_shift64_imm(_jit_t *jit, uint8_t type, unsigned amount)
+{
+    if (amount == 0) {
+        return;
+    }
+    if (type == SHIFT_LSL) {
+        if (amount < 32) {
+            _emit_shift_imm(jit, SHIFT_LSL, R1, R1, amount);
+            _emit_dp(jit, DP_ORR, false, R1, R1, R0, SHIFT_LSR, 32 - amount);
+            _emit_shift_imm(jit, SHIFT_LSL, R0, R0, amount);
+        }
+        else {
+            if (amount > 32) {
+                _emit_shift_imm(jit, SHIFT_LSL, R1, R0, amount - 32);
+            }
+            else {
+                _emit_mov(jit, R1, R0);
+            }
+            _emit_movw(jit, R0, 0);
+        }
+        return;
+    }
+    /* Logical and arithmetic right shifts */
+    if (amount < 32) {
+        _emit_shift_imm(jit, SHIFT_LSR, R0, R0, amount);
+        _emit_dp(jit, DP_ORR, false, R0, R0, R1, SHIFT_LSL, 32 - amount);
+        _emit_shift_imm(jit, type, R1, R1, amount);
+    }
+    else {
+        if (amount > 32) {
+            _emit_shift_imm(jit, type, R0, R1, amount - 32);
+        }
+        else {
+            _emit_mov(jit, R0, R1);
+        }
+        if (type == SHIFT_ASR) {
+            _emit_shift_imm(jit, SHIFT_ASR, R1, R1, 31);
+        }
+        else {
+            _emit_movw(jit, R1, 0);
+        }
+    }
+}
+
+static void _emit_alu64(_jit_t *jit, const rbpf_insn_t *insn, uint8_t op, bool imm)
+{
+    _emit_load64(jit, R0, R1, insn->dst);
+    _emit_operand64(jit, insn, imm);
+    _emit_op(jit, op, op == DP_ADD || op == DP_SUB, R0, R0, R2);
+    _emit_op(jit, op == DP_ADD ? DP_ADC : op == DP_SUB ? DP_SBC : op, false, R1, R1, R3);
+    _emit_store64(jit, R0, R1, insn->dst);
+}
+
+static void _emit_mul64(_jit_t *jit, const rbpf_insn_t *insn, bool imm)
+{
+    _emit_load64(jit, R0, R1, insn->dst);
+    _emit_operand64(jit, insn, imm);
+    _emit_umull(jit, IP, LR, R0, R2);
+    _emit_mla(jit, LR, R0, R3, LR);
+    _emit_mla(jit, LR, R1, R2, LR);
+    _emit_store64(jit, IP, LR, insn->dst);
+}
+
+/* Operations implemented by a C function taking r0:r1 and r2:r3 */
+static void _emit_alu64_call(_jit_t *jit, const rbpf_insn_t *insn, bool imm,
+                             uint64_t (*func)(uint64_t, uint64_t))
+{
+    _emit_load64(jit, R0, R1, insn->dst);
+    _emit_operand64(jit, insn, imm);
+    _emit_call(jit, (const void *)func);
+    _emit_store64(jit, R0, R1, insn->dst);
+}
+
+/* 64 bit division and modulo with the hardware divide when the upper halves
+ * of both operands are zero, the C function otherwise */
+static void _emit_divmod64(_jit_t *jit, const rbpf_insn_t *insn, bool imm, bool mod)
+{
+    _emit_load64(jit, R0, R1, insn->dst);
+    _emit_operand64(jit, insn, imm);
+    _emit_div_check(jit, insn, imm);
+    /* ORRS of the upper halves, BNE to the call */
+    _emit_op(jit, DP_ORR, true, IP, R1, R3);
+    size_t wide = jit->pos;
+    _emit16(jit, 0);
+    if (mod) {
+        _emit_udiv(jit, IP, R0, R2);
+        _emit_mls(jit, R0, IP, R2, R0);
+    }
+    else {
+        _emit_udiv(jit, R0, R0, R2);
+    }
+    /* MOVS r1, #0 */
+    _emit16(jit, 0x2000 | (R1 << 8));
+    /* B over the call */
+    size_t done = jit->pos;
+    _emit16(jit, 0);
+    _patch_bcond16(jit, wide, COND_NE, jit->pos);
+    _emit_call(jit, mod ? (const void *)_jit_mod : (const void *)_jit_div);
+    _patch_b16(jit, done, jit->pos);
+    _emit_store64(jit, R0, R1, insn->dst);
+}
+
+static void _emit_shift64(_jit_t *jit, const rbpf_insn_t *insn, bool imm, uint8_t type,
+                          uint64_t (*func)(uint64_t, uint64_t))
+{
+    if (imm && insn->immediate >= 0 && insn->immediate < 64) {
+        _emit_load64(jit, R0, R1, insn->dst);
+        _emit_shift64_imm(jit, type, insn->immediate);
+        _emit_store64(jit, R0, R1, insn->dst);
+    }
+    else {
+        _emit_alu64_call(jit, insn, imm, func);
+    }
+}
+
+static void _emit_alu32(_jit_t *jit, const rbpf_insn_t *insn, uint8_t op, bool imm)
+{
+    _emit_load32(jit, R0, insn->dst);
+    _emit_operand32(jit, insn, imm);
+    _emit_op(jit, op, false, R0, R0, R2);
+    _emit_store32(jit, R0, insn->dst);
+}
+
+/* 32 bit shifts, the interpreter sign extends the arithmetic shift result */
+static void _emit_shift32(_jit_t *jit, const rbpf_insn_t *insn, bool imm, uint8_t type)
+{
+    _emit_load32(jit, R0, insn->dst);
+    if (imm && insn->immediate >= 0 && insn->immediate < 32) {
+        if (insn->immediate) {
+            _emit_shift_imm(jit, type, R0, R0, insn->immediate);
+        }
+    }
+    else {
+        _emit_operand32(jit, insn, imm);
+        _emit_shift_reg(jit, type, R0, R0, R2);
+    }
+    if (type == SHIFT_ASR) {
+        _emit_store32s(jit, R0, insn->dst);
+    }
+    else {
+        _emit_store32(jit, R0, insn->dst);
+    }
+}
+
+static void _emit_divmod32(_jit_t *jit, const rbpf_insn_t *insn, bool imm, bool mod)
+{
+    _emit_load32(jit, R0, insn->dst);
+    if (imm) {
+        _emit_div_check(jit, insn, imm);
+        _emit_operand32(jit, insn, imm);
+    }
+    else {
+        _emit_load64(jit, R2, R3, insn->src);
+        _emit_div_check(jit, insn, imm);
+    }
+    if (mod) {
+        _emit_udiv(jit, IP, R0, R2);
+        _emit_mls(jit, R0, IP, R2, R0);
+    }
+    else {
+        _emit_udiv(jit, R0, R0, R2);
+    }
+    _emit_store32(jit, R0, insn->dst);
+}
+
+/* Exits when the access at the address in r7 isn't allowed */
+static void _emit_mem_allowed(_jit_t *jit, size_t size, bool store)
+{
+    _emit_mov(jit, R0, R4);
+    _emit_mov(jit, R1, R7);
+    _emit_movw(jit, R2, size);
+    _emit_call(jit, store ? (const void *)rbpf_store_allowed : (const void *)rbpf_load_allowed);
+    /* CMP r0, #0 */
+    _emit16(jit, 0x2800 | (R0 << 8));
+    _emit_bcond(jit, COND_EQ, jit->stubs[STUB_ILLEGAL_MEM]);
+}
+
+/* Address of the access in r7, checked against the memory regions unless
+ * the verifier proved it in bounds */
+static void _emit_mem_check(_jit_t *jit, const rbpf_insn_t *insn, uint8_t base, size_t size,
+                            bool store, bool check)
+{
+    _emit_load32(jit, R7, base);
+    if (insn->offset) {
+        _emit_imm32(jit, R2, (uint32_t)insn->offset);
+        _emit_op(jit, DP_ADD, false, R7, R7, R2);
+    }
+    if (check) {
+        _emit_mem_allowed(jit, size, store);
+    }
+}
+
+static const uint16_t _load_ops[] = { LDST_LDRB, LDST_LDRH, LDST_LDR };
+static const uint16_t _store_ops[] = { LDST_STRB, LDST_STRH, LDST_STR };
+
+/* size_log2: 0 for bytes up to 3 for double words */
+static void _emit_ldx(_jit_t *jit, const rbpf_insn_t *insn, unsigned size_log2, bool check)
+{
+    _emit_mem_check(jit, insn, insn->src, 1 << size_log2, false, check);
+    if (size_log2 == 3) {
+        /* Two word loads, double word loads would fault on unaligned addresses */
+        _emit_ldst(jit, LDST_LDR, R0, R7, 0);
+        _emit_ldst(jit, LDST_LDR, R1, R7, 4);
+        _emit_store64(jit, R0, R1, insn->dst);
+    }
+    else {
+        _emit_ldst(jit, _load_ops[size_log2], R0, R7, 0);
+        _emit_store32(jit, R0, insn->dst);
+    }
+}
+
+static void _emit_st(_jit_t *jit, const rbpf_insn_t *insn, unsigned size_log2, bool imm,
+                     bool check)
+{
+    _emit_mem_check(jit, insn, insn->dst, 1 << size_log2, true, check);
+    if (imm && size_log2 == 3) {
+        _emit_imm64(jit, R0, R1, insn->immediate);
+    }
+    else if (imm) {
+        _emit_imm32(jit, R0, (uint32_t)insn->immediate);
+    }
+    else if (size_log2 == 3) {
+        _emit_load64(jit, R0, R1, insn->src);
+    }
+    else {
+        _emit_load32(jit, R0, insn->src);
+    }
+    if (size_log2 == 3) {
+        _emit_ldst(jit, LDST_STR, R0, R7, 0);
+        _emit_ldst(jit, LDST_STR, R1, R7, 4);
+    }
+    else {
+        _emit_ldst(jit, _store_ops[size_log2], R0, R7, 0);
+    }
+}
+
+/* Word atomics, the operation is in the immediate. The address must be
+ * aligned and allowed for both a load and a store */
+static void _emit_atomic32(_jit_t *jit, const rbpf_insn_t *insn)
+{
+    bool cmpxchg = insn->immediate == BPF_INSTRUCTION_ATOMIC_CMPXCHG;
+    uint8_t value = R1;
+    uint8_t status = R3;
+
+    _emit_mem_check(jit, insn, insn->dst, 4, true, true);
+    _emit_mem_allowed(jit, 4, false);
+    /* TST r7, #3 */
+    _emit32(jit, 0xf010 | R7, 0x0f03);
+    _emit_bcond(jit, COND_NE, jit->stubs[STUB_ILLEGAL_MEM]);
+
+    _emit_load32(jit, R2, insn->src);
+    if (cmpxchg) {
+        _emit_load32(jit, R3, 0);
+        status = R1;
+    }
+    size_t retry = jit->pos;
+    _emit_ldrex(jit, R0, R7);
+    switch (insn->immediate & ~BPF_INSTRUCTION_ATOMIC_FETCH) {
+    case BPF_INSTRUCTION_ATOMIC_ADD:
+        _emit_op(jit, DP_ADD, false, R1, R0, R2);
+        break;
+    case BPF_INSTRUCTION_ATOMIC_OR:
+        _emit_op(jit, DP_ORR, false, R1, R0, R2);
+        break;
+    case BPF_INSTRUCTION_ATOMIC_AND:
+        _emit_op(jit, DP_AND, false, R1, R0, R2);
+        break;
+    case BPF_INSTRUCTION_ATOMIC_XOR:
+        _emit_op(jit, DP_EOR, false, R1, R0, R2);
+        break;
+    default:
+        /* XCHG and CMPXCHG store the source register, CMPXCHG only when the
+         * memory holds r0: BNE over the store and the retry */
+        value = R2;
+        if (cmpxchg) {
+            _emit_cmp(jit, R0, R3);
+            _emit16(jit, 0xd100 | 3);
+        }
+        break;
+    }
+    _emit_strex(jit, status, value, R7);
+    /* CMP status, #0; BNE retry */
+    _emit16(jit, 0x2800 | (status << 8));
+    _emit16(jit, 0xd100 | (((int32_t)retry - (int32_t)(jit->pos + 2)) & 0xff));
+
+    if (cmpxchg) {
+        /* CLREX, the compare may have failed with the monitor still open */
+        _emit32(jit, 0xf3bf, 0x8f2f);
+        _emit_store32(jit, R0, 0);
+    }
+    else if (insn->immediate & BPF_INSTRUCTION_ATOMIC_FETCH) {
+        _emit_store32(jit, R0, insn->src);
+    }
+}
+
+/*
+ * Conditional jumps: set the flags, skip the jump when the condition doesn't
+ * hold, charge the fuel and jump. The final B.W is patched afterwards.
+ */
+static void _emit_cond_jmp(_jit_t *jit, const rbpf_insn_t *insn, bool imm, uint8_t cond,
+                           bool is_signed, bool swap)
+{
+    _emit_load64(jit, R0, R1, insn->dst);
+    _emit_operand64(jit, insn, imm);
+    if (is_signed) {
+        /* SUBS/SBCS of the high words leave valid N and V flags */
+        uint8_t a = swap ? R2 : R0;
+        uint8_t b = swap ? R0 : R2;
+        _emit_op(jit, DP_SUB, true, IP, a, b);
+        _emit_op(jit, DP_SBC, true, IP, a + 1, b + 1);
+    }
+    else if (cond == COND_NE && swap) {
+        /* JSET, swap is used to flag it */
+        _emit_op(jit, DP_AND, false, IP, R0, R2);
+        _emit_op(jit, DP_AND, false, LR, R1, R3);
+        _emit_op(jit, DP_ORR, true, IP, IP, LR);
+    }
+    else {
+        /* Unsigned comparison: high words first, low words when equal */
+        _emit_cmp(jit, R1, R3);
+        _emit_it_eq(jit);
+        _emit_cmp(jit, R0, R2);
+    }
+    /* B<!cond> over the fuel charge and the jump */
+    uint32_t cost = _jump_cost(jit, insn);
+    _emit16(jit, 0xd000 | ((cond ^ 1) << 8) | (_budget_len(cost) + 1));
+    _emit_budget(jit, cost);
+    _emit32(jit, 0, 0);
+}
+
+/*
+ * Jump tables: the index is clamped to the default entry and a TBH branches
+ * to the stub of its entry, right after the TBH offsets. Every stub charges
+ * the fuel of its entry and ends with a B.W, patched afterwards, the last stub
+ * ends the sequence.
+ */
+static void _emit_jmp_table(_jit_t *jit, const rbpf_insn_t *insn)
+{
+    size_t len = insn->immediate;
+
+    _emit_load64(jit, R0, R1, insn->dst);
+    _emit_imm32(jit, R2, len);
+    /* CMP r1, #0; IT NE; MOV r0, r2, the upper half takes the default */
+    _emit16(jit, 0x2900);
+    _emit16(jit, 0xbf18);
+    _emit_mov(jit, R0, R2);
+    /* CMP r0, r2; IT HI; MOV r0, r2 */
+    _emit_cmp(jit, R0, R2);
+    _emit16(jit, 0xbf88);
+    _emit_mov(jit, R0, R2);
+    /* TBH [pc, r0, LSL #1], the offsets count halfwords from their start */
+    _emit32(jit, 0xe8df, 0xf010 | R0);
+
+    size_t offsets = jit->pos;
+    jit->pos += len + 1;
+    for (size_t entry = 0; entry <= len; entry++) {
+        if (offsets + entry < jit->len) {
+            jit->code[offsets + entry] = jit->pos - offsets;
+        }
+        _emit_budget(jit, _target_cost(jit, insn->table[entry]));
+        _emit32(jit, 0, 0);
+    }
+}
+
+/* Push the return address and the registers r6-r9 of the caller, move r10 to
+ * the frame of the function and branch to it with the final B.W */
+static void _emit_local_call(_jit_t *jit)
+{
+    /* MOV ip, sp; the calls in progress use r8 - sp bytes */
+    _emit16(jit, 0x46ec);
+    _emit_op(jit, DP_SUB, false, IP, R8, IP);
+    _emit_movw(jit, R0, (RBPF_CALL_DEPTH_MAX - 1) * CALL_FRAME_LEN);
+    _emit_dp(jit, DP_SUB, true, 0xf, IP, R0, SHIFT_LSL, 0);
+    _emit_bcond(jit, COND_HS, jit->stubs[STUB_ILLEGAL_CALL]);
+
+    /* BL over the B, the function returns to the B to the next instruction */
+    _emit32(jit, 0xf000, 0xf801);
+    size_t skip = jit->pos;
+    _emit16(jit, 0);
+
+    /* PUSH {r0, lr} */
+    _emit16(jit, 0xb501);
+    for (uint8_t reg = 6; reg < 10; reg += 2) {
+        _emit_load64(jit, R0, R1, reg);
+        _emit_load64(jit, R2, R3, reg + 1);
+        /* PUSH {r0-r3} */
+        _emit16(jit, 0xb40f);
+    }
+    _emit_load32(jit, R0, 10);
+    _emit_movw(jit, IP, RBPF_CALL_FRAME_SIZE);
+    _emit_op(jit, DP_SUB, false, R0, R0, IP);
+    _emit_store32(jit, R0, 10);
+    _emit32(jit, 0, 0);
+
+    if (skip < jit->len) {
+        jit->code[skip] = 0xe000 | ((jit->pos - (skip + 2)) & 0x7ff);
+    }
+}
+
+/* Return to the caller when a local call is in progress, exit otherwise */
+static void _emit_return(_jit_t *jit)
+{
+    if (jit->calls) {
+        /* CMP sp, r8; BNE over the exit */
+        _emit16(jit, 0x45c5);
+        _emit16(jit, 0xd100 | 3);
+    }
+    _emit_movw(jit, R0, RBPF_OK);
+    _emit_b(jit, 0);
+    if (!jit->calls) {
+        return;
+    }
+
+    for (uint8_t reg = 8; reg >= 6; reg -= 2) {
+        /* POP {r0-r3} */
+        _emit16(jit, 0xbc0f);
+        _emit_store64(jit, R0, R1, reg);
+        _emit_store64(jit, R2, R3, reg + 1);
+    }
+    _emit_load32(jit, R0, 10);
+    _emit_movw(jit, IP, RBPF_CALL_FRAME_SIZE);
+    _emit_op(jit, DP_ADD, false, R0, R0, IP);
+    _emit_store32(jit, R0, 10);
+    /* POP {r0, pc} */
+    _emit16(jit, 0xbd01);
+}
+
+#define ALU_CASES(OPCODE, DP) \
+    case RBPF_HANDLER_ALU64_ ## OPCODE ## _REG: \
+        _emit_alu64(jit, insn, DP, false); \
+        break; \
+    case RBPF_HANDLER_ALU64_ ## OPCODE ## _IMM: \
+        _emit_alu64(jit, insn, DP, true); \
+        break; \
+    ALU32_CASES(OPCODE, DP)
+
+#if (RBPF_ENABLE_ALU32)
+#define ALU32_CASES(OPCODE, DP) \
+    case RBPF_HANDLER_ALU32_ ## OPCODE ## _REG: \
+        _emit_alu32(jit, insn, DP, false); \
+        break; \
+    case RBPF_HANDLER_ALU32_ ## OPCODE ## _IMM: \
+        _emit_alu32(jit, insn, DP, true); \
+        break;
+#else
+#define ALU32_CASES(OPCODE, DP)
+#endif
+
+/* Context accesses keep their check, the native code doesn't know the size of
+ * the context it runs with */
+#define MEM_CASES(SIZEOP, SIZE_LOG2) \
+    case RBPF_HANDLER_MEM_LDX ## SIZEOP: \
+    case RBPF_HANDLER_MEM_LDX ## SIZEOP ## _CTX: \
+        _emit_ldx(jit, insn, SIZE_LOG2, true); \
+        break; \
+    case RBPF_HANDLER_MEM_LDX ## SIZEOP ## _SAFE: \
+        _emit_ldx(jit, insn, SIZE_LOG2, false); \
+        break; \
+    case RBPF_HANDLER_MEM_STX ## SIZEOP: \
+    case RBPF_HANDLER_MEM_STX ## SIZEOP ## _CTX: \
+        _emit_st(jit, insn, SIZE_LOG2, false, true); \
+        break; \
+    case RBPF_HANDLER_MEM_STX ## SIZEOP ## _SAFE: \
+        _emit_st(jit, insn, SIZE_LOG2, false, false); \
+        break; \
+    case RBPF_HANDLER_MEM_ST ## SIZEOP: \
+    case RBPF_HANDLER_MEM_ST ## SIZEOP ## _CTX: \
+        _emit_st(jit, insn, SIZE_LOG2, true, true); \
+        break; \
+    case RBPF_HANDLER_MEM_ST ## SIZEOP ## _SAFE: \
+        _emit_st(jit, insn, SIZE_LOG2, true, false); \
+        break;
+
+#define JMP_CASES(OPCODE, COND, SIGNED, SWAP) \
+    case RBPF_HANDLER_JMP_ ## OPCODE ## _REG: \
+        _emit_cond_jmp(jit, insn, false, COND, SIGNED, SWAP); \
+        break; \
+    case RBPF_HANDLER_JMP_ ## OPCODE ## _IMM: \
+        _emit_cond_jmp(jit, insn, true, COND, SIGNED, SWAP); \
+        break;
+
+static void _emit_insn(_jit_t *jit, const rbpf_insn_t *insn)
+{
+    switch (insn->handler) {
+    ALU_CASES(ADD, DP_ADD)
+    ALU_CASES(SUB, DP_SUB)
+    ALU_CASES(AND, DP_AND)
+    ALU_CASES(OR, DP_ORR)
+    ALU_CASES(XOR, DP_EOR)
+
+    case RBPF_HANDLER_ALU64_MUL_REG:
+        _emit_mul64(jit, insn, false);
+        break;
+    case RBPF_HANDLER_ALU64_MUL_IMM:
+        _emit_mul64(jit, insn, true);
+        break;
+    case RBPF_HANDLER_ALU64_LSH_REG:
+        _emit_shift64(jit, insn, false, SHIFT_LSL, _jit_lsh);
+        break;
+    case RBPF_HANDLER_ALU64_LSH_IMM:
+        _emit_shift64(jit, insn, true, SHIFT_LSL, _jit_lsh);
+        break;
+    case RBPF_HANDLER_ALU64_RSH_REG:
+        _emit_shift64(jit, insn, false, SHIFT_LSR, _jit_rsh);
+        break;
+    case RBPF_HANDLER_ALU64_RSH_IMM:
+        _emit_shift64(jit, insn, true, SHIFT_LSR, _jit_rsh);
+        break;
+    case RBPF_HANDLER_ALU64_ARSH_REG:
+        _emit_shift64(jit, insn, false, SHIFT_ASR, _jit_arsh);
+        break;
+    case RBPF_HANDLER_ALU64_ARSH_IMM:
+        _emit_shift64(jit, insn, true, SHIFT_ASR, _jit_arsh);
+        break;
+    case RBPF_HANDLER_ALU64_DIV_REG:
+        _emit_divmod64(jit, insn, false, false);
+        break;
+    case RBPF_HANDLER_ALU64_DIV_IMM:
+        _emit_divmod64(jit, insn, true, false);
+        break;
+    case RBPF_HANDLER_ALU64_MOD_REG:
+        _emit_divmod64(jit, insn, false, true);
+        break;
+    case RBPF_HANDLER_ALU64_MOD_IMM:
+        _emit_divmod64(jit, insn, true, true);
+        break;
+    case RBPF_HANDLER_ALU64_MOV_REG:
+        _emit_load64(jit, R0, R1, insn->src);
+        _emit_store64(jit, R0, R1, insn->dst);
+        break;
+    case RBPF_HANDLER_ALU64_MOV_IMM:
+        _emit_imm64(jit, R0, R1, insn->immediate);
+        _emit_store64(jit, R0, R1, insn->dst);
+        break;
+    case RBPF_HANDLER_MEM_LDDW:
+        _emit_imm64(jit, R0, R1, insn->immediate);
+        _emit_store64(jit, R0, R1, insn->dst);
+        /* B over the illegal second half, only reachable by a jump */
+        _emit16(jit, 0xe001);
+        break;
+    case RBPF_HANDLER_ALU64_NEG_IMM:
+        _emit_load64(jit, R0, R1, insn->dst);
+        _emit_movw(jit, R2, 0);
+        _emit_op(jit, DP_SUB, true, R0, R2, R0);
+        _emit_op(jit, DP_SBC, false, R1, R2, R1);
+        _emit_store64(jit, R0, R1, insn->dst);
+        break;
+
+
+    /* Byte swaps, the target is little endian */
+    case RBPF_HANDLER_ALU_LE16:
+        _emit_load32(jit, R0, insn->dst);
+        _emit_uxth(jit, R0, R0);
+        _emit_store32(jit, R0, insn->dst);
+        break;
+    case RBPF_HANDLER_ALU_LE32:
+        _emit_load32(jit, R0, insn->dst);
+        _emit_store32(jit, R0, insn->dst);
+        break;
+    case RBPF_HANDLER_ALU_LE64:
+        break;
+    case RBPF_HANDLER_ALU_BE16:
+        _emit_load32(jit, R0, insn->dst);
+        _emit_rev16(jit, R0, R0);
+        _emit_uxth(jit, R0, R0);
+        _emit_store32(jit, R0, insn->dst);
+        break;
+    case RBPF_HANDLER_ALU_BE32:
+        _emit_load32(jit, R0, insn->dst);
+        _emit_rev(jit, R0, R0);
+        _emit_store32(jit, R0, insn->dst);
+        break;
+    case RBPF_HANDLER_ALU_BE64:
+        _emit_load64(jit, R0, R1, insn->dst);
+        _emit_rev(jit, R2, R1);
+        _emit_rev(jit, R3, R0);
+        _emit_store64(jit, R2, R3, insn->dst);
+        break;
+
+#if (RBPF_ENABLE_ALU32)
+    case RBPF_HANDLER_ALU32_MUL_REG:
+    case RBPF_HANDLER_ALU32_MUL_IMM:
+        _emit_load32(jit, R0, insn->dst);
+        _emit_operand32(jit, insn, insn->handler == RBPF_HANDLER_ALU32_MUL_IMM);
+        _emit_mla(jit, R0, R0, R2, 0xf);
+        _emit_store32(jit, R0, insn->dst);
+        break;
+    case RBPF_HANDLER_ALU32_LSH_REG:
+        _emit_shift32(jit, insn, false, SHIFT_LSL);
+        break;
+    case RBPF_HANDLER_ALU32_LSH_IMM:
+        _emit_shift32(jit, insn, true, SHIFT_LSL);
+        break;
+    case RBPF_HANDLER_ALU32_RSH_REG:
+        _emit_shift32(jit, insn, false, SHIFT_LSR);
+        break;
+    case RBPF_HANDLER_ALU32_RSH_IMM:
+        _emit_shift32(jit, insn, true, SHIFT_LSR);
+        break;
+    case RBPF_HANDLER_ALU32_ARSH_REG:
+        _emit_shift32(jit, insn, false, SHIFT_ASR);
+        break;
+    case RBPF_HANDLER_ALU32_ARSH_IMM:
+        _emit_shift32(jit, insn, true, SHIFT_ASR);
+        break;
+    case RBPF_HANDLER_ALU32_DIV_REG:
+        _emit_divmod32(jit, insn, false, false);
+        break;
+    case RBPF_HANDLER_ALU32_DIV_IMM:
+        _emit_divmod32(jit, insn, true, false);
+        break;
+    case RBPF_HANDLER_ALU32_MOD_REG:
+        _emit_divmod32(jit, insn, false, true);
+        break;
+    case RBPF_HANDLER_ALU32_MOD_IMM:
+        _emit_divmod32(jit, insn, true, true);
+        break;
+    case RBPF_HANDLER_ALU32_MOV_REG:
+        _emit_load32(jit, R0, insn->src);
+        _emit_store32(jit, R0, insn->dst);
+        break;
+    case RBPF_HANDLER_ALU32_MOV_IMM:
+        _emit_imm32(jit, R0, (uint32_t)insn->immediate);
+        _emit_store32(jit, R0, insn->dst);
+        break;
+    case RBPF_HANDLER_ALU32_NEG_IMM:
+        /* Sign extended, as the interpreter does */
+        _emit_load32(jit, R0, insn->dst);
+        _emit_movw(jit, R2, 0);
+        _emit_op(jit, DP_SUB, false, R0, R2, R0);
+        _emit_store32s(jit, R0, insn->dst);
+        break;
+#endif
+
+    MEM_CASES(B, 0)
+    MEM_CASES(H, 1)
+    MEM_CASES(W, 2)
+    MEM_CASES(DW, 3)
+
+#define ATOMIC_CASE(name, opcode, op) case RBPF_HANDLER_ ## name:
+    ATOMIC_HANDLERS(ATOMIC_CASE, W)
+        _emit_atomic32(jit, insn);
+        break;
+#undef ATOMIC_CASE
+
+    case RBPF_HANDLER_JMP_ALWAYS:
+        _emit_budget(jit, _jump_cost(jit, insn));
+        _emit32(jit, 0, 0);
+        break;
+    case RBPF_HANDLER_JMP_TABLE:
+        _emit_jmp_table(jit, insn);
+        break;
+
+    JMP_CASES(EQ, COND_EQ, false, false)
+    JMP_CASES(NE, COND_NE, false, false)
+    JMP_CASES(SET, COND_NE, false, true)
+    JMP_CASES(GT, COND_HI, false, false)
+    JMP_CASES(GE, COND_HS, false, false)
+    JMP_CASES(LT, COND_LO, false, false)
+    JMP_CASES(LE, COND_LS, false, false)
+    /* a > b and a <= b are evaluated as b < a and b >= a */
+    JMP_CASES(SGT, COND_LT, true, true)
+    JMP_CASES(SGE, COND_GE, true, false)
+    JMP_CASES(SLT, COND_LT, true, false)
+    JMP_CASES(SLE, COND_GE, true, true)
+
+    case RBPF_HANDLER_CALL:
+        _emit_mov(jit, R0, R4);
+        _emit_mov(jit, R1, R5);
+        _emit_call(jit, (const void *)insn->call);
+        _emit_store32(jit, R0, 0);
+        break;
+    case RBPF_HANDLER_CALL_LOCAL:
+        _emit_local_call(jit);
+        break;
+    case RBPF_HANDLER_TAIL_CALL:
+        /* Exits with RBPF_TAIL_CALL when the next application can start */
+        _emit_mov(jit, R0, R4);
+        _emit_mov(jit, R1, R5);
+        _emit_call(jit, (const void *)rbpf_vm_tail_call);
+        /* CMP r0, #0 */
+        _emit16(jit, 0x2800);
+        _emit_bcond(jit, COND_NE, 0);
+        break;
+    case RBPF_HANDLER_RETURN:
+        _emit_return(jit);
+        break;
+    default:
+        _emit_exit(jit, STUB_ILLEGAL_INSTRUCTION);
+        break;
+    }
+}
+
+#if (RBPF_ENABLE_FUSION)
+/* First instruction of the sequences run by the fused handlers, the native
+ * code runs every instruction on its own */
+#define UNFUSED(name, first, len) [RBPF_HANDLER_ ## name] = RBPF_HANDLER_ ## first,
+static const uint8_t _unfused[RBPF_HANDLER_COUNT] = {
+    RBPF_FUSED_HANDLERS(UNFUSED)
+};
+#undef UNFUSED
+#endif
+
+/* Instructions ending with a B.W to their target */
+static bool _is_jump(const rbpf_insn_t *insn)
+{
+    return (insn->handler >= RBPF_HANDLER_JMP_ALWAYS &&
+            insn->handler <= RBPF_HANDLER_JMP_SLE_IMM) ||
+           insn->handler == RBPF_HANDLER_CALL_LOCAL;
+}
+
+int rbpf_jit_compile(rbpf_application_t *rbpf, void *buf, size_t len)
+{
+    int res = rbpf_application_verify_preflight(rbpf);
+
+    rbpf->jit = NULL;
+    if (res < 0) {
+        return res;
+    }
+
+    size_t num_instructions = rbpf->num_insns;
+    size_t table_len = (num_instructions + 1) * sizeof(uint16_t);
+    _jit_t jit = {
+        .code = (uint16_t *)(((uintptr_t)buf + 1) & ~(uintptr_t)1),
+        .check_budget = !(rbpf->flags & (RBPF_CONFIG_NO_RETURN | RBPF_FLAG_TERMINATES)),
+        .calls = rbpf->flags & RBPF_FLAG_CALLS,
+        .insns = rbpf->insns,
+    };
+
+    if (len < table_len + 2) {
+        return RBPF_ILLEGAL_LEN;
+    }
+    size_t space = len - ((uintptr_t)jit.code - (uintptr_t)buf);
+
+    /* The instruction positions are kept at the end of the buffer until the
+     * jumps are patched */
+    jit.len = (space - table_len) / sizeof(uint16_t);
+    jit.offsets = jit.code + jit.len;
+
+    /* MOV sp, r8; POP {r4-r8, pc} */
+    _emit16(&jit, 0x46c5);
+    _emit32(&jit, 0xe8bd, 0x81f0);
+    for (unsigned stub = 0; stub < STUB_COUNT; stub++) {
+        jit.stubs[stub] = jit.pos;
+        _emit_imm32(&jit, R0, (uint32_t)(int32_t)_stub_codes[stub]);
+        _emit_b(&jit, 0);
+    }
+
+    size_t entry = jit.pos;
+    /* PUSH {r4-r8, lr} */
+    _emit32(&jit, 0xe92d, 0x41f0);
+    _emit_mov(&jit, R4, R0);
+    _emit_mov(&jit, R5, R1);
+    _emit_mov(&jit, R6, R2);
+    /* MOV r8, sp */
+    _emit16(&jit, 0x46e8);
+
+    /* The entry instruction is in r3, the functions starting elsewhere than
+     * the first instruction jump to it once the body is emitted */
+    const rbpf_function_t *functions = rbpf_application_functions(rbpf);
+    size_t dispatch = jit.pos;
+    for (size_t function = 0; function < rbpf_application_functions_len(rbpf); function++) {
+        uint16_t pc = functions[function].location_offset / sizeof(bpf_instruction_t);
+
+        if (pc != 0) {
+            _emit_movw(&jit, IP, pc);
+            _emit_dp(&jit, DP_SUB, true, 0xf, R3, IP, SHIFT_LSL, 0);
+            _emit_it_eq(&jit);
+            _emit32(&jit, 0, 0);
+        }
+    }
+
+    for (size_t pc = 0; pc < num_instructions; pc++) {
+        rbpf_insn_t insn = rbpf->insns[pc];
+
+        jit.offsets[pc] = jit.pos;
+        jit.pc = pc;
+#if (RBPF_ENABLE_FUSION)
+        if (_unfused[insn.handler]) {
+            insn.handler = _unfused[insn.handler];
+        }
+#endif
+        _emit_insn(&jit, &insn);
+        if (jit.pos > jit.len || jit.pos > UINT16_MAX) {
+            return RBPF_ILLEGAL_LEN;
+        }
+    }
+    jit.offsets[num_instructions] = jit.pos;
+
+    /* Every jump ends with the B.W to its target */
+    for (size_t pc = 0; pc < num_instructions; pc++) {
+        const rbpf_insn_t *insn = &rbpf->insns[pc];
+        if (_is_jump(insn)) {
+            _patch_b(&jit, jit.offsets[pc + 1] - 2, jit.offsets[insn->target - rbpf->insns]);
+        }
+        else if (insn->handler == RBPF_HANDLER_JMP_TABLE) {
+            /* The stubs from the last one, back from the next instruction */
+            size_t pos = jit.offsets[pc + 1];
+
+            jit.pc = pc;
+            for (size_t entry = insn->immediate + 1; entry-- > 0;) {
+                pos -= 2;
+                _patch_b(&jit, pos, jit.offsets[insn->table[entry]]);
+                pos -= _budget_len(_target_cost(&jit, insn->table[entry]));
+            }
+        }
+    }
+    for (size_t function = 0; function < rbpf_application_functions_len(rbpf); function++) {
+        size_t pc = functions[function].location_offset / sizeof(bpf_instruction_t);
+
+        if (pc != 0) {
+            dispatch += FUNCTION_LEN;
+            _patch_b(&jit, dispatch - 2, jit.offsets[pc]);
+        }
+    }
+
+    /* Make sure the new instructions are visible to the instruction fetch */
+    __asm__ volatile ("dsb\n\tisb" ::: "memory");
+    rbpf->jit = (rbpf_jit_fn_t)((uintptr_t)(jit.code + entry) | 1);
+    return RBPF_OK;
+}
+
+#else /* RBPF_ENABLE_JIT && __thumb2__ */
+
+int rbpf_jit_compile(rbpf_application_t *rbpf, void *buf, size_t len)
+{
+    (void)rbpf;
+    (void)buf;
+    (void)len;
+    return RBPF_JIT_UNAVAILABLE;
+}
+
+#endif /* RBPF_ENABLE_JIT && __thumb2__ */
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2023 Inria
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Bulk memory functions of the applications. Every function checks the whole
+ * ranges it reads and writes once, then goes through them natively, a word
+ * at a time when they are equally aligned, instead of the memory checks of a
+ * loop of loads and stores in the application.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "rbpf.h"
+#include "rbpf/builtin_calls.h"
+#include "rbpf/config.h"
+
+#define _WORD_MASK  (sizeof(uint32_t) - 1)
+
+/* Ranges up to 2 GiB, the offsets returned then stay positive */
+static inline bool _len_valid(uint64_t len)
+{
+    return len <= INT32_MAX;
+}
+
+static inline bool _aligned(const void *a, const void *b)
+{
+    return !(((uintptr_t)a | (uintptr_t)b) & _WORD_MASK);
+}
+
+/* Copied one byte at a time here, a plain loop could be turned back into a
+ * memcpy call, which the FAE builds don't link with */
+static void _copy_bytes(volatile uint8_t *dst, const uint8_t *src, size_t len)
+{
+    while (len--) {
+        *dst++ = *src++;
+    }
+}
+
+/* Blocks of four words, the length left is under a block */
+static void _copy_words(uint8_t **dst, const uint8_t **src, size_t *len)
+{
+    uint8_t *d = *dst;
+    const uint8_t *s = *src;
+    size_t blocks = *len / (4 * sizeof(uint32_t));
+
+    *len -= blocks * 4 * sizeof(uint32_t);
+    while (blocks--) {
+#ifdef __thumb2__
+        __asm__ volatile ("ldmia %[s]!, {r3-r6}\n\tstmia %[d]!, {r3-r6}"
+                          : [d] "+r" (d), [s] "+r" (s)
+                          :
+                          : "r3", "r4", "r5", "r6", "memory");
+#else
+        volatile uint32_t *wd = (volatile uint32_t *)d;
+        const uint32_t *ws = (const uint32_t *)s;
+        uint32_t w0 = ws[0], w1 = ws[1], w2 = ws[2], w3 = ws[3];
+
+        wd[0] = w0;
+        wd[1] = w1;
+        wd[2] = w2;
+        wd[3] = w3;
+        d += 4 * sizeof(uint32_t);
+        s += 4 * sizeof(uint32_t);
+#endif
+    }
+    *dst = d;
+    *src = s;
+}
+
+static void _copy(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    if (!((uintptr_t)dst - (uintptr_t)src < len)) {
+        /* Forward, by blocks of words once both are aligned */
+        size_t head = -(uintptr_t)dst & _WORD_MASK;
+
+        if (!(((uintptr_t)dst ^ (uintptr_t)src) & _WORD_MASK) && len >= head) {
+            _copy_bytes(dst, src, head);
+            dst += head;
+            src += head;
+            len -= head;
+
+            _copy_words(&dst, &src, &len);
+        }
+        _copy_bytes(dst, src, len);
+    }
+    else {
+        /* The destination overlaps the end of the source, backward */
+        volatile uint8_t *vdst = dst;
+
+        while (len--) {
+            vdst[len] = src[len];
+        }
+    }
+}
+
+static void _fill(volatile uint8_t *dst, uint8_t value, size_t len)
+{
+    size_t head = -(uintptr_t)dst & _WORD_MASK;
+
+    if (len >= head + sizeof(uint32_t)) {
+        const uint32_t word = value * 0x01010101U;
+
+        for (; head; head--, len--) {
+            *dst++ = value;
+        }
+        volatile uint32_t *wdst = (volatile uint32_t *)dst;
+        for (; len >= sizeof(uint32_t); len -= sizeof(uint32_t)) {
+            *wdst++ = word;
+        }
+        dst = (volatile uint8_t *)wdst;
+    }
+    while (len--) {
+        *dst++ = value;
+    }
+}
+
+static int _compare(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    /* Skip the equal words, the first difference is in the bytes after */
+    if (_aligned(a, b)) {
+        while (len >= sizeof(uint32_t) && *(const uint32_t *)a == *(const uint32_t *)b) {
+            a += sizeof(uint32_t);
+            b += sizeof(uint32_t);
+            len -= sizeof(uint32_t);
+        }
+    }
+    for (; len; len--, a++, b++) {
+        if (*a != *b) {
+            return *a < *b ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static int32_t _find(const uint8_t *s, uint8_t value, size_t len)
+{
+    const uint8_t *start = s;
+
+    for (; len && ((uintptr_t)s & _WORD_MASK); len--, s++) {
+        if (*s == value) {
+            return s - start;
+        }
+    }
+
+    /* Skip the words without the value, a zero byte of their xor with it */
+    const uint32_t pattern = value * 0x01010101U;
+    for (; len >= sizeof(uint32_t); len -= sizeof(uint32_t), s += sizeof(uint32_t)) {
+        uint32_t word = *(const uint32_t *)s ^ pattern;
+
+        if ((word - 0x01010101U) & ~word & 0x80808080U) {
+            break;
+        }
+    }
+
+    for (; len; len--, s++) {
+        if (*s == value) {
+            return s - start;
+        }
+    }
+    return -1;
+}
+
+uint32_t rbpf_vm_memcpy(rbpf_application_t *rbpf, uint64_t *regs)
+{
+    uint8_t *dst = (uint8_t *)(uintptr_t)regs[1];
+    const uint8_t *src = (const uint8_t *)(uintptr_t)regs[2];
+    const uint64_t len = regs[3];
+
+    if (!_len_valid(len) ||
+        (len && !(rbpf_store_allowed(rbpf, dst, len) &&
+                  rbpf_load_allowed(rbpf, (void *)src, len)))) {
+        return (uint32_t)RBPF_ILLEGAL_MEM;
+    }
+    _copy(dst, src, len);
+    return RBPF_OK;
+}
+
+uint32_t rbpf_vm_memset(rbpf_application_t *rbpf, uint64_t *regs)
+{
+    uint8_t *dst = (uint8_t *)(uintptr_t)regs[1];
+    const uint64_t len = regs[3];
+
+    if (!_len_valid(len) || (len && !rbpf_store_allowed(rbpf, dst, len))) {
+        return (uint32_t)RBPF_ILLEGAL_MEM;
+    }
+    _fill(dst, (uint8_t)regs[2], len);
+    return RBPF_OK;
+}
+
+uint32_t rbpf_vm_memcmp(rbpf_application_t *rbpf, uint64_t *regs)
+{
+    const uint8_t *a = (const uint8_t *)(uintptr_t)regs[1];
+    const uint8_t *b = (const uint8_t *)(uintptr_t)regs[2];
+    const uint64_t len = regs[3];
+
+    if (!_len_valid(len) ||
+        (len && !(rbpf_load_allowed(rbpf, (void *)a, len) &&
+                  rbpf_load_allowed(rbpf, (void *)b, len)))) {
+        return (uint32_t)RBPF_ILLEGAL_MEM;
+    }
+    return (uint32_t)_compare(a, b, len);
+}
+
+uint32_t rbpf_vm_memchr(rbpf_application_t *rbpf, uint64_t *regs)
+{
+    const uint8_t *s = (const uint8_t *)(uintptr_t)regs[1];
+    const uint64_t len = regs[3];
+
+    if (!_len_valid(len) || (len && !rbpf_load_allowed(rbpf, (void *)s, len))) {
+        return (uint32_t)RBPF_ILLEGAL_MEM;
+    }
+    return (uint32_t)_find(s, (uint8_t)regs[2], len);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2023 Inria
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/*
+ * Execution profiles. The engine built with RBPF_ENABLE_PROFILE increments the
+ * counters of the instructions it runs, a profile only needs them cleared
+ * beforehand and read back afterwards.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "rbpf.h"
+#include "rbpf/config.h"
+
+void rbpf_profile_init(rbpf_profile_t *profile, rbpf_profile_entry_t *entries, size_t len)
+{
+    /* Cleared one by one, an initializer makes the compiler generate a memset
+     * call, which the FAE builds don't link with */
+    for (size_t i = 0; i < len; i++) {
+        entries[i].count = 0;
+        entries[i].taken = 0;
+        entries[i].misses = 0;
+    }
+    profile->entries = entries;
+    profile->len = len;
+    profile->current = entries;
+}
+
+size_t rbpf_profile_dump(const rbpf_profile_t *profile, rbpf_profile_print_t print, void *arg)
+{
+    size_t ran = 0;
+
+    for (size_t pc = 0; pc < profile->len; pc++) {
+        const rbpf_profile_entry_t *entry = &profile->entries[pc];
+
+        if (entry->count == 0) {
+            continue;
+        }
+        ran++;
+        if (print) {
+            print(pc, entry, arg);
+        }
+    }
+    return ran;
+}
@@ -13,70 +13,1989 @@
 
 #include "rbpf.h"
 #include "rbpf/builtin_shared.h"
+#include "rbpf/builtin_calls.h"
 #include "rbpf/instruction.h"
 #include "rbpf/config.h"
+#include "handlers.h"
 
-static bool _rbpf_check_call(uint32_t num)
+/* Map every bytecode opcode to the handler executing it, unknown opcodes map
+ * to the illegal instruction handler */
+#define HANDLER_OF_OPCODE(name) [BPF_INSTRUCTION_ ## name] = RBPF_HANDLER_ ## name,
+static const uint8_t _rbpf_opcode_handlers[256] = {
+    RBPF_OPCODE_HANDLERS(HANDLER_OF_OPCODE)
+    /* Replaced by the handler of their width while pre-decoding */
+    [BPF_INSTRUCTION_ALU_END_LE] = RBPF_HANDLER_ALU_LE64,
+    [BPF_INSTRUCTION_ALU_END_BE] = RBPF_HANDLER_ALU_BE64,
+    /* Replaced by the handler of their operation while pre-decoding */
+    [BPF_INSTRUCTION_MEM_ATOMICW] = RBPF_HANDLER_ATOMICW_ADD,
+#if (RBPF_ENABLE_ATOMIC64)
+    [BPF_INSTRUCTION_MEM_ATOMICDW] = RBPF_HANDLER_ATOMICDW_ADD,
+#endif
+};
+
+static rbpf_call_t _rbpf_get_call(uint32_t num)
+{
+    switch (num) {
+    case BPF_FUNC_BPF_STORE_LOCAL:
+        return rbpf_vm_store_local;
+    case BPF_FUNC_BPF_STORE_GLOBAL:
+        return rbpf_vm_store_global;
+    case BPF_FUNC_BPF_FETCH_LOCAL:
+        return rbpf_vm_fetch_local;
+    case BPF_FUNC_BPF_FETCH_GLOBAL:
+        return rbpf_vm_fetch_global;
+    case BPF_FUNC_BPF_MEMCPY:
+        return rbpf_vm_memcpy;
+    case BPF_FUNC_BPF_MEMSET:
+        return rbpf_vm_memset;
+    case BPF_FUNC_BPF_MEMCMP:
+        return rbpf_vm_memcmp;
+    case BPF_FUNC_BPF_MEMCHR:
+        return rbpf_vm_memchr;
+    default:
+        return rbpf_get_external_call(num);
+    }
+}
+
+static bool _rbpf_is_lddw(uint8_t opcode)
+{
+    return opcode == BPF_INSTRUCTION_MEM_LDDW ||
+           opcode == BPF_INSTRUCTION_MEM_LDDWD ||
+           opcode == BPF_INSTRUCTION_MEM_LDDWR;
+}
+
+/* Fold a double word load into the single 64 bit immediate it produces */
+static int64_t _rbpf_lddw_immediate(const rbpf_application_t *rbpf,
+                                    const bpf_instruction_t *i)
+{
+    uint64_t low = (uint32_t)i->immediate;
+    uint64_t high = (uint64_t)(uint32_t)(i + 1)->immediate << 32;
+
+    switch (i->opcode) {
+    /* Addresses relative to the application data and read-only data */
+    case BPF_INSTRUCTION_MEM_LDDWD:
+        return (intptr_t)rbpf_application_data(rbpf) + (int64_t)i->immediate + high;
+    case BPF_INSTRUCTION_MEM_LDDWR:
+        return (intptr_t)rbpf_application_rodata(rbpf) + (int64_t)i->immediate + high;
+    default:
+        return low | high;
+    }
+}
+
+/* Jumps to a single target, in their offset */
+static bool _rbpf_is_jump(uint8_t opcode)
+{
+    return opcode != BPF_INSTRUCTION_RETURN && opcode != BPF_INSTRUCTION_CALL &&
+           opcode != BPF_INSTRUCTION_JMP_TABLE &&
+           (opcode & BPF_INSTRUCTION_CLS_MASK) == BPF_INSTRUCTION_CLS_BRANCH;
+}
+
+/* Entries of a pre-decoded jump table, its default entry included */
+static size_t _rbpf_table_len(const rbpf_insn_t *insn)
+{
+    return (size_t)insn->immediate + 1;
+}
+
+/* Opcode of the instructions lowered to every handler, the double word loads
+ * all map back to the LDDW opcode */
+#define OPCODE_OF_HANDLER(name) [RBPF_HANDLER_ ## name] = BPF_INSTRUCTION_ ## name,
+#define OPCODE_OF_BYTESWAP(name, opcode, width) [RBPF_HANDLER_ ## name] = BPF_INSTRUCTION_ ## opcode,
+#define OPCODE_OF_VARIANT(name, opcode) [RBPF_HANDLER_ ## name] = BPF_INSTRUCTION_ ## opcode,
+#define OPCODE_OF_ATOMIC(name, opcode, op) [RBPF_HANDLER_ ## name] = BPF_INSTRUCTION_ ## opcode,
+static const uint8_t _rbpf_handler_opcodes[RBPF_HANDLER_COUNT] = {
+    RBPF_OPCODE_HANDLERS(OPCODE_OF_HANDLER)
+    RBPF_BYTESWAP_HANDLERS(OPCODE_OF_BYTESWAP)
+    RBPF_VARIANT_HANDLERS(OPCODE_OF_VARIANT)
+    RBPF_ATOMIC_HANDLERS(OPCODE_OF_ATOMIC)
+};
+
+static bool _rbpf_is_byteswap(uint8_t opcode)
+{
+    return opcode == BPF_INSTRUCTION_ALU_END_LE || opcode == BPF_INSTRUCTION_ALU_END_BE;
+}
+
+/* Handler of a byte swap to the width in its immediate, the illegal
+ * instruction handler for other widths */
+#define HANDLER_OF_BYTESWAP(name, op, width) \
+    if (i->opcode == BPF_INSTRUCTION_ ## op && i->immediate == width) { \
+        return RBPF_HANDLER_ ## name; \
+    }
+static uint8_t _rbpf_byteswap_handler(const bpf_instruction_t *i)
+{
+    RBPF_BYTESWAP_HANDLERS(HANDLER_OF_BYTESWAP)
+    return RBPF_HANDLER_ILLEGAL;
+}
+#undef HANDLER_OF_BYTESWAP
+
+static bool _rbpf_is_atomic(uint8_t opcode)
+{
+    return opcode == BPF_INSTRUCTION_MEM_ATOMICW || opcode == BPF_INSTRUCTION_MEM_ATOMICDW;
+}
+
+/* Handler of an atomic instruction doing the operation in its immediate, the
+ * illegal instruction handler for unknown operations and unsupported widths */
+#define HANDLER_OF_ATOMIC(name, width, op) \
+    if (i->opcode == BPF_INSTRUCTION_ ## width && \
+        i->immediate == BPF_INSTRUCTION_ATOMIC_ ## op) { \
+        return RBPF_HANDLER_ ## name; \
+    }
+static uint8_t _rbpf_atomic_handler(const bpf_instruction_t *i)
+{
+    RBPF_ATOMIC_HANDLERS(HANDLER_OF_ATOMIC)
+    return RBPF_HANDLER_ILLEGAL;
+}
+#undef HANDLER_OF_ATOMIC
+
+/* Register the atomic instruction loads the previous value in, -1 when it
+ * doesn't */
+static int _rbpf_atomic_fetch_reg(const bpf_instruction_t *i)
+{
+    if (!(i->immediate & BPF_INSTRUCTION_ATOMIC_FETCH)) {
+        return -1;
+    }
+    return i->immediate == BPF_INSTRUCTION_ATOMIC_CMPXCHG ? 0 : i->src;
+}
+
+/* Length of an instruction in the compressed text, from its opcode, 0 for the
+ * opcodes without a compressed form */
+static size_t _rbpf_compressed_len(uint8_t opcode)
+{
+    bool imm = !(opcode & BPF_INSTRUCTION_ALU_S_MASK);
+
+    if (_rbpf_is_lddw(opcode)) {
+        return 10;
+    }
+    /* The byte swaps keep their width */
+    if (_rbpf_is_byteswap(opcode)) {
+        return 6;
+    }
+    /* The atomic instructions keep their operation after the offset */
+    if (_rbpf_is_atomic(opcode)) {
+        return 8;
+    }
+    switch (opcode & BPF_INSTRUCTION_CLS_MASK) {
+    case BPF_INSTRUCTION_CLS_ALU32:
+    case BPF_INSTRUCTION_CLS_ALU64:
+        /* Opcode, registers and the immediate, NEG has no operand */
+        return (imm && (opcode & BPF_INSTRUCTION_ALU_OP_MASK) != BPF_INSTRUCTION_ALU_NEG) ? 6 : 2;
+    case BPF_INSTRUCTION_CLS_LDX:
+    case BPF_INSTRUCTION_CLS_STX:
+        /* Opcode, registers and the offset */
+        return 4;
+    case BPF_INSTRUCTION_CLS_ST:
+        return 8;
+    case BPF_INSTRUCTION_CLS_BRANCH:
+        if (opcode == BPF_INSTRUCTION_RETURN) {
+            return 2;
+        }
+        /* Calls and jump tables keep their immediate only */
+        if (opcode == BPF_INSTRUCTION_CALL || opcode == BPF_INSTRUCTION_JMP_TABLE) {
+            return 6;
+        }
+        return (imm && opcode != BPF_INSTRUCTION_JMP_ALWAYS) ? 8 : 4;
+    default:
+        return 0;
+    }
+}
+
+static uint32_t _rbpf_read32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Read the instruction at pos into i, a double word load into i[0] and i[1].
+ * The jumps of the compressed text keep their offset in bytes. Returns the
+ * length of the instruction in the text, or an error */
+static int _rbpf_fetch(const uint8_t *pos, size_t left, bool compressed, bpf_instruction_t *i)
+{
+    i[1] = (bpf_instruction_t){ 0 };
+    if (!compressed) {
+        size_t len = sizeof(bpf_instruction_t);
+
+        if (left >= len && _rbpf_is_lddw(pos[0])) {
+            len *= 2;
+        }
+        if (left < len) {
+            return RBPF_ILLEGAL_LEN;
+        }
+        i[0] = *(const bpf_instruction_t *)pos;
+        if (len > sizeof(bpf_instruction_t)) {
+            i[1] = *(const bpf_instruction_t *)(pos + sizeof(bpf_instruction_t));
+        }
+        return len;
+    }
+
+    /* Without a handler the length of the instruction is not known either */
+    size_t len = _rbpf_compressed_len(pos[0]);
+    if (len == 0 || (_rbpf_opcode_handlers[pos[0]] == RBPF_HANDLER_ILLEGAL &&
+                     !_rbpf_is_lddw(pos[0]))) {
+        return RBPF_ILLEGAL_INSTRUCTION;
+    }
+    if (left < len) {
+        return RBPF_ILLEGAL_LEN;
+    }
+
+    i[0] = (bpf_instruction_t){ .opcode = pos[0], .dst = pos[1] & 0x0f, .src = pos[1] >> 4 };
+    switch (len) {
+    case 10:
+        i[0].immediate = _rbpf_read32(pos + 2);
+        i[1].immediate = _rbpf_read32(pos + 6);
+        break;
+    case 6:
+        i[0].immediate = _rbpf_read32(pos + 2);
+        break;
+    case 8:
+        i[0].immediate = _rbpf_read32(pos + 4);
+    /* fall through */
+    case 4:
+        i[0].offset = (int16_t)(pos[2] | (pos[3] << 8));
+        break;
+    default:
+        break;
+    }
+    return len;
+}
+
+/* Index of the instruction starting at byte addr of the compressed text,
+ * searching from the instruction at pc, starting at byte at. -1 when no
+ * instruction starts there */
+static intptr_t _rbpf_compressed_pc(const rbpf_insn_t *insns, size_t len, size_t pc,
+                                    intptr_t at, intptr_t addr)
+{
+    while (at < addr && pc < len) {
+        at += _rbpf_compressed_len(_rbpf_handler_opcodes[insns[pc].handler]);
+        pc += insns[pc].handler == RBPF_HANDLER_MEM_LDDW ? 2 : 1;
+    }
+    while (at > addr && pc > 0) {
+        pc -= (pc >= 2 && insns[pc - 2].handler == RBPF_HANDLER_MEM_LDDW) ? 2 : 1;
+        at -= _rbpf_compressed_len(_rbpf_handler_opcodes[insns[pc].handler]);
+    }
+    return (at == addr && pc < len) ? (intptr_t)pc : -1;
+}
+
+#if (RBPF_ENABLE_RANGE_ANALYSIS)
+/* Bytecode instruction lowered into insns[pc], before the verifier changes
+ * its handler. Double word loads only keep their first half */
+static bpf_instruction_t _rbpf_text(const rbpf_insn_t *insns, size_t pc)
+{
+    const rbpf_insn_t *insn = &insns[pc];
+    bpf_instruction_t i = {
+        .opcode = _rbpf_handler_opcodes[insn->handler],
+        .dst = insn->dst,
+        .src = insn->src,
+        .offset = insn->offset,
+        .immediate = insn->immediate,
+    };
+
+    if (_rbpf_is_jump(i.opcode)) {
+        i.offset = insn->target - insn - 1;
+    }
+    else if (insn->handler == RBPF_HANDLER_JMP_TABLE) {
+        i.offset = 0;
+    }
+    else if (insn->handler == RBPF_HANDLER_CALL_LOCAL) {
+        i.src = BPF_INSTRUCTION_CALL_LOCAL_SRC;
+        i.offset = 0;
+        i.immediate = insn->target - insn - 1;
+    }
+    return i;
+}
+
+/*
+ * Range analysis
+ *
+ * Abstract interpretation of the application over the registers. Every
+ * register is either unknown, a number or a pointer into one of the memory
+ * regions of the application, with the range of the number or of the offset
+ * from the start of the region. Whether its upper 32 bits are zero is tracked
+ * alongside, also for values of unknown range. The register state is kept at the jump
+ * targets and the application is walked in order until these states don't
+ * change anymore. States that keep changing are widened to unknown.
+ */
+
+enum {
+    _VAL_UNKNOWN = 0,
+    _VAL_SCALAR,
+    _VAL_STACK,
+    _VAL_CTX,
+    _VAL_DATA,
+    _VAL_RODATA,
+    _VAL_EMPTY = 0xff,  /* No value, the path can't be taken */
+};
+
+typedef struct {
+    uint8_t kind;
+    bool zext;                  /* The upper 32 bits are zero */
+    int32_t min;
+    int32_t max;
+} _value_t;
+
+typedef struct {
+    _value_t regs[11];
+    bool ctx_written;           /* A store may have changed a declared context field */
+} _state_t;
+
+/* Loops closed before the current instruction and not inside another one, for
+ * which the analysis keeps the fuel they would charge */
+#define ANALYSIS_LOOPS_MAX  (8)
+
+typedef struct {
+    size_t start;               /* Target of the jump closing the loop */
+    uint64_t work;              /* Fuel charged by all its iterations */
+} _loop_t;
+
+typedef struct {
+    const rbpf_application_t *rbpf;
+    rbpf_insn_t *insns;
+    size_t len;
+    size_t data_len;
+    size_t rodata_len;
+    bool r10_fixed;             /* r10 is never written by the application */
+    int32_t r10_min;            /* Lowest offset of r10 in the stack, in a called function */
+    bool widen;
+    bool changed;
+#if (RBPF_ENABLE_REG32)
+    bool reg32;                 /* No instruction reads a non-zero upper half */
+#endif
+    bool unbounded;             /* A loop isn't proven to end */
+    bool ctx_bounds;            /* The declared context fields are loaded in their range */
+    uint32_t calls;             /* Local calls, a function runs at most once per call */
+    uint8_t num_loops;
+    _loop_t loops[ANALYSIS_LOOPS_MAX];  /* In text order */
+    bool stack_lost;            /* A stack address is no longer followed */
+    int32_t stack_low;          /* Lowest stack offset accessed */
+    uint8_t num_states;
+    uint32_t pcs[RBPF_ANALYSIS_STATES];
+    bool reached[RBPF_ANALYSIS_STATES];
+    _state_t states[RBPF_ANALYSIS_STATES];
+} _analysis_t;
+
+static void _value_set(_value_t *v, uint8_t kind, int64_t min, int64_t max)
+{
+    if (kind == _VAL_UNKNOWN || min < INT32_MIN || max > INT32_MAX || min > max) {
+        v->kind = _VAL_UNKNOWN;
+        v->zext = false;
+        v->min = 0;
+        v->max = 0;
+        return;
+    }
+    v->kind = kind;
+    v->zext = kind == _VAL_SCALAR && min >= 0;
+    v->min = min;
+    v->max = max;
+}
+
+/* The range of the value proves its upper 32 bits to be zero */
+static bool _value_zext(const _analysis_t *a, const _value_t *v)
+{
+    int64_t base;
+
+    switch (v->kind) {
+    case _VAL_SCALAR:
+        return v->min >= 0;
+    case _VAL_CTX:
+        /* Only the context pointer itself, its address is not known yet */
+        return v->min == 0 && v->max == 0 && UINTPTR_MAX <= UINT32_MAX;
+    case _VAL_STACK:
+        /* The offsets count from the start of a full size stack ending at
+         * r10, one given after the checks is taken at the bottom of memory */
+        base = a->rbpf->stack ?
+               (intptr_t)(a->rbpf->stack + a->rbpf->stack_len) - RBPF_STACK_SIZE : 0;
+        break;
+    case _VAL_DATA:
+        /* The folded double word loads use signed addresses */
+        base = (intptr_t)rbpf_application_data(a->rbpf);
+        break;
+    case _VAL_RODATA:
+        base = (intptr_t)rbpf_application_rodata(a->rbpf);
+        break;
+    default:
+        return false;
+    }
+    return base + v->min >= 0 && base + v->max <= (int64_t)UINT32_MAX;
+}
+
+static void _state_unknown(const _analysis_t *a, _state_t *state)
+{
+    for (unsigned r = 0; r < 11; r++) {
+        _value_set(&state->regs[r], _VAL_UNKNOWN, 0, 0);
+    }
+    if (a->r10_fixed) {
+        _value_set(&state->regs[10], _VAL_STACK, a->r10_min, RBPF_STACK_SIZE);
+        state->regs[10].zext = _value_zext(a, &state->regs[10]);
+    }
+    state->ctx_written = true;
+}
+
+/* The stack addresses in the registers are about to be forgotten, the
+ * application may then access its stack anywhere */
+static void _stack_drop(_analysis_t *a, const _value_t *regs, unsigned from, unsigned to)
+{
+    for (unsigned r = from; r < to; r++) {
+        if (regs[r].kind == _VAL_STACK) {
+            a->stack_lost = true;
+        }
+    }
+}
+
+static int _state_slot(const _analysis_t *a, size_t pc)
+{
+    for (unsigned slot = 0; slot < a->num_states; slot++) {
+        if (a->pcs[slot] == pc) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+/* Merge a state flowing into a jump target */
+static void _state_merge(_analysis_t *a, size_t pc, const _state_t *state)
+{
+    int slot = _state_slot(a, pc);
+
+    if (slot < 0) {
+        _stack_drop(a, state->regs, 0, 10);
+        return;
+    }
+    if (!a->reached[slot]) {
+        a->states[slot] = *state;
+        a->reached[slot] = true;
+        a->changed = true;
+        return;
+    }
+    if (state->ctx_written && !a->states[slot].ctx_written) {
+        a->states[slot].ctx_written = true;
+        a->changed = true;
+    }
+    for (unsigned r = 0; r < 11; r++) {
+        _value_t *dst = &a->states[slot].regs[r];
+        const _value_t *src = &state->regs[r];
+        _value_t res = *dst;
+        bool zext = dst->zext && src->zext;
+
+        if (src->kind == _VAL_STACK && dst->kind != _VAL_STACK) {
+            a->stack_lost = true;
+        }
+        if (dst->kind != src->kind) {
+            _value_set(&res, _VAL_UNKNOWN, 0, 0);
+        }
+        else {
+            _value_set(&res, dst->kind, src->min < dst->min ? src->min : dst->min,
+                       src->max > dst->max ? src->max : dst->max);
+        }
+        res.zext = zext;
+        if (res.kind != dst->kind || res.min != dst->min || res.max != dst->max ||
+            res.zext != dst->zext) {
+            if (a->widen) {
+                _value_set(&res, _VAL_UNKNOWN, 0, 0);
+                res.zext = zext;
+            }
+            if (dst->kind == _VAL_STACK && res.kind != _VAL_STACK) {
+                a->stack_lost = true;
+            }
+            *dst = res;
+            a->changed = true;
+        }
+    }
+}
+
+static void _transfer_alu64(_value_t *regs, const bpf_instruction_t *i)
+{
+    _value_t *dst = &regs[i->dst];
+    _value_t src;
+    bool imm = !(i->opcode & BPF_INSTRUCTION_ALU_S_MASK);
+
+    if (imm) {
+        _value_set(&src, _VAL_SCALAR, i->immediate, i->immediate);
+    }
+    else {
+        src = regs[i->src];
+    }
+
+    switch (i->opcode & BPF_INSTRUCTION_ALU_OP_MASK) {
+    case BPF_INSTRUCTION_ALU_MOV:
+        *dst = src;
+        return;
+    case BPF_INSTRUCTION_ALU_ADD:
+        if (src.kind == _VAL_SCALAR && dst->kind != _VAL_UNKNOWN) {
+            _value_set(dst, dst->kind, (int64_t)dst->min + src.min, (int64_t)dst->max + src.max);
+        }
+        else if (dst->kind == _VAL_SCALAR && src.kind >= _VAL_STACK) {
+            _value_set(dst, src.kind, (int64_t)dst->min + src.min, (int64_t)dst->max + src.max);
+        }
+        else {
+            _value_set(dst, _VAL_UNKNOWN, 0, 0);
+        }
+        return;
+    case BPF_INSTRUCTION_ALU_SUB:
+        if (src.kind == _VAL_SCALAR && dst->kind != _VAL_UNKNOWN) {
+            _value_set(dst, dst->kind, (int64_t)dst->min - src.max, (int64_t)dst->max - src.min);
+        }
+        else {
+            _value_set(dst, _VAL_UNKNOWN, 0, 0);
+        }
+        return;
+    case BPF_INSTRUCTION_ALU_AND:
+        /* A positive mask bounds any value */
+        if (src.kind == _VAL_SCALAR && src.min >= 0) {
+            int32_t max = src.max;
+            if (dst->kind == _VAL_SCALAR && dst->min >= 0 && dst->max < max) {
+                max = dst->max;
+            }
+            _value_set(dst, _VAL_SCALAR, 0, max);
+        }
+        else {
+            _value_set(dst, _VAL_UNKNOWN, 0, 0);
+        }
+        return;
+    case BPF_INSTRUCTION_ALU_RSH:
+        if (imm && i->immediate >= 0 && i->immediate < 64) {
+            if (dst->kind == _VAL_SCALAR && dst->min >= 0) {
+                _value_set(dst, _VAL_SCALAR, (int64_t)dst->min >> i->immediate,
+                           (int64_t)dst->max >> i->immediate);
+            }
+            else if (i->immediate > 32) {
+                _value_set(dst, _VAL_SCALAR, 0, (INT64_C(1) << (64 - i->immediate)) - 1);
+            }
+            else {
+                _value_set(dst, _VAL_UNKNOWN, 0, 0);
+            }
+        }
+        else {
+            _value_set(dst, _VAL_UNKNOWN, 0, 0);
+        }
+        return;
+    case BPF_INSTRUCTION_ALU_LSH:
+        if (imm && i->immediate >= 0 && i->immediate < 32 &&
+            dst->kind == _VAL_SCALAR && dst->min >= 0) {
+            _value_set(dst, _VAL_SCALAR, (int64_t)dst->min << i->immediate,
+                       (int64_t)dst->max << i->immediate);
+        }
+        else {
+            _value_set(dst, _VAL_UNKNOWN, 0, 0);
+        }
+        return;
+    case BPF_INSTRUCTION_ALU_MUL:
+        if (src.kind == _VAL_SCALAR && src.min >= 0 &&
+            dst->kind == _VAL_SCALAR && dst->min >= 0) {
+            _value_set(dst, _VAL_SCALAR, (int64_t)dst->min * src.min,
+                       (int64_t)dst->max * src.max);
+        }
+        else {
+            _value_set(dst, _VAL_UNKNOWN, 0, 0);
+        }
+        return;
+    default:
+        _value_set(dst, _VAL_UNKNOWN, 0, 0);
+        return;
+    }
+}
+
+static void _transfer_alu32(_value_t *regs, const bpf_instruction_t *i)
+{
+    _value_t *dst = &regs[i->dst];
+    _value_t src;
+    bool imm = !(i->opcode & BPF_INSTRUCTION_ALU_S_MASK);
+
+    if (imm) {
+        _value_set(&src, _VAL_SCALAR, i->immediate, i->immediate);
+    }
+    else {
+        src = regs[i->src];
+    }
+
+    /* Only results that are still positive as 32 bit numbers are tracked */
+    switch (i->opcode & BPF_INSTRUCTION_ALU_OP_MASK) {
+    case BPF_INSTRUCTION_ALU_BYTESWAP:
+        /* Converting to little endian truncates, the 16 bit swaps too */
+        if (i->immediate == 16) {
+            _value_set(dst, _VAL_SCALAR, 0, UINT16_MAX);
+            return;
+        }
+        if (i->opcode == BPF_INSTRUCTION_ALU_END_LE &&
+            (i->immediate == 64 || (dst->kind == _VAL_SCALAR && dst->min >= 0))) {
+            return;
+        }
+        break;
+    case BPF_INSTRUCTION_ALU_MOV:
+        if (src.kind == _VAL_SCALAR && src.min >= 0) {
+            *dst = src;
+            return;
+        }
+        break;
+    case BPF_INSTRUCTION_ALU_AND:
+        if (src.kind == _VAL_SCALAR && src.min >= 0) {
+            _value_set(dst, _VAL_SCALAR, 0, src.max);
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+    _value_set(dst, _VAL_UNKNOWN, 0, 0);
+}
+
+/* The instruction leaves the upper 32 bits of its destination at zero,
+ * whatever the range of the result */
+static bool _zext_result(const _value_t *regs, const bpf_instruction_t *i)
+{
+    const _value_t *dst = &regs[i->dst];
+    bool imm = !(i->opcode & BPF_INSTRUCTION_ALU_S_MASK);
+    bool src = imm ? i->immediate >= 0 : regs[i->src].zext;
+    uint8_t op = i->opcode & BPF_INSTRUCTION_ALU_OP_MASK;
+
+    switch (i->opcode & BPF_INSTRUCTION_CLS_MASK) {
+    case BPF_INSTRUCTION_CLS_LDX:
+        return (i->opcode & BPF_INSTRUCTION_MEM_SZ_MASK) != 0x18;
+    case BPF_INSTRUCTION_CLS_ALU32:
+        /* The 64 bit byte swaps keep or swap in the upper half */
+        if (_rbpf_is_byteswap(i->opcode)) {
+            return i->immediate != 64 || (i->opcode == BPF_INSTRUCTION_ALU_END_LE && dst->zext);
+        }
+        /* The results of these are sign extended */
+        return op != BPF_INSTRUCTION_ALU_NEG && op != BPF_INSTRUCTION_ALU_ARSH;
+    case BPF_INSTRUCTION_CLS_ALU64:
+        switch (op) {
+        case BPF_INSTRUCTION_ALU_MOV:
+            return src;
+        case BPF_INSTRUCTION_ALU_AND:
+            return dst->zext || src;
+        case BPF_INSTRUCTION_ALU_OR:
+        case BPF_INSTRUCTION_ALU_XOR:
+            return dst->zext && src;
+        /* The result is at most the destination */
+        case BPF_INSTRUCTION_ALU_RSH:
+        case BPF_INSTRUCTION_ALU_ARSH:
+        case BPF_INSTRUCTION_ALU_DIV:
+        case BPF_INSTRUCTION_ALU_MOD:
+            return dst->zext;
+        default:
+            return false;
+        }
+    default:
+        return false;
+    }
+}
+
+/*
+ * Refine the range of a register compared against a constant. Returns the
+ * range when the jump is taken in taken and when it isn't in fallthrough,
+ * _VAL_EMPTY as kind means the edge can't be followed.
+ */
+static void _refine(const _value_t *v, uint8_t op, int64_t c, _value_t *taken,
+                    _value_t *fallthrough)
+{
+    bool is_signed = (op == BPF_INSTRUCTION_BRANCH_JSGT || op == BPF_INSTRUCTION_BRANCH_JSGE ||
+                      op == BPF_INSTRUCTION_BRANCH_JSLT || op == BPF_INSTRUCTION_BRANCH_JSLE);
+    int64_t lo, hi;
+    int64_t t_lo, t_hi, f_lo, f_hi;
+
+    *taken = *fallthrough = *v;
+
+    if (v->kind == _VAL_SCALAR) {
+        lo = v->min;
+        hi = v->max;
+        /* Negative values are large unsigned numbers */
+        if (!is_signed && (lo < 0 || c < 0)) {
+            return;
+        }
+    }
+    else if (v->kind == _VAL_UNKNOWN) {
+        lo = is_signed ? INT64_MIN : 0;
+        hi = INT64_MAX;
+        if (!is_signed && c < 0) {
+            return;
+        }
+    }
+    else {
+        return;
+    }
+    t_lo = f_lo = lo;
+    t_hi = f_hi = hi;
+
+    switch (op) {
+    case BPF_INSTRUCTION_BRANCH_JEQ:
+        t_lo = t_hi = c;
+        break;
+    case BPF_INSTRUCTION_BRANCH_JNE:
+        f_lo = f_hi = c;
+        break;
+    case BPF_INSTRUCTION_BRANCH_JGT:
+    case BPF_INSTRUCTION_BRANCH_JSGT:
+        t_lo = c + 1;
+        f_hi = c;
+        break;
+    case BPF_INSTRUCTION_BRANCH_JGE:
+    case BPF_INSTRUCTION_BRANCH_JSGE:
+        t_lo = c;
+        f_hi = c - 1;
+        break;
+    case BPF_INSTRUCTION_BRANCH_JLT:
+    case BPF_INSTRUCTION_BRANCH_JSLT:
+        t_hi = c - 1;
+        f_lo = c;
+        break;
+    case BPF_INSTRUCTION_BRANCH_JLE:
+    case BPF_INSTRUCTION_BRANCH_JSLE:
+        t_hi = c;
+        f_lo = c + 1;
+        break;
+    default:
+        return;
+    }
+
+    if (t_lo < lo) {
+        t_lo = lo;
+    }
+    if (t_hi > hi) {
+        t_hi = hi;
+    }
+    if (f_lo < lo) {
+        f_lo = lo;
+    }
+    if (f_hi > hi) {
+        f_hi = hi;
+    }
+    if (t_lo > t_hi) {
+        taken->kind = _VAL_EMPTY;
+    }
+    else {
+        _value_set(taken, _VAL_SCALAR, t_lo, t_hi);
+        taken->zext |= v->zext;
+    }
+    if (f_lo > f_hi) {
+        fallthrough->kind = _VAL_EMPTY;
+    }
+    else {
+        _value_set(fallthrough, _VAL_SCALAR, f_lo, f_hi);
+        fallthrough->zext |= v->zext;
+    }
+}
+
+/* Handler running a memory access proven to be in bounds */
+static uint8_t _proven_handler(uint8_t handler, bool ctx)
+{
+#define PROVEN_CASES(SIZEOP) \
+    case RBPF_HANDLER_MEM_STX ## SIZEOP: \
+        return ctx ? RBPF_HANDLER_MEM_STX ## SIZEOP ## _CTX : RBPF_HANDLER_MEM_STX ## SIZEOP ## _SAFE; \
+    case RBPF_HANDLER_MEM_ST ## SIZEOP: \
+        return ctx ? RBPF_HANDLER_MEM_ST ## SIZEOP ## _CTX : RBPF_HANDLER_MEM_ST ## SIZEOP ## _SAFE; \
+    case RBPF_HANDLER_MEM_LDX ## SIZEOP: \
+        return ctx ? RBPF_HANDLER_MEM_LDX ## SIZEOP ## _CTX : RBPF_HANDLER_MEM_LDX ## SIZEOP ## _SAFE;
+
+    switch (handler) {
+    PROVEN_CASES(B)
+    PROVEN_CASES(H)
+    PROVEN_CASES(W)
+    PROVEN_CASES(DW)
+    default:
+        return handler;
+    }
+#undef PROVEN_CASES
+}
+
+/* Bytes accessed by the load or store */
+static uint8_t _mem_size(const bpf_instruction_t *i)
+{
+    static const uint8_t sizes[] = { 4, 2, 1, 8 };
+
+    return sizes[(i->opcode & BPF_INSTRUCTION_MEM_SZ_MASK) >> 3];
+}
+
+static void _mark_mem(rbpf_application_t *rbpf, _analysis_t *a, const _value_t *regs,
+                      const bpf_instruction_t *i, size_t pc)
+{
+    uint8_t cls = i->opcode & BPF_INSTRUCTION_CLS_MASK;
+    bool load = cls == BPF_INSTRUCTION_CLS_LDX;
+    const _value_t *base = load ? &regs[i->src] : &regs[i->dst];
+    int64_t start = (int64_t)base->min + i->offset;
+    int64_t end = (int64_t)base->max + i->offset + _mem_size(i);
+    uint8_t handler = a->insns[pc].handler;
+    bool safe = false;
+
+    if (base->kind == _VAL_STACK && start < a->stack_low) {
+        a->stack_low = start < 0 ? 0 : start;
+    }
+    if (start < 0 || _proven_handler(handler, false) == handler) {
+        return;
+    }
+    switch (base->kind) {
+    case _VAL_STACK:
+        safe = end <= RBPF_STACK_SIZE;
+        break;
+    case _VAL_DATA:
+        safe = end <= (int64_t)a->data_len;
+        break;
+    case _VAL_RODATA:
+        safe = load && end <= (int64_t)a->rodata_len;
+        break;
+    case _VAL_CTX:
+        if (end > (int64_t)rbpf->ctx_len_min) {
+            rbpf->ctx_len_min = end;
+        }
+        a->insns[pc].handler = _proven_handler(handler, true);
+        return;
+    default:
+        return;
+    }
+    if (safe) {
+        a->insns[pc].handler = _proven_handler(handler, false);
+    }
+}
+
+#if (RBPF_ENABLE_REG32)
+/* The shift amount is proven to be at most max */
+static bool _reg32_shift(const _value_t *regs, const bpf_instruction_t *i, int32_t max)
+{
+    const _value_t *src = &regs[i->src];
+
+    if (!(i->opcode & BPF_INSTRUCTION_ALU_S_MASK)) {
+        return i->immediate >= 0 && i->immediate <= max;
+    }
+    return src->kind == _VAL_SCALAR && src->min >= 0 && src->max <= max;
+}
+
+/*
+ * The instruction gives the same result with 32 bit registers. With these,
+ * every register holds the low half of its value, which is all most
+ * instructions read. The ones also reading the upper half need it proven to
+ * be zero.
+ */
+static bool _reg32_insn(const _value_t *regs, const bpf_instruction_t *i)
+{
+    const _value_t *dst = &regs[i->dst];
+    const _value_t *src = &regs[i->src];
+    bool imm = !(i->opcode & BPF_INSTRUCTION_ALU_S_MASK);
+    uint8_t op = i->opcode & BPF_INSTRUCTION_ALU_OP_MASK;
+
+    switch (i->opcode & BPF_INSTRUCTION_CLS_MASK) {
+    case BPF_INSTRUCTION_CLS_ALU64:
+        switch (op) {
+        /* Shifts by 32 bits or more move the upper half in */
+        case BPF_INSTRUCTION_ALU_LSH:
+            return _reg32_shift(regs, i, 31);
+        case BPF_INSTRUCTION_ALU_RSH:
+            return dst->zext && _reg32_shift(regs, i, 31);
+        case BPF_INSTRUCTION_ALU_ARSH:
+            return dst->zext && _reg32_shift(regs, i, 63);
+        /* Negative immediates are large unsigned divisors */
+        case BPF_INSTRUCTION_ALU_DIV:
+        case BPF_INSTRUCTION_ALU_MOD:
+            return dst->zext && (imm ? i->immediate >= 0 : src->zext);
+        default:
+            return true;
+        }
+    case BPF_INSTRUCTION_CLS_ALU32:
+        /* A 64 bit big endian swap moves the upper half down */
+        if (i->opcode == BPF_INSTRUCTION_ALU_END_BE && i->immediate == 64) {
+            return dst->zext;
+        }
+        /* The division by zero check reads the whole divisor */
+        return imm || (op != BPF_INSTRUCTION_ALU_DIV && op != BPF_INSTRUCTION_ALU_MOD) ||
+               src->zext;
+    case BPF_INSTRUCTION_CLS_STX:
+        /* Double word atomics load and store the whole registers */
+        if (i->opcode == BPF_INSTRUCTION_MEM_ATOMICDW) {
+            return false;
+        }
+        return (i->opcode & BPF_INSTRUCTION_MEM_SZ_MASK) != 0x18 || src->zext;
+    case BPF_INSTRUCTION_CLS_BRANCH:
+        if (i->opcode == BPF_INSTRUCTION_RETURN) {
+            return regs[0].zext;
+        }
+        /* Helpers take the 64 bit registers, local calls only save r6-r9 and
+         * tail calls only read the index */
+        if (i->opcode == BPF_INSTRUCTION_CALL) {
+            return i->src == BPF_INSTRUCTION_CALL_LOCAL_SRC ||
+                   (i->immediate == BPF_FUNC_BPF_TAIL_CALL && regs[1].zext);
+        }
+        /* The whole index is bounded by the table */
+        if (i->opcode == BPF_INSTRUCTION_JMP_TABLE) {
+            return dst->zext;
+        }
+        return i->opcode == BPF_INSTRUCTION_JMP_ALWAYS || (dst->zext && (imm || src->zext));
+    default:
+        return true;
+    }
+}
+#endif /* RBPF_ENABLE_REG32 */
+
+/*
+ * Termination
+ *
+ * A loop is a jump going back, from j to its target t. It is bounded when a
+ * counter register is only written in [t, j] by the addition of a constant,
+ * run exactly once per iteration, and the jump compares the counter, or a zero
+ * extended copy of it made right before the jump, unsigned against a bound of
+ * known range. Counting towards the bound without wrapping around ends the
+ * loop after a number of iterations known from the ranges. The loop must be
+ * entered through t only, then a run never loops forever when all its loops
+ * are bounded.
+ */
+
+/* The instruction writes the register, calls clobber all of them */
+static bool _writes(const bpf_instruction_t *i, uint8_t reg)
+{
+    switch (i->opcode & BPF_INSTRUCTION_CLS_MASK) {
+    case BPF_INSTRUCTION_CLS_LD:
+    case BPF_INSTRUCTION_CLS_LDX:
+    case BPF_INSTRUCTION_CLS_ALU32:
+    case BPF_INSTRUCTION_CLS_ALU64:
+        return i->dst == reg;
+    case BPF_INSTRUCTION_CLS_BRANCH:
+        return i->opcode == BPF_INSTRUCTION_CALL;
+    case BPF_INSTRUCTION_CLS_STX:
+        return _rbpf_is_atomic(i->opcode) && _rbpf_atomic_fetch_reg(i) == reg;
+    default:
+        return false;
+    }
+}
+
+/* Range of the value as an unsigned number, false when not known */
+static bool _unsigned_range(const _value_t *v, uint64_t *min, uint64_t *max)
+{
+    if (v->kind == _VAL_SCALAR && v->min >= 0) {
+        *min = v->min;
+        *max = v->max;
+        return true;
+    }
+    if (v->zext) {
+        *min = 0;
+        *max = UINT32_MAX;
+        return true;
+    }
+    return false;
+}
+
+/* The jump from pc to target, with the loop [t, j] counted by the increment
+ * at inc, either enters the loop elsewhere than at t, runs the increment again
+ * without going through j or skips it */
+static bool _skips_counter(size_t pc, size_t target, size_t t, size_t j, size_t inc)
+{
+    bool inside = pc >= t && pc <= j;
+
+    return (inside && pc > inc && target >= t && target <= inc) ||
+           (inside && pc < inc && target > inc && target <= j) ||
+           (!inside && target > t && target <= j);
+}
+
+typedef struct {
+    uint64_t max;               /* Largest value compared, it wraps around after it */
+    int32_t step;               /* Added to the compared value every iteration */
+} _counter_t;
+
+/* The register compared by the jump at j going back to t counts the
+ * iterations of the loop */
+static bool _loop_counter(const _analysis_t *a, size_t t, size_t j, uint8_t reg,
+                          _counter_t *counter)
+{
+    bpf_instruction_t i;
+    size_t def = j;
+    size_t inc = j + 1;
+    uint8_t c = reg;
+
+    counter->max = UINT64_MAX;
+    do {
+        if (def == t) {
+            return false;
+        }
+        i = _rbpf_text(a->insns, --def);
+    } while (!_writes(&i, reg));
+
+    /* A zero extended copy of the counter, made on every path to the jump */
+    if (def >= t + 2 && i.opcode == BPF_INSTRUCTION_ALU64_RSH_IMM && i.immediate == 32) {
+        bpf_instruction_t lsh = _rbpf_text(a->insns, def - 1);
+        bpf_instruction_t mov = _rbpf_text(a->insns, def - 2);
+
+        if (lsh.opcode == BPF_INSTRUCTION_ALU64_LSH_IMM && lsh.dst == reg && lsh.immediate == 32 &&
+            mov.opcode == BPF_INSTRUCTION_ALU64_MOV_REG && mov.dst == reg) {
+            c = mov.src;
+            def -= 2;
+        }
+    }
+    else if (i.opcode == BPF_INSTRUCTION_ALU32_MOV_REG) {
+        c = i.src;
+    }
+    if (c != reg) {
+        counter->max = UINT32_MAX;
+        for (size_t pc = def + 1; pc <= j; pc++) {
+            if (a->insns[pc].flags & RBPF_INSN_TARGET) {
+                return false;
+            }
+        }
+    }
+
+    /* The counter is written once in the loop, by its increment */
+    for (size_t pc = t; pc <= j; pc++) {
+        i = _rbpf_text(a->insns, pc);
+        if (i.opcode == BPF_INSTRUCTION_CALL) {
+            return false;
+        }
+        if (_writes(&i, c)) {
+            if (inc <= j) {
+                return false;
+            }
+            inc = pc;
+        }
+        if (_rbpf_is_lddw(i.opcode)) {
+            pc++;
+        }
+    }
+    if (inc > j) {
+        return false;
+    }
+    i = _rbpf_text(a->insns, inc);
+    if ((i.opcode != BPF_INSTRUCTION_ALU64_ADD_IMM && i.opcode != BPF_INSTRUCTION_ALU32_ADD_IMM) ||
+        i.immediate == 0) {
+        return false;
+    }
+    if (i.opcode == BPF_INSTRUCTION_ALU32_ADD_IMM) {
+        counter->max = UINT32_MAX;
+    }
+    counter->step = i.immediate;
+
+    /* Every iteration runs the increment once: no loop inside the loop runs
+     * it again, no jump skips it and nothing jumps into the loop but at t */
+    for (size_t pc = 0; pc < a->len; pc++) {
+        i = _rbpf_text(a->insns, pc);
+        if (_rbpf_is_lddw(i.opcode)) {
+            pc++;
+            continue;
+        }
+        if (a->insns[pc].handler == RBPF_HANDLER_JMP_TABLE) {
+            const rbpf_insn_t *insn = &a->insns[pc];
+
+            for (size_t entry = 0; entry < _rbpf_table_len(insn); entry++) {
+                if (_skips_counter(pc, insn->table[entry], t, j, inc)) {
+                    return false;
+                }
+            }
+            continue;
+        }
+        if (!_rbpf_is_jump(i.opcode) || pc == j) {
+            continue;
+        }
+        if (_skips_counter(pc, pc + 1 + i.offset, t, j, inc)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Most iterations of the loop closed by the jump at j, UINT64_MAX when it
+ * isn't bounded */
+static uint64_t _loop_trips(const _analysis_t *a, const _value_t *regs,
+                            const bpf_instruction_t *i, size_t j)
+{
+    size_t t = j + 1 + i->offset;
+    bool imm = !(i->opcode & BPF_INSTRUCTION_ALU_S_MASK);
+    uint8_t op = i->opcode & BPF_INSTRUCTION_ALU_OP_MASK;
+    uint8_t reg = i->dst;
+    _value_t bound;
+    _counter_t counter;
+    uint64_t b_min, b_max, x_min, x_max;
+
+    if (i->opcode == BPF_INSTRUCTION_JMP_ALWAYS || (!imm && i->src == i->dst)) {
+        return UINT64_MAX;
+    }
+    if (imm) {
+        _value_set(&bound, _VAL_SCALAR, i->immediate, i->immediate);
+    }
+    else {
+        bound = regs[i->src];
+    }
+    if (!_loop_counter(a, t, j, reg, &counter)) {
+        /* The counter compared second, swap the comparison */
+        if (imm || !_loop_counter(a, t, j, i->src, &counter)) {
+            return UINT64_MAX;
+        }
+        reg = i->src;
+        bound = regs[i->dst];
+        switch (op) {
+        case BPF_INSTRUCTION_BRANCH_JGT:
+            op = BPF_INSTRUCTION_BRANCH_JLT;
+            break;
+        case BPF_INSTRUCTION_BRANCH_JGE:
+            op = BPF_INSTRUCTION_BRANCH_JLE;
+            break;
+        case BPF_INSTRUCTION_BRANCH_JLT:
+            op = BPF_INSTRUCTION_BRANCH_JGT;
+            break;
+        case BPF_INSTRUCTION_BRANCH_JLE:
+            op = BPF_INSTRUCTION_BRANCH_JGE;
+            break;
+        default:
+            break;
+        }
+    }
+    if (!_unsigned_range(&bound, &b_min, &b_max)) {
+        return UINT64_MAX;
+    }
+    x_max = counter.max;
+    if (_unsigned_range(&regs[reg], &x_min, &x_max) && x_max > counter.max) {
+        x_max = counter.max;
+    }
+
+    if (counter.step > 0) {
+        /* Counting up to the bound, which stays below the wrap around */
+        uint64_t step = counter.step;
+        uint64_t limit = op == BPF_INSTRUCTION_BRANCH_JLT ? b_max :
+                         op == BPF_INSTRUCTION_BRANCH_JLE ? b_max + 1 : 0;
+
+        if (limit == 0 || limit - 1 + step > counter.max) {
+            return UINT64_MAX;
+        }
+        return (limit + step - 1) / step;
+    }
+    else {
+        /* Counting down to the bound, which stays above the wrap around */
+        uint64_t step = -(int64_t)counter.step;
+        uint64_t low = op == BPF_INSTRUCTION_BRANCH_JGT ? b_min + 1 :
+                       op == BPF_INSTRUCTION_BRANCH_JGE ? b_min :
+                       op == BPF_INSTRUCTION_BRANCH_JNE && b_max == 0 && step == 1 ? 1 : 0;
+
+        if (low == 0 || low < step) {
+            return UINT64_MAX;
+        }
+        return x_max < low ? 0 : (x_max - low) / step + 1;
+    }
+}
+
+/* Adds the fuel charged by the loop [t, j] running at most trips iterations,
+ * the loops closed before inside it charge theirs on every iteration */
+static void _loop_work(_analysis_t *a, size_t t, size_t j, uint64_t trips)
+{
+    uint64_t work = j - t + 1;
+
+    if (trips > RBPF_LOOP_TRIPS_MAX) {
+        a->unbounded = true;
+        return;
+    }
+    while (a->num_loops && a->loops[a->num_loops - 1].start >= t) {
+        work += a->loops[--a->num_loops].work;
+    }
+    if (trips && work > RBPF_LOOP_WORK_MAX / trips) {
+        a->unbounded = true;
+        return;
+    }
+    if (a->num_loops == ANALYSIS_LOOPS_MAX) {
+        /* The first two merged at the start of the second, a loop around
+         * either counts both */
+        a->loops[1].work += a->loops[0].work;
+        for (unsigned k = 1; k < a->num_loops; k++) {
+            a->loops[k - 1] = a->loops[k];
+        }
+        a->num_loops--;
+    }
+    a->loops[a->num_loops].start = t;
+    a->loops[a->num_loops].work = work * trips;
+    a->num_loops++;
+}
+
+/* Fuel the proven loops charge in a run, UINT64_MAX above RBPF_LOOP_WORK_MAX.
+ * A function runs once per call made by each run of its caller */
+static uint64_t _loops_work(const _analysis_t *a)
+{
+    uint64_t work = 0;
+
+    for (unsigned k = 0; k < a->num_loops; k++) {
+        work += a->loops[k].work;
+    }
+    for (unsigned depth = 1; depth < RBPF_CALL_DEPTH_MAX && work; depth++) {
+        if (work > RBPF_LOOP_WORK_MAX / (a->calls + 1)) {
+            return UINT64_MAX;
+        }
+        work *= a->calls + 1;
+    }
+    return work > RBPF_LOOP_WORK_MAX ? UINT64_MAX : work;
+}
+
+/* Maximum declared for the context field the load reads */
+static bool _ctx_bound(const _analysis_t *a, const _value_t *base, const bpf_instruction_t *i,
+                       uint32_t *max)
+{
+    const rbpf_application_t *rbpf = a->rbpf;
+    int64_t offset = (int64_t)base->min + i->offset;
+
+    if (!a->ctx_bounds || base->kind != _VAL_CTX || base->min != base->max) {
+        return false;
+    }
+    for (size_t k = 0; k < rbpf->ctx_bounds_len; k++) {
+        const rbpf_ctx_bound_t *bound = &rbpf->ctx_bounds[k];
+
+        if (bound->offset == offset && bound->size == _mem_size(i) && bound->max <= INT32_MAX) {
+            *max = bound->max;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* The value may be an address in the context. Stack and data addresses are
+ * not, the context must not overlap them */
+static bool _may_be_ctx(const _value_t *v)
+{
+    return v->kind != _VAL_STACK && v->kind != _VAL_DATA && v->kind != _VAL_RODATA;
+}
+
+/* The store may change a declared context field */
+static bool _store_ctx_bound(const _analysis_t *a, const _value_t *base,
+                             const bpf_instruction_t *i)
+{
+    const rbpf_application_t *rbpf = a->rbpf;
+    int64_t start = (int64_t)base->min + i->offset;
+    int64_t end = (int64_t)base->max + i->offset + _mem_size(i);
+
+    if (base->kind != _VAL_CTX) {
+        return _may_be_ctx(base);
+    }
+    for (size_t k = 0; k < rbpf->ctx_bounds_len; k++) {
+        const rbpf_ctx_bound_t *bound = &rbpf->ctx_bounds[k];
+
+        if (start < bound->offset + bound->size && end > bound->offset) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* The external function may change a declared context field, only the
+ * functions of the virtual machine are known to write nothing else than the
+ * memory of their arguments */
+static bool _call_ctx_bound(const _value_t *regs, int32_t num)
 {
     switch (num) {
+    case BPF_FUNC_BPF_STORE_LOCAL:
+    case BPF_FUNC_BPF_STORE_GLOBAL:
+    case BPF_FUNC_BPF_MEMCMP:
+    case BPF_FUNC_BPF_MEMCHR:
+        return false;
+    case BPF_FUNC_BPF_FETCH_LOCAL:
+    case BPF_FUNC_BPF_FETCH_GLOBAL:
+        return _may_be_ctx(&regs[2]);
+    case BPF_FUNC_BPF_MEMCPY:
+    case BPF_FUNC_BPF_MEMSET:
+        return _may_be_ctx(&regs[1]);
     default:
-        return rbpf_get_external_call(num) ? true : false;
+        return true;
+    }
+}
+
+/* Walk the application once, in order. Marks the proven accesses when mark is set */
+static void _analysis_pass(rbpf_application_t *rbpf, _analysis_t *a, bool mark)
+{
+    _state_t cur;
+    bool live = true;
+
+    _state_unknown(a, &cur);
+    for (unsigned r = 0; r < 10; r++) {
+        _value_set(&cur.regs[r], _VAL_SCALAR, 0, 0);
+    }
+    _value_set(&cur.regs[1], _VAL_CTX, 0, 0);
+    _value_set(&cur.regs[10], _VAL_STACK, RBPF_STACK_SIZE, RBPF_STACK_SIZE);
+    cur.regs[1].zext = _value_zext(a, &cur.regs[1]);
+    cur.regs[10].zext = _value_zext(a, &cur.regs[10]);
+    cur.ctx_written = false;
+
+    const rbpf_function_t *functions = rbpf_application_functions(rbpf);
+    for (size_t function = 0; function < rbpf_application_functions_len(rbpf); function++) {
+        _state_merge(a, functions[function].location_offset / sizeof(bpf_instruction_t), &cur);
+    }
+
+    for (size_t pc = 0; pc < a->len; pc++) {
+        const bpf_instruction_t text = _rbpf_text(a->insns, pc);
+        const bpf_instruction_t *i = &text;
+        uint8_t cls = i->opcode & BPF_INSTRUCTION_CLS_MASK;
+        _value_t *regs = cur.regs;
+
+        if (a->insns[pc].flags & RBPF_INSN_TARGET) {
+            int slot = _state_slot(a, pc);
+            if (slot < 0) {
+                if (live) {
+                    _stack_drop(a, regs, 0, 10);
+                }
+                _state_unknown(a, &cur);
+                live = true;
+            }
+            else {
+                if (live) {
+                    _state_merge(a, pc, &cur);
+                }
+                live = a->reached[slot];
+                cur = a->states[slot];
+            }
+        }
+        if (!live) {
+            continue;
+        }
+#if (RBPF_ENABLE_REG32)
+        if (mark && a->reg32 && !_reg32_insn(regs, i)) {
+            a->reg32 = false;
+        }
+#endif
+
+        if (_rbpf_is_lddw(i->opcode)) {
+            const rbpf_insn_t *insn = &a->insns[pc];
+            uint32_t high = (uint32_t)insn[1].immediate;
+            uint8_t kind = insn->flags & RBPF_INSN_DATA ? _VAL_DATA :
+                           insn->flags & RBPF_INSN_RODATA ? _VAL_RODATA : _VAL_SCALAR;
+            /* Offset of the folded addresses in their section */
+            int64_t value = kind == _VAL_DATA ?
+                            insn->immediate - (intptr_t)rbpf_application_data(rbpf) :
+                            kind == _VAL_RODATA ?
+                            insn->immediate - (intptr_t)rbpf_application_rodata(rbpf) :
+                            (int64_t)((uint32_t)insn->immediate);
+            _value_set(&regs[i->dst], high ? _VAL_UNKNOWN : kind, value, value);
+            regs[i->dst].zext = (uint64_t)insn->immediate <= UINT32_MAX;
+            pc++;
+            continue;
+        }
+
+        bool zext = _zext_result(regs, i);
+        /* A stack address the instruction makes something else of */
+        bool stack_in = false;
+
+        if (cls == BPF_INSTRUCTION_CLS_ALU64 || cls == BPF_INSTRUCTION_CLS_ALU32) {
+            bool mov = (i->opcode & BPF_INSTRUCTION_ALU_OP_MASK) == BPF_INSTRUCTION_ALU_MOV;
+            stack_in = (!mov && regs[i->dst].kind == _VAL_STACK) ||
+                       ((i->opcode & BPF_INSTRUCTION_ALU_S_MASK) &&
+                        regs[i->src].kind == _VAL_STACK);
+        }
+        else if (cls == BPF_INSTRUCTION_CLS_STX && regs[i->src].kind == _VAL_STACK) {
+            a->stack_lost = true;
+        }
+
+        switch (cls) {
+        case BPF_INSTRUCTION_CLS_ALU64:
+            _transfer_alu64(regs, i);
+            break;
+        case BPF_INSTRUCTION_CLS_ALU32:
+            _transfer_alu32(regs, i);
+            break;
+        case BPF_INSTRUCTION_CLS_LDX: {
+            uint32_t max;
+
+            if (mark) {
+                _mark_mem(rbpf, a, regs, i, pc);
+            }
+            if (!cur.ctx_written && _ctx_bound(a, &regs[i->src], i, &max)) {
+                _value_set(&regs[i->dst], _VAL_SCALAR, 0, max);
+                break;
+            }
+            switch (i->opcode & BPF_INSTRUCTION_MEM_SZ_MASK) {
+            case 0x10:
+                _value_set(&regs[i->dst], _VAL_SCALAR, 0, UINT8_MAX);
+                break;
+            case 0x08:
+                _value_set(&regs[i->dst], _VAL_SCALAR, 0, UINT16_MAX);
+                break;
+            default:
+                _value_set(&regs[i->dst], _VAL_UNKNOWN, 0, 0);
+                break;
+            }
+            break;
+        }
+        case BPF_INSTRUCTION_CLS_ST:
+        case BPF_INSTRUCTION_CLS_STX:
+            if (mark) {
+                _mark_mem(rbpf, a, regs, i, pc);
+            }
+            if (a->ctx_bounds && _store_ctx_bound(a, &regs[i->dst], i)) {
+                cur.ctx_written = true;
+            }
+            /* The previous value loaded by an atomic, zero extended for a word */
+            if (_rbpf_is_atomic(i->opcode) && _rbpf_atomic_fetch_reg(i) >= 0) {
+                _value_t *fetched = &regs[_rbpf_atomic_fetch_reg(i)];
+
+                _value_set(fetched, _VAL_UNKNOWN, 0, 0);
+                fetched->zext = i->opcode == BPF_INSTRUCTION_MEM_ATOMICW;
+            }
+            break;
+        case BPF_INSTRUCTION_CLS_BRANCH:
+            if (mark && _rbpf_is_jump(i->opcode) && i->offset < 0) {
+                _loop_work(a, pc + 1 + i->offset, pc, _loop_trips(a, regs, i, pc));
+            }
+            if (i->opcode == BPF_INSTRUCTION_RETURN) {
+                live = false;
+            }
+            else if (i->opcode == BPF_INSTRUCTION_CALL &&
+                     i->src == BPF_INSTRUCTION_CALL_LOCAL_SRC) {
+                /* The called function starts from unknown arguments, r6-r9
+                 * and r10 are back to their value on its return */
+                _state_t callee;
+
+                if (mark) {
+                    a->calls++;
+                }
+                _state_unknown(a, &callee);
+                _state_merge(a, pc + 1 + i->immediate, &callee);
+                _stack_drop(a, regs, 0, 6);
+                for (unsigned r = 0; r < 6; r++) {
+                    _value_set(&regs[r], _VAL_UNKNOWN, 0, 0);
+                }
+                /* Through the context address it may have been given */
+                cur.ctx_written = true;
+            }
+            else if (i->opcode == BPF_INSTRUCTION_CALL) {
+                if (a->ctx_bounds && _call_ctx_bound(regs, i->immediate)) {
+                    cur.ctx_written = true;
+                }
+                /* The external functions access the stack from the
+                 * addresses they get onwards */
+                for (unsigned r = 1; r < 6; r++) {
+                    if (mark && regs[r].kind == _VAL_STACK && regs[r].min < a->stack_low) {
+                        a->stack_low = regs[r].min < 0 ? 0 : regs[r].min;
+                    }
+                }
+                _stack_drop(a, regs, 6, 10);
+                for (unsigned r = 0; r < 10; r++) {
+                    _value_set(&regs[r], _VAL_UNKNOWN, 0, 0);
+                }
+            }
+            else if (i->opcode == BPF_INSTRUCTION_JMP_ALWAYS) {
+                _state_merge(a, pc + 1 + i->offset, &cur);
+                live = false;
+            }
+            else if (i->opcode == BPF_INSTRUCTION_JMP_TABLE) {
+                /* No loop through a table is bounded */
+                const rbpf_insn_t *insn = &a->insns[pc];
+
+                for (size_t entry = 0; entry < _rbpf_table_len(insn); entry++) {
+                    if (mark && insn->table[entry] <= pc) {
+                        a->unbounded = true;
+                    }
+                    _state_merge(a, insn->table[entry], &cur);
+                }
+                live = false;
+            }
+            else {
+                bool imm = !(i->opcode & BPF_INSTRUCTION_ALU_S_MASK);
+                const _value_t *src = &regs[i->src];
+                _state_t taken = cur;
+
+                if (imm || (src->kind == _VAL_SCALAR && src->min == src->max)) {
+                    _value_t t, f;
+                    _refine(&regs[i->dst], i->opcode & BPF_INSTRUCTION_ALU_OP_MASK,
+                            imm ? i->immediate : src->min, &t, &f);
+                    taken.regs[i->dst] = t;
+                    regs[i->dst] = f;
+                    if (f.kind == _VAL_EMPTY) {
+                        live = false;
+                    }
+                }
+                if (taken.regs[i->dst].kind != _VAL_EMPTY) {
+                    _state_merge(a, pc + 1 + i->offset, &taken);
+                }
+            }
+            break;
+        default:
+            break;
+        }
+        if (stack_in && regs[i->dst].kind != _VAL_STACK) {
+            a->stack_lost = true;
+        }
+        if (cls == BPF_INSTRUCTION_CLS_ALU64 || cls == BPF_INSTRUCTION_CLS_ALU32 ||
+            cls == BPF_INSTRUCTION_CLS_LDX) {
+            regs[i->dst].zext = zext || _value_zext(a, &regs[i->dst]);
+        }
+    }
+}
+
+/* Passes over the application before giving up on the analysis */
+#define ANALYSIS_PASSES_MAX    (16)
+
+static void _rbpf_analyze(rbpf_application_t *rbpf, size_t len)
+{
+    _analysis_t a = {
+        .rbpf = rbpf,
+        .insns = rbpf->insns,
+        .len = len,
+        .data_len = rbpf_application_data_len(rbpf),
+        .rodata_len = rbpf_application_rodata_len(rbpf),
+        .r10_fixed = true,
+        .r10_min = (rbpf->flags & RBPF_FLAG_CALLS) ?
+                   RBPF_STACK_SIZE - (RBPF_CALL_DEPTH_MAX - 1) * RBPF_CALL_FRAME_SIZE :
+                   RBPF_STACK_SIZE,
+#if (RBPF_ENABLE_REG32)
+        .reg32 = true,
+#endif
+        .stack_low = RBPF_STACK_SIZE,
+        .ctx_bounds = rbpf->ctx_bounds_len > 0,
+    };
+    unsigned passes = 0;
+
+    /* The entry of every function starts from the initial state */
+    const rbpf_function_t *functions = rbpf_application_functions(rbpf);
+    for (size_t function = 0; function < rbpf_application_functions_len(rbpf); function++) {
+        size_t entry = functions[function].location_offset / sizeof(bpf_instruction_t);
+
+        if (a.num_states < RBPF_ANALYSIS_STATES && _state_slot(&a, entry) < 0) {
+            a.pcs[a.num_states++] = entry;
+        }
+    }
+
+    for (size_t pc = 0; pc < len; pc++) {
+        const bpf_instruction_t text = _rbpf_text(a.insns, pc);
+        const bpf_instruction_t *i = &text;
+        uint8_t cls = i->opcode & BPF_INSTRUCTION_CLS_MASK;
+
+        if (i->dst == 10 && (cls == BPF_INSTRUCTION_CLS_ALU32 || cls == BPF_INSTRUCTION_CLS_ALU64 ||
+                             cls == BPF_INSTRUCTION_CLS_LDX || _rbpf_is_lddw(i->opcode))) {
+            a.r10_fixed = false;
+        }
+        if (_rbpf_is_lddw(i->opcode)) {
+            pc++;
+        }
+        else if (_rbpf_is_jump(i->opcode) && a.num_states < RBPF_ANALYSIS_STATES &&
+            _state_slot(&a, pc + 1 + i->offset) < 0) {
+            a.pcs[a.num_states++] = pc + 1 + i->offset;
+        }
+        else if (a.insns[pc].handler == RBPF_HANDLER_JMP_TABLE) {
+            const rbpf_insn_t *insn = &a.insns[pc];
+
+            for (size_t entry = 0; entry < _rbpf_table_len(insn); entry++) {
+                if (a.num_states < RBPF_ANALYSIS_STATES && _state_slot(&a, insn->table[entry]) < 0) {
+                    a.pcs[a.num_states++] = insn->table[entry];
+                }
+            }
+        }
+    }
+
+    /* A written r10 points anywhere in the stack */
+    a.stack_lost = !a.r10_fixed;
+
+    do {
+        if (++passes > ANALYSIS_PASSES_MAX) {
+            return;
+        }
+        /* Only the first pass may grow the ranges, the next ones widen */
+        a.widen = passes > 1;
+        a.changed = false;
+        _analysis_pass(rbpf, &a, false);
+    } while (a.changed);
+
+    _analysis_pass(rbpf, &a, true);
+#if (RBPF_ENABLE_REG32)
+    if (a.reg32) {
+        rbpf->flags |= RBPF_FLAG_REG32;
+    }
+#endif
+    if (!a.unbounded && _loops_work(&a) <= RBPF_LOOP_WORK_MAX) {
+        rbpf->flags |= RBPF_FLAG_TERMINATES;
+    }
+    if (!a.stack_lost) {
+        /* Rounded up to keep r10 aligned */
+        rbpf->stack_depth = (RBPF_STACK_SIZE - a.stack_low + 7) & ~7;
+    }
+}
+#endif /* RBPF_ENABLE_RANGE_ANALYSIS */
+
+#if (RBPF_ENABLE_FUSION)
+/* Number of instructions run by every fused handler */
+#define FUSED_LEN(name, first, len) [RBPF_HANDLER_ ## name] = len,
+static const uint8_t _rbpf_fused_len[RBPF_HANDLER_COUNT] = {
+    RBPF_FUSED_HANDLERS(FUSED_LEN)
+};
+#undef FUSED_LEN
+
+static bool _fusable(const rbpf_insn_t *insn, uint8_t handler, uint8_t dst)
+{
+    return insn->handler == handler && insn->dst == dst;
+}
+
+static bool _shift32(const rbpf_insn_t *insn, uint8_t handler, uint8_t dst)
+{
+    return _fusable(insn, handler, dst) && insn->immediate == 32;
+}
+
+/* Handler running the longest sequence starting at i[0] out of the left
+ * instructions, the handler of i[0] if none matches */
+static uint8_t _fused_handler(const rbpf_insn_t *i, size_t left)
+{
+    uint8_t dst = i->dst;
+
+    if (left >= 3 && _shift32(&i[1], RBPF_HANDLER_ALU64_LSH_IMM, dst)) {
+        bool sext = _shift32(&i[2], RBPF_HANDLER_ALU64_ARSH_IMM, dst);
+        bool zext = _shift32(&i[2], RBPF_HANDLER_ALU64_RSH_IMM, dst);
+
+        if (i->handler == RBPF_HANDLER_ALU64_MOV_REG && (sext || zext)) {
+            return sext ? RBPF_HANDLER_FUSED_MOV_SEXT32 : RBPF_HANDLER_FUSED_MOV_ZEXT32;
+        }
+        if (i->handler == RBPF_HANDLER_MEM_LDXW && sext) {
+            return RBPF_HANDLER_FUSED_LDXW_SEXT32;
+        }
+    }
+    if (i->handler == RBPF_HANDLER_ALU64_LSH_IMM && i->immediate == 32) {
+        if (left >= 3 && _fusable(&i[1], RBPF_HANDLER_ALU64_ADD_REG, dst) &&
+            _shift32(&i[2], RBPF_HANDLER_ALU64_ARSH_IMM, dst)) {
+            return RBPF_HANDLER_FUSED_ADD_SEXT32;
+        }
+        if (left >= 2 && _shift32(&i[1], RBPF_HANDLER_ALU64_RSH_IMM, dst)) {
+            return RBPF_HANDLER_FUSED_ZEXT32;
+        }
+        if (left >= 2 && _shift32(&i[1], RBPF_HANDLER_ALU64_ARSH_IMM, dst)) {
+            return RBPF_HANDLER_FUSED_SEXT32;
+        }
+    }
+    /* The stored register is the loaded one */
+    if (left >= 2 && i->handler == RBPF_HANDLER_MEM_LDXB &&
+        i[1].handler == RBPF_HANDLER_MEM_STXB && i[1].src == dst) {
+        return RBPF_HANDLER_FUSED_LDXB_STXB;
+    }
+    if (left >= 2 && i->handler == RBPF_HANDLER_ALU64_ADD_IMM) {
+#define FUSED_JMP_CASES(OPCODE) \
+    case RBPF_HANDLER_JMP_ ## OPCODE ## _REG: \
+        return RBPF_HANDLER_FUSED_ADD_JMP_ ## OPCODE ## _REG; \
+    case RBPF_HANDLER_JMP_ ## OPCODE ## _IMM: \
+        return RBPF_HANDLER_FUSED_ADD_JMP_ ## OPCODE ## _IMM;
+
+        switch (i[1].handler) {
+        FUSED_JMP_CASES(EQ)
+        FUSED_JMP_CASES(GT)
+        FUSED_JMP_CASES(GE)
+        FUSED_JMP_CASES(LT)
+        FUSED_JMP_CASES(LE)
+        FUSED_JMP_CASES(SET)
+        FUSED_JMP_CASES(NE)
+        FUSED_JMP_CASES(SGT)
+        FUSED_JMP_CASES(SGE)
+        FUSED_JMP_CASES(SLT)
+        FUSED_JMP_CASES(SLE)
+        default:
+            break;
+        }
+#undef FUSED_JMP_CASES
+    }
+    return i->handler;
+}
+
+/* Replace the handler of the first instruction of the sequences with a fused
+ * handler. The other instructions keep their own handler, a jump landing on
+ * them runs the rest of the sequence unfused. Runs after the range analysis,
+ * proven memory accesses are not fused */
+static void _rbpf_fuse(rbpf_insn_t *insns, size_t len)
+{
+    for (size_t pc = 0; pc < len; pc++) {
+        uint8_t handler = _fused_handler(&insns[pc], len - pc);
+
+        if (handler != insns[pc].handler) {
+            insns[pc].handler = handler;
+            pc += _rbpf_fused_len[handler] - 1;
+        }
+    }
+}
+#endif /* RBPF_ENABLE_FUSION */
+
+static uint64_t _rbpf_sections_len(const rbpf_header_t *header)
+{
+    return sizeof(rbpf_header_t) + (uint64_t)header->data_len + header->rodata_len +
+           header->text_len + (uint64_t)header->functions * sizeof(rbpf_function_t);
+}
+
+/* First instruction after the function starting at pc */
+static size_t _rbpf_function_end(const rbpf_insn_t *insns, size_t len, size_t pc)
+{
+    while (++pc < len && !(insns[pc].flags & RBPF_INSN_FUNCTION)) {}
+    return pc;
+}
+
+/* Most frames the local call at insns[pc] adds, from the ones of the calls of
+ * the called function */
+static int64_t _rbpf_call_frames(const rbpf_insn_t *insns, size_t len, size_t pc)
+{
+    size_t start = insns[pc].target - insns;
+    size_t end = _rbpf_function_end(insns, len, start);
+    int64_t frames = 1;
+
+    for (pc = start; pc < end; pc++) {
+        if (insns[pc].handler == RBPF_HANDLER_CALL_LOCAL && insns[pc].immediate >= frames) {
+            frames = insns[pc].immediate + 1;
+        }
     }
+    return frames;
 }
 
+/* Checks of the applications making local calls, the functions start at the
+ * instructions flagged RBPF_INSN_FUNCTION */
+static int _rbpf_check_functions(rbpf_insn_t *insns, size_t len)
+{
+    static const uint8_t sizes[] = { 4, 2, 1, 8 };
+    size_t start = 0;
+    size_t end = _rbpf_function_end(insns, len, 0);
+
+    for (size_t pc = 0; pc < len; pc++) {
+        const rbpf_insn_t *insn = &insns[pc];
+        uint8_t opcode = _rbpf_handler_opcodes[insn->handler];
+        uint8_t cls = opcode & BPF_INSTRUCTION_CLS_MASK;
+
+        if (pc == end) {
+            /* No function continues into the next one */
+            uint8_t last = insns[pc - 1].handler;
+            if (last != RBPF_HANDLER_RETURN && last != RBPF_HANDLER_JMP_ALWAYS &&
+                last != RBPF_HANDLER_JMP_TABLE) {
+                return RBPF_ILLEGAL_CALL;
+            }
+            start = pc;
+            end = _rbpf_function_end(insns, len, pc);
+        }
+
+        /* r10 is the end of the frame of the function */
+        if (insn->dst == 10 && (cls == BPF_INSTRUCTION_CLS_ALU32 ||
+                                cls == BPF_INSTRUCTION_CLS_ALU64 ||
+                                cls == BPF_INSTRUCTION_CLS_LDX ||
+                                insn->handler == RBPF_HANDLER_MEM_LDDW)) {
+            return RBPF_ILLEGAL_REGISTER;
+        }
+        if (((cls == BPF_INSTRUCTION_CLS_LDX && insn->src == 10) ||
+             ((cls == BPF_INSTRUCTION_CLS_ST || cls == BPF_INSTRUCTION_CLS_STX) &&
+              insn->dst == 10)) &&
+            (insn->offset < -RBPF_CALL_FRAME_SIZE ||
+             insn->offset + sizes[(opcode & BPF_INSTRUCTION_MEM_SZ_MASK) >> 3] > 0)) {
+            return RBPF_ILLEGAL_MEM;
+        }
+
+        if (insn->handler == RBPF_HANDLER_MEM_LDDW) {
+            pc++;
+        }
+        else if (_rbpf_is_jump(opcode) &&
+                 (insn->target < &insns[start] || insn->target >= &insns[end])) {
+            return RBPF_ILLEGAL_JUMP;
+        }
+        else if (insn->handler == RBPF_HANDLER_JMP_TABLE) {
+            for (size_t entry = 0; entry < _rbpf_table_len(insn); entry++) {
+                if (insn->table[entry] < start || insn->table[entry] >= end) {
+                    return RBPF_ILLEGAL_JUMP;
+                }
+            }
+        }
+        else if (insn->handler == RBPF_HANDLER_CALL_LOCAL) {
+            /* The immediate counts the frames the call adds from now on */
+            insns[pc].immediate = 1;
+        }
+    }
+
+    /* Every pass makes the frames of the calls one call deeper exact, more
+     * passes than the depth only keep growing them on recursive calls */
+    for (unsigned pass = 0; pass < RBPF_CALL_DEPTH_MAX; pass++) {
+        for (size_t pc = 0; pc < len; pc++) {
+            if (insns[pc].handler == RBPF_HANDLER_CALL_LOCAL) {
+                insns[pc].immediate = _rbpf_call_frames(insns, len, pc);
+                if (insns[pc].immediate > RBPF_CALL_DEPTH_MAX - 1) {
+                    return RBPF_ILLEGAL_CALL;
+                }
+            }
+        }
+    }
+    return RBPF_OK;
+}
 
 int rbpf_application_verify_preflight(rbpf_application_t *rbpf)
 {
-    const bpf_instruction_t *application = rbpf_application_text(rbpf);
+    const uint8_t *text = rbpf_application_text(rbpf);
     size_t length = rbpf_application_text_len(rbpf);
+    bool compressed = rbpf_header(rbpf)->flags & RBPF_HEADER_COMPRESSED;
+    rbpf_insn_t *insns = rbpf->insns;
+    size_t num_instructions = 0;
 
     if (rbpf->flags & RBPF_FLAG_PREFLIGHT_DONE) {
         return RBPF_OK;
     }
 
-    if (length & 0x7) {
+    rbpf->flags &= ~RBPF_FLAG_CALLS;
+    if ((!compressed && (length & 0x7)) || length == 0) {
+        return RBPF_ILLEGAL_LEN;
+    }
+
+    /* The sections must fit in the application, which isn't necessarily a
+     * buffer sized after them when executed in place */
+    if (_rbpf_sections_len(rbpf_header(rbpf)) > rbpf->application_len) {
         return RBPF_ILLEGAL_LEN;
     }
 
+    for (size_t pos = 0; pos < length; ) {
+        bpf_instruction_t i[2];
+        int len = _rbpf_fetch(text + pos, length - pos, compressed, i);
+        size_t pc = num_instructions;
+        rbpf_insn_t *insn = &insns[pc];
+
+        if (len < 0) {
+            return len;
+        }
+        pos += len;
+        num_instructions += _rbpf_is_lddw(i->opcode) ? 2 : 1;
+
+        /* Not enough room for the pre-decoded application */
+        if (num_instructions > rbpf->insns_len) {
+            return RBPF_ILLEGAL_LEN;
+        }
 
-    for (const bpf_instruction_t *i = application;
-         i < (bpf_instruction_t *)((uint8_t *)application + length); i++) {
         /* Check if register values are valid */
         if (i->dst >= 11 || i->src >= 11) {
             return RBPF_ILLEGAL_REGISTER;
         }
 
+        insn->handler = _rbpf_opcode_handlers[i->opcode];
+        insn->dst = i->dst;
+        insn->src = i->src;
+        insn->flags = 0;
+        insn->offset = i->offset;
+        insn->immediate = i->immediate;
+
         /* Double length instruction */
-        if (i->opcode == 0x18) {
-            i++;
+        if (_rbpf_is_lddw(i->opcode)) {
+            insn->handler = RBPF_HANDLER_MEM_LDDW;
+            insn->immediate = _rbpf_lddw_immediate(rbpf, i);
+            if (i->opcode == BPF_INSTRUCTION_MEM_LDDWD) {
+                insn->flags = RBPF_INSN_DATA;
+            }
+            else if (i->opcode == BPF_INSTRUCTION_MEM_LDDWR) {
+                insn->flags = RBPF_INSN_RODATA;
+            }
+
+            /* The second half is never executed, unless jumped to. It keeps
+             * the upper half of the immediate for the range analysis */
+            insns[pc + 1] = (rbpf_insn_t){
+                .handler = RBPF_HANDLER_ILLEGAL,
+                .immediate = i[1].immediate,
+            };
             continue;
         }
 
         /* Only instruction-specific checks here */
-        if ((i->opcode & BPF_INSTRUCTION_CLS_MASK) == BPF_INSTRUCTION_CLS_BRANCH) {
-            intptr_t target = (intptr_t)(i + i->offset);
-            /* Check if the jump target is within bounds. The address is
-             * incremented after the jump by the regular PC increase */
-            if ((target >= (intptr_t)((uint8_t *)application + length))
-                || (target < (intptr_t)application)) {
+        if (_rbpf_is_byteswap(i->opcode)) {
+            insn->handler = _rbpf_byteswap_handler(i);
+            if (insn->handler == RBPF_HANDLER_ILLEGAL) {
+                return RBPF_ILLEGAL_INSTRUCTION;
+            }
+        }
+        else if (_rbpf_is_atomic(i->opcode)) {
+            insn->handler = _rbpf_atomic_handler(i);
+            if (insn->handler == RBPF_HANDLER_ILLEGAL) {
+                return RBPF_ILLEGAL_INSTRUCTION;
+            }
+            /* The previous value can't replace the stack frame pointer */
+            if (_rbpf_atomic_fetch_reg(i) == 10) {
+                return RBPF_ILLEGAL_REGISTER;
+            }
+        }
+        else if (i->opcode == BPF_INSTRUCTION_CALL && i->src == BPF_INSTRUCTION_CALL_LOCAL_SRC) {
+            if (RBPF_CALL_DEPTH_MAX < 2) {
+                return RBPF_ILLEGAL_CALL;
+            }
+            insn->handler = RBPF_HANDLER_CALL_LOCAL;
+            rbpf->flags |= RBPF_FLAG_CALLS;
+        }
+        else if (i->opcode == BPF_INSTRUCTION_JMP_TABLE) {
+            /* Read in place, the number of entries first, the entries are
+             * checked once all the instructions are known */
+            uint64_t offset = (uint32_t)i->immediate;
+            size_t rodata_len = rbpf_application_rodata_len(rbpf);
+
+            if (offset + sizeof(uint32_t) > rodata_len) {
+                return RBPF_ILLEGAL_JUMP;
+            }
+            const uint32_t *table =
+                (const uint32_t *)((const uint8_t *)rbpf_application_rodata(rbpf) + offset);
+            if (((uintptr_t)table & 0x3) ||
+                ((uint64_t)table[0] + 2) * sizeof(uint32_t) > rodata_len - offset) {
                 return RBPF_ILLEGAL_JUMP;
             }
+            insn->table = table + 1;
+            insn->immediate = table[0];
+        }
+        else if (i->opcode == BPF_INSTRUCTION_CALL && i->immediate == BPF_FUNC_BPF_TAIL_CALL) {
+            insn->handler = RBPF_HANDLER_TAIL_CALL;
+        }
+        else if (i->opcode == BPF_INSTRUCTION_CALL) {
+            insn->call = _rbpf_get_call(i->immediate);
+            if (!insn->call) {
+                return RBPF_ILLEGAL_CALL;
+            }
         }
+    }
 
-        if (i->opcode == (BPF_INSTRUCTION_BRANCH_CALL | BPF_INSTRUCTION_CLS_BRANCH)) {
-            if (!_rbpf_check_call(i->immediate)) {
+    /* Resolve the jumps once the number of instructions is known. The target
+     * is relative to the instruction following the jump, in bytes in the
+     * compressed text */
+    for (size_t pc = 0, at = 0; pc < num_instructions; pc++) {
+        rbpf_insn_t *insn = &insns[pc];
+        uint8_t opcode = _rbpf_handler_opcodes[insn->handler];
+        size_t len = _rbpf_compressed_len(opcode);
+        intptr_t target = (intptr_t)pc + 1 + insn->offset;
+
+        if (compressed && _rbpf_is_jump(opcode)) {
+            target = _rbpf_compressed_pc(insns, num_instructions, pc + 1, at + len,
+                                         at + len + insn->offset);
+        }
+        at += len;
+        if (insn->handler == RBPF_HANDLER_MEM_LDDW) {
+            pc++;
+        }
+        else if (_rbpf_is_jump(opcode)) {
+            if ((target >= (intptr_t)num_instructions) || (target < 0)) {
+                return RBPF_ILLEGAL_JUMP;
+            }
+            insn->target = &insns[target];
+            insns[target].flags |= RBPF_INSN_TARGET;
+        }
+        else if (insn->handler == RBPF_HANDLER_JMP_TABLE) {
+            for (size_t entry = 0; entry < _rbpf_table_len(insn); entry++) {
+                if (insn->table[entry] >= num_instructions) {
+                    return RBPF_ILLEGAL_JUMP;
+                }
+                insns[insn->table[entry]].flags |= RBPF_INSN_TARGET;
+            }
+        }
+        else if (insn->handler == RBPF_HANDLER_CALL_LOCAL) {
+            /* Counted in instructions, also in the compressed text */
+            target = (intptr_t)pc + 1 + insn->immediate;
+            if ((target >= (intptr_t)num_instructions) || (target < 0)) {
                 return RBPF_ILLEGAL_CALL;
             }
+            insn->target = &insns[target];
+            insns[target].flags |= RBPF_INSN_TARGET | RBPF_INSN_FUNCTION;
         }
     }
 
-    size_t num_instructions = length / sizeof(bpf_instruction_t);
+    /* The functions start on an instruction, at their offset in the
+     * uncompressed text, and their name is in the read-only data */
+    const rbpf_function_t *functions = rbpf_application_functions(rbpf);
+    for (size_t function = 0; function < rbpf_application_functions_len(rbpf); function++) {
+        size_t entry = functions[function].location_offset / sizeof(bpf_instruction_t);
+
+        if ((functions[function].location_offset % sizeof(bpf_instruction_t)) ||
+            entry >= num_instructions) {
+            return RBPF_ILLEGAL_JUMP;
+        }
+        if (functions[function].name_offset >= rbpf_application_rodata_len(rbpf)) {
+            return RBPF_ILLEGAL_LEN;
+        }
+        insns[entry].flags |= RBPF_INSN_TARGET;
+    }
 
     /* Check if the last instruction is a return instruction */
-    if (application[num_instructions - 1].opcode != 0x95 &&
+    if (insns[num_instructions - 1].handler != RBPF_HANDLER_RETURN &&
         !(rbpf->flags & RBPF_CONFIG_NO_RETURN)) {
         return RBPF_NO_RETURN;
     }
+
+    if (rbpf->flags & RBPF_FLAG_CALLS) {
+        int res = _rbpf_check_functions(insns, num_instructions);
+        if (res < 0) {
+            return res;
+        }
+    }
+
+    rbpf->num_insns = num_instructions;
+    rbpf->ctx_len_min = 0;
+    rbpf->stack_depth = RBPF_STACK_SIZE;
+    rbpf->flags &= ~(RBPF_FLAG_REG32 | RBPF_FLAG_TERMINATES);
+#if (RBPF_ENABLE_RANGE_ANALYSIS)
+    _rbpf_analyze(rbpf, num_instructions);
+#endif
+#if (RBPF_ENABLE_FUSION)
+    _rbpf_fuse(insns, num_instructions);
+#endif
     rbpf->flags |= RBPF_FLAG_PREFLIGHT_DONE;
     return RBPF_OK;
 }
@@ -255,6 +255,15 @@ static const void **user_syscall_table;
 
 static int *syscall_result_ptr;
 
+/**
+ * @internal
+ *
+ * @brief Bounds of the free RAM left by CRT0 after the
+ * relocation of the program
+ */
+static void *free_ram_start;
+static void *free_ram_end;
+
 /**
  * @brief Wrapper that branches to the xipfs_exit(3) function
  *
@@ -512,6 +521,19 @@ extern void *memset(void *m, int c, size_t n) {
     return res;
 }
 
+/**
+ * @brief Returns the free RAM left to the program
+ *
+ * @param size Receives the size of the free RAM in bytes
+ *
+ * @return The start address of the free RAM
+ */
+extern void *get_free_ram(size_t *size)
+{
+    *size = (size_t)((uintptr_t)free_ram_end - (uintptr_t)free_ram_start);
+    return free_ram_start;
+}
+
 /**
  * @internal
  *
@@ -539,6 +561,10 @@ int start(crt0_ctx_t *crt0_ctx)
         syscall_result_ptr  = NULL;
     }
 
+    /* keep track of the RAM left after the relocation */
+    free_ram_start = crt0_ctx->ram_start;
+    free_ram_end   = crt0_ctx->ram_end;
+
     /* initialize the arguments passed to the program */
     argc = crt0_ctx->argc;
     argv = crt0_ctx->argv;
@@ -56,4 +56,6 @@ extern int get_file_size(const char *name, size_t *size);
 
 extern void *memset(void *m, int c, size_t n);
 
+extern void *get_free_ram(size_t *size);
+
 #endif /* STDRIOT_H */
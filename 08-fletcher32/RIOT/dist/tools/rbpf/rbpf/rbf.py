@@ -23,6 +23,22 @@ RELOCATIONS = ".rel.text"
 
 COMPRESSED = 0x01
 
+# Comparisons of a register to a constant a switch is made of, only unsigned
+# ones and equalities, so that every value past the largest constant ends at
+# the same instruction
+SWITCH_COMPARISONS = {
+    instructions.EqBranchImmInstruction.OPCODE: lambda a, b: a == b,
+    instructions.NeBranchImmInstruction.OPCODE: lambda a, b: a != b,
+    instructions.GtBranchImmInstruction.OPCODE: lambda a, b: a > b,
+    instructions.GeBranchImmInstruction.OPCODE: lambda a, b: a >= b,
+    instructions.LtBranchImmInstruction.OPCODE: lambda a, b: a < b,
+    instructions.LeBranchImmInstruction.OPCODE: lambda a, b: a <= b,
+}
+
+# Switches worth a jump table, and the largest table emitted
+JUMP_TABLE_MIN_COMPARISONS = 3
+JUMP_TABLE_MAX_ENTRIES = 256
+
 
 class Symbol(object):
     def __init__(self, location, name, instruction=None):
@@ -54,7 +70,7 @@ class RBF(object):
         _round_len(self.data)
         _round_len(self.rodata)
 
-        if (len(text) % 8) != 0:
+        if not compressed and (len(text) % 8) != 0:
             logging.error(
                 f"Length of the text is not a whole number of instructions: {len(text)}"
             )
@@ -127,6 +143,113 @@ class RBF(object):
                     print(f"<{symbol.name}>")
                 print(instr.full_print())
 
+        tables = [
+            instr
+            for instr in self.instructions
+            if isinstance(instr, instructions.JumpTableInstruction)
+        ]
+        if tables:
+            print()
+            print("jump tables:")
+        for instr in tables:
+            entries = self.jump_table(instr.immediate)
+            targets = ", ".join(hex(entry * 8) for entry in entries[:-1])
+            print(f"\t{hex(instr.address)}: {targets}, default {hex(entries[-1] * 8)}")
+
+    def jump_table(self, offset):
+        """Entries of the jump table at offset in the rodata, the default one last"""
+        (count,) = struct.unpack_from("<I", self.rodata, offset)
+        return list(struct.unpack_from(f"<{count + 1}I", self.rodata, offset + 4))
+
+    @staticmethod
+    def _switch_comparison(instr, register):
+        return (
+            instr is not None
+            and instr.OPCODE in SWITCH_COMPARISONS
+            and instr.dst_register == register
+            and instr.immediate < 0x80000000
+        )
+
+    @staticmethod
+    def _switch_target(by_index, comparisons, first, value):
+        """Instruction the value ends at after the comparisons, None when they loop"""
+        index = first
+        for _ in range(len(comparisons) + 1):
+            if index not in comparisons:
+                return index
+            instr = by_index[index]
+            if SWITCH_COMPARISONS[instr.OPCODE](value, instr.immediate):
+                index += 1 + instr.offset
+            else:
+                index += 1
+        return None
+
+    def lower_switches(self):
+        """
+        Replace the comparisons clang emits for a switch with a jump table, on
+        an application read from an ELF file.
+
+        A switch is a tree of conditional jumps comparing a register to
+        constants, with no other instruction in between. Its first comparison
+        becomes a jump through a table appended to the rodata, with the
+        instruction every value up to the largest constant ends at and the one
+        all the larger values end at. The other comparisons stay in place, the
+        text keeps its layout and the jumps their offsets. The entries are
+        instruction indices, they need no relocation. Returns the number of
+        tables emitted.
+        """
+        by_index = {instr.address // 8: instr for instr in self.instructions}
+        lowered = set()
+        tables = 0
+        for first, instr in sorted(by_index.items()):
+            if first in lowered or not RBF._switch_comparison(instr, instr.dst_register):
+                continue
+            register = instr.dst_register
+            comparisons, todo = set(), [first]
+            while todo:
+                index = todo.pop()
+                node = by_index.get(index)
+                if index in comparisons or not RBF._switch_comparison(node, register):
+                    continue
+                comparisons.add(index)
+                todo += [index + 1, index + 1 + node.offset]
+            if len(comparisons) < JUMP_TABLE_MIN_COMPARISONS:
+                continue
+
+            count = max(by_index[index].immediate for index in comparisons) + 1
+            if count > JUMP_TABLE_MAX_ENTRIES:
+                continue
+            entries = [
+                RBF._switch_target(by_index, comparisons, first, value)
+                for value in range(count + 1)
+            ]
+            if None in entries:
+                continue
+
+            # Appended after the rounded rodata, the table stays 4 bytes aligned
+            offset = len(self.rodata)
+            self.rodata += struct.pack(f"<{count + 2}I", count, *entries)
+            struct.pack_into(
+                "<BBhi",
+                self.text,
+                first * 8,
+                instructions.JumpTableInstruction.OPCODE,
+                register,
+                0,
+                offset,
+            )
+            lowered |= comparisons
+            tables += 1
+            logging.info(
+                f"Replacing the {len(comparisons)} comparisons of r{register} at "
+                f"{hex(first * 8)} with a table of {count} entries at {offset}"
+            )
+
+        if len(self.rodata) % 8:
+            self.rodata += bytes(8 - len(self.rodata) % 8)
+        self.instructions = instructions.parse_text(self.text)
+        return tables
+
     def format(self):
         if not self.header:
             self.header = HEADER(
@@ -159,7 +282,10 @@ class RBF(object):
                 len(compressed_text),
                 len(self.symbols),
             )
-        data = bytearray(HEADER_STRUCT.pack(*self.header))
+        header = self.header._replace(
+            flags=self.header.flags | COMPRESSED, text_len=len(compressed_text)
+        )
+        data = bytearray(HEADER_STRUCT.pack(*header))
         data += self.data
         data += self.rodata
         data += compressed_text
@@ -196,12 +322,30 @@ class RBF(object):
         elif section == DATA:
             return instructions.LDDWD_OPCODE
 
+    @staticmethod
+    def _patch_call(text, symbol, location):
+        # Call of a global function: the immediate becomes the offset of the
+        # function from the instruction following the call, in instructions
+        call = struct.Struct("<BBhi")
+        opcode, registers, offset, immediate = call.unpack_from(text, location)
+        if symbol.entry.st_info.type != "STT_FUNC":
+            logging.error(f"Call at {hex(location)} of {symbol.name}, not a function")
+            return
+        target = symbol.entry.st_value // 8 + immediate + 1
+        immediate = target - location // 8 - 1
+        logging.info(f"Replacing call at {location} with local call {immediate:+}")
+        registers = (registers & 0x0F) | (instructions.CallInstruction.LOCAL_SRC << 4)
+        text[location : location + 8] = call.pack(opcode, registers, offset, immediate)
+
     @staticmethod
     def _patch_text(text, elffile, relocation):
         entry = relocation.entry
         location = entry.r_offset
         symbols = elffile.get_section_by_name(SYMBOLS)
         symbol = symbols.get_symbol(entry.r_info_sym)
+        if text[location] == instructions.CallInstruction.OPCODE:
+            RBF._patch_call(text, symbol, location)
+            return
         if symbol.entry.st_info.type == "STT_SECTION":
             # refers to an offset in a section
             section_name = elffile.get_section(symbol.entry.st_shndx).name
@@ -265,6 +265,25 @@ class ARSHInstruction(AluInstruction):
     OPCODE = 0xCF
 
 
+class ByteSwapInstruction(AluImmInstruction):
+    """Converts the low 16, 32 or 64 bits, given by the immediate, to an endianness"""
+
+    ENDIAN = "le"
+
+    def asm_print(self):
+        return f"r{self.dst_register} = {self.ENDIAN}{self.immediate} r{self.dst_register}"
+
+
+class LEInstruction(ByteSwapInstruction):
+    ENDIAN = "le"
+    OPCODE = 0xD4
+
+
+class BEInstruction(ByteSwapInstruction):
+    ENDIAN = "be"
+    OPCODE = 0xDC
+
+
 class MemInstruction(Instruction):
 
     COMPRESSED = struct.Struct("<BBh")
@@ -479,6 +498,55 @@ class STBInstruction(StoreInstruction):
     OPCODE = 0x72
 
 
+class AtomicInstruction(MemInstruction):
+    """
+    Atomic read-modify-write on memory, the operation is in the immediate
+    """
+
+    COMPRESSED = struct.Struct("<BBhI")
+
+    FETCH = 0x01
+    OPERATIONS = {0x00: "+", 0x40: "|", 0x50: "&", 0xA0: "^"}
+    FETCH_NAMES = {0x00: "add", 0x40: "or", 0x50: "and", 0xA0: "xor"}
+    XCHG = 0xE1
+    CMPXCHG = 0xF1
+
+    def asm_print(self):
+        target = f"({self.size_str}*)(r{self.dst_register} + {self.offset})"
+        operation = self.immediate & ~self.FETCH
+        if self.immediate == self.XCHG:
+            return f"r{self.src_register} = xchg({target}, r{self.src_register})"
+        elif self.immediate == self.CMPXCHG:
+            return f"r0 = cmpxchg({target}, r0, r{self.src_register})"
+        elif operation not in self.OPERATIONS:
+            return f"atomic {hex(self.immediate)} {target}"
+        elif self.immediate & self.FETCH:
+            name = self.FETCH_NAMES[operation]
+            return f"r{self.src_register} = atomic_fetch_{name}({target}, r{self.src_register})"
+        return f"lock *{target} {self.OPERATIONS[operation]}= r{self.src_register}"
+
+    def compress(self):
+        return self.COMPRESSED.pack(
+            self.OPCODE, self.registers, self.offset, self.immediate
+        )
+
+    @classmethod
+    def expand_compressed(cls, fields):
+        return fields
+
+
+class AtomicDWInstruction(AtomicInstruction):
+
+    OPCODE = 0xDB
+    size_str = "uint64_t"
+
+
+class AtomicWInstruction(AtomicInstruction):
+
+    OPCODE = 0xC3
+    size_str = "uint32_t"
+
+
 class BranchInstruction(Instruction):
 
     OPERAND = "=="
@@ -546,16 +614,12 @@ class AlwaysBranchInstruction(BranchInstruction):
     OPCODE = 0x05
     COMPRESSED = struct.Struct("<BBh")
 
+    def compressed_asm_print(self):
+        return f"goto {'{:+}'.format(self._compressed_offset())}"
+
     def asm_print(self):
         return f"goto {self.offset}"
 
-    def compress(self):
-        return self.COMPRESSED.pack(self.OPCODE, self.registers)
-
-    @classmethod
-    def expand_compressed(cls, fields):
-        return fields[0], fields[1], 0, 0
-
 
 class EqBranchInstruction(BranchInstruction):
 
@@ -689,11 +753,37 @@ class SLeBranchImmInstruction(BranchImmInstruction):
     OPCODE = 0xD5
 
 
+class JumpTableInstruction(Instruction):
+    """
+    Jump through the table at the immediate offset in the read-only data,
+    indexed by the destination register. The table is the number of entries,
+    the entries and a default entry, all instruction indices
+    """
+
+    OPCODE = 0x0D
+    COMPRESSED = struct.Struct("<BBI")
+
+    def asm_print(self):
+        return f"goto table[r{self.dst_register}] at {self.immediate} + .rodata"
+
+    def compress(self):
+        return self.COMPRESSED.pack(self.OPCODE, self.registers, self.immediate)
+
+    @classmethod
+    def expand_compressed(cls, fields):
+        return fields[0], fields[1], 0, fields[2]
+
+
 class CallInstruction(AluImmInstruction):
 
     OPCODE = 0x85
+    # Source register of the calls to a function of the application
+    LOCAL_SRC = 1
 
     def asm_print(self):
+        if self.src_register == self.LOCAL_SRC:
+            target = struct.unpack("<i", struct.pack("<I", self.immediate))[0]
+            return f"Call local {target:+}"
         return f"Call {self.immediate}"
 
 
@@ -736,6 +826,8 @@ INSTRUCTIONS = {
     MovInstruction.OPCODE: MovInstruction,
     ARSHImmInstruction.OPCODE: ARSHImmInstruction,
     ARSHInstruction.OPCODE: ARSHInstruction,
+    LEInstruction.OPCODE: LEInstruction,
+    BEInstruction.OPCODE: BEInstruction,
     LDDWInstruction.OPCODE: LDDWInstruction,
     LDXDWInstruction.OPCODE: LDXDWInstruction,
     LDXWInstruction.OPCODE: LDXWInstruction,
@@ -749,6 +841,8 @@ INSTRUCTIONS = {
     STWInstruction.OPCODE: STWInstruction,
     STHInstruction.OPCODE: STHInstruction,
     STBInstruction.OPCODE: STBInstruction,
+    AtomicDWInstruction.OPCODE: AtomicDWInstruction,
+    AtomicWInstruction.OPCODE: AtomicWInstruction,
     AlwaysBranchInstruction.OPCODE: AlwaysBranchInstruction,
     EqBranchInstruction.OPCODE: EqBranchInstruction,
     EqBranchImmInstruction.OPCODE: EqBranchImmInstruction,
@@ -772,6 +866,7 @@ INSTRUCTIONS = {
     SLtBranchImmInstruction.OPCODE: SLtBranchImmInstruction,
     SLeBranchInstruction.OPCODE: SLeBranchInstruction,
     SLeBranchImmInstruction.OPCODE: SLeBranchImmInstruction,
+    JumpTableInstruction.OPCODE: JumpTableInstruction,
     CallInstruction.OPCODE: CallInstruction,
     ReturnInstruction.OPCODE: ReturnInstruction,
     # Custom rBPF
@@ -11,7 +11,9 @@
 
 import argparse
 import logging
-from rbpf import rbf, instructions
+import shlex
+import sys
+from rbpf import rbf, instructions, native, profile
 
 
 def test_instr(arguments):
@@ -28,6 +30,8 @@ def dump(arguments):
 
 def generate(arguments):
     rbf_o = rbf.RBF.from_elf(arguments.input)
+    if arguments.jump_tables and not rbf_o.lower_switches():
+        logging.warning("no switch to replace with a jump table")
     if arguments.compress:
         data = rbf_o.format_compressed()
     else:
@@ -35,6 +39,38 @@ def generate(arguments):
     arguments.output.write(data)
 
 
+def profile_dump(arguments):
+    rbf_o = rbf.RBF.from_rbf(arguments.file.read())
+    counters = profile.parse(arguments.counters)
+    if not counters:
+        logging.error("no profile lines found")
+        sys.exit(1)
+    profile.dump(rbf_o, counters, compressed=arguments.compress)
+
+
+def compile_native(arguments):
+    if arguments.input.read(4) == b"\x7fELF":
+        arguments.input.seek(0)
+        rbf_o = rbf.RBF.from_elf(arguments.input)
+        if arguments.jump_tables:
+            rbf_o.lower_switches()
+    else:
+        arguments.input.seek(0)
+        rbf_o = rbf.RBF.from_rbf(arguments.input.read())
+    name = arguments.name or native.default_name(arguments.output)
+    try:
+        source = native.generate_c(rbf_o, name, branches=arguments.branches)
+        if arguments.output.endswith(".c"):
+            with open(arguments.output, "w") as output:
+                output.write(source)
+        else:
+            cflags = native.DEFAULT_CFLAGS + shlex.split(arguments.cflags)
+            native.compile_c(source, arguments.output, arguments.cc, cflags)
+    except native.NativeError as error:
+        logging.error(error)
+        sys.exit(1)
+
+
 if __name__ == "__main__":
     parser = argparse.ArgumentParser("RIOT BPF format utility")
     parser.add_argument(
@@ -59,6 +95,13 @@ if __name__ == "__main__":
     parser_gen = subparsers.add_parser("generate")
     parser_gen.set_defaults(func=generate)
     parser_gen.add_argument("--compress", "-c", action="store_true", default=False)
+    parser_gen.add_argument(
+        "--jump-tables",
+        "-j",
+        action="store_true",
+        default=False,
+        help="Replace the comparisons of the switches with jump tables",
+    )
     parser_gen.add_argument(
         "input", type=argparse.FileType("rb"), help="ELF file to read"
     )
@@ -66,6 +109,49 @@ if __name__ == "__main__":
         "output", type=argparse.FileType("wb"), help="RBF file to write"
     )
 
+    parser_profile = subparsers.add_parser("profile")
+    parser_profile.set_defaults(func=profile_dump)
+    parser_profile.add_argument("--compress", "-c", action="store_true", default=False)
+    parser_profile.add_argument(
+        "file", type=argparse.FileType("rb"), help="RBF file that was profiled"
+    )
+    parser_profile.add_argument(
+        "counters",
+        type=argparse.FileType("r"),
+        help="Console output of a run built with RBPF_PROFILE=1",
+    )
+
+    parser_native = subparsers.add_parser("compile-native")
+    parser_native.set_defaults(func=compile_native)
+    parser_native.add_argument(
+        "--name", "-n", help="Name of the generated function (default: output name)"
+    )
+    parser_native.add_argument(
+        "--cc", default="arm-none-eabi-gcc", help="Compiler for the generated code"
+    )
+    parser_native.add_argument(
+        "--cflags", default="", help="Extra flags for the compiler"
+    )
+    parser_native.add_argument(
+        "--jump-tables",
+        "-j",
+        action="store_true",
+        default=False,
+        help="Replace the comparisons of the switches of an ELF file with jump tables",
+    )
+    parser_native.add_argument(
+        "--branches",
+        type=int,
+        default=native.BRANCHES_ALLOWED,
+        help="Number of taken jumps allowed",
+    )
+    parser_native.add_argument(
+        "input", type=argparse.FileType("rb"), help="ELF or RBF file to read"
+    )
+    parser_native.add_argument(
+        "output", help="Object file to write, or C file if it ends with .c"
+    )
+
     args = parser.parse_args()
 
     logging.basicConfig(format="%(message)s")
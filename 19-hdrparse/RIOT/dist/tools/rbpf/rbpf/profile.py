@@ -0,0 +1,93 @@
+"""Execution profiles of rBPF applications.
+
+An engine built with RBPF_ENABLE_PROFILE prints a line per instruction that
+ran, with its index in the uncompressed text:
+
+    <prefix>profile pc <pc> count <runs> taken <jumps taken> misses <misses>
+
+The lines are read back from a capture of the console and laid over the
+disassembly of the application, followed by the totals of every opcode, the
+calls to every external function and the share of the jumps taken.
+"""
+
+import collections
+import re
+
+from rbpf import instructions
+
+PROFILE_LINE = re.compile(
+    r"profile pc (\d+) count (\d+) taken (\d+) misses (\d+)"
+)
+
+Counters = collections.namedtuple("Counters", "count taken misses")
+
+
+def parse(lines):
+    """Counters of every instruction, by index, the other lines are skipped"""
+    counters = {}
+    for line in lines:
+        match = PROFILE_LINE.search(line)
+        if match:
+            pc, count, taken, misses = (int(field) for field in match.groups())
+            counters[pc] = Counters(count, taken, misses)
+    return counters
+
+
+def _name(instr):
+    return f"{type(instr).__name__[: -len('Instruction')]} ({hex(instr.OPCODE)})"
+
+
+def _is_call(instr):
+    return (
+        isinstance(instr, instructions.CallInstruction)
+        and instr.src_register != instr.LOCAL_SRC
+    )
+
+
+def dump(rbf_o, counters, compressed=False):
+    none = Counters(0, 0, 0)
+    total = sum(counter.count for counter in counters.values())
+
+    print("text:")
+    print(f"{'count'.rjust(10)} {'taken'.rjust(10)} {'misses'.rjust(8)}")
+    for instr in rbf_o.instructions:
+        counter = counters.get(instr.address // 8, none)
+        text = instr.compressed_print() if compressed else instr.full_print()
+        print(
+            f"{counter.count:10} {counter.taken:10} {counter.misses:8} {text}"
+        )
+    print()
+
+    opcodes = collections.Counter()
+    calls = collections.Counter()
+    misses = collections.Counter()
+    for instr in rbf_o.instructions:
+        counter = counters.get(instr.address // 8, none)
+        opcodes[_name(instr)] += counter.count
+        misses[_name(instr)] += counter.misses
+        if _is_call(instr):
+            calls[instr.immediate] += counter.count
+
+    print(f"opcodes ({total} instructions run):")
+    for name, count in opcodes.most_common():
+        if count == 0:
+            break
+        share = 100 * count / total
+        print(f"\t{name}: {count} ({share:.1f}%), {misses[name]} misses")
+    print()
+
+    print("external calls:")
+    for function, count in calls.most_common():
+        print(f"\t{function}: {count}")
+    print()
+
+    print("jumps:")
+    for instr in rbf_o.instructions:
+        counter = counters.get(instr.address // 8, none)
+        jump = (instructions.BranchInstruction, instructions.JumpTableInstruction)
+        if isinstance(instr, jump) and counter.count:
+            share = 100 * counter.taken / counter.count
+            print(
+                f"\t{hex(instr.address)}: {counter.taken}/{counter.count} taken "
+                f"({share:.1f}%)"
+            )
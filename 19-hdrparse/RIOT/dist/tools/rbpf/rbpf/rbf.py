@@ -0,0 +1,442 @@
+import struct
+import logging
+from collections import namedtuple
+from elftools.elf.elffile import ELFFile
+from rbpf import instructions
+import itertools
+
+MAGIC = int.from_bytes(b"rBPF", "little")
+
+HEADER_STRUCT = struct.Struct("<IIIIIII")
+HEADER = namedtuple(
+    "Header", "magic version flags data_len rodata_len text_len functions_len"
+)
+
+SYMBOL_STRUCT = struct.Struct("<HHH")
+SYMBOL = namedtuple("Symbol", "name_offset flags location_offset")
+
+TEXT = ".text"
+DATA = ".data"
+RODATA = ".rodata"
+SYMBOLS = ".symtab"
+RELOCATIONS = ".rel.text"
+
+COMPRESSED = 0x01
+
+# Comparisons of a register to a constant a switch is made of, only unsigned
+# ones and equalities, so that every value past the largest constant ends at
+# the same instruction
+SWITCH_COMPARISONS = {
+    instructions.EqBranchImmInstruction.OPCODE: lambda a, b: a == b,
+    instructions.NeBranchImmInstruction.OPCODE: lambda a, b: a != b,
+    instructions.GtBranchImmInstruction.OPCODE: lambda a, b: a > b,
+    instructions.GeBranchImmInstruction.OPCODE: lambda a, b: a >= b,
+    instructions.LtBranchImmInstruction.OPCODE: lambda a, b: a < b,
+    instructions.LeBranchImmInstruction.OPCODE: lambda a, b: a <= b,
+}
+
+# Switches worth a jump table, and the largest table emitted
+JUMP_TABLE_MIN_COMPARISONS = 3
+JUMP_TABLE_MAX_ENTRIES = 256
+
+
+class Symbol(object):
+    def __init__(self, location, name, instruction=None):
+        self.location = location
+        self.name = name
+        self.instruction = instruction
+
+
+class RBF(object):
+    def __init__(self, data, rodata, text, symbols, header=None):
+        self.data = data
+        self.rodata = rodata
+        self.text = text
+        self.header = header
+        if header:
+            self.flags = self.header.flags
+        else:
+            self.flags = 0
+        compressed = bool(self.flags & COMPRESSED)
+        self.instructions = instructions.parse_text(self.text, compressed=compressed)
+        self.symbols = symbols
+
+        def _round_len(bstr):
+            if (len(bstr) % 8) != 0:
+                bytes_to_append = 8 - len(bstr) % 8
+                logging.debug(f"appending {bytes_to_append} bytes")
+                bstr += bytes([0x00] * bytes_to_append)
+
+        _round_len(self.data)
+        _round_len(self.rodata)
+
+        if not compressed and (len(text) % 8) != 0:
+            logging.error(
+                f"Length of the text is not a whole number of instructions: {len(text)}"
+            )
+
+    def _parse_symbols(self, symbols):
+        syms = []
+        for symbol in symbols:
+            rodata_offset = symbol.name_offset
+            name = self.rodata[rodata_offset:].split(b"\00")[0].decode("ascii")
+            instruction = self.instruction_by_address(symbol.location_offset)
+            syms.append(Symbol(symbol.location_offset, name, instruction))
+        return syms
+
+    def instruction_by_address(self, address):
+        for instruction in self.instructions:
+            if instruction.address == address:
+                return instruction
+        return None
+
+    @staticmethod
+    def _hex_dump(data):
+        return " ".join(map("0x{0:0>2X}".format, data))
+
+    @staticmethod
+    def _split_instructions(data):
+        iterator = [iter(data)] * 8
+        return list(itertools.zip_longest(*iterator))
+
+    @staticmethod
+    def obj_hexstr(bstr):
+        addr = 0
+        while len(bstr) > 0:
+            slice_len = 8 if len(bstr) > 8 else len(bstr)
+            line = bstr[:slice_len]
+            bstr = bstr[slice_len:]
+            yield "{:>5x}: ".format(addr) + " ".join(
+                map("0x{0:0>2x}".format, line)
+            ) + "\n"
+            addr += 8
+
+    def dump(self, compressed=False):
+        print(
+            f"Magic:\t\t{hex(self.header.magic)}\n"
+            f"Version:\t{self.header.version}\n"
+            f"flags:\t{hex(self.flags)}\n"
+            f"Data length:\t{self.header.data_len} B\n"
+            f"RoData length:\t{self.header.rodata_len} B\n"
+            f"Text length:\t{self.header.text_len} B\n"
+            f"No. functions:\t{self.header.functions_len}\n"
+        )
+        print("functions:")
+        syms = {sym.location: sym for sym in self._parse_symbols(self.symbols)}
+        for symbol in syms.values():
+            print(f'\t"{symbol.name}": {hex(symbol.location)}')
+        print()
+
+        print("data:")
+        print("".join(data for data in RBF.obj_hexstr(self.data)))
+
+        print("rodata:")
+        print("".join(data for data in RBF.obj_hexstr(self.rodata)))
+
+        print("text:")
+        for instr in self.instructions:
+            if compressed:
+                print(instr.compressed_print())
+            else:
+                if instr.address in syms:
+                    symbol = syms[instr.address]
+                    print(f"<{symbol.name}>")
+                print(instr.full_print())
+
+        tables = [
+            instr
+            for instr in self.instructions
+            if isinstance(instr, instructions.JumpTableInstruction)
+        ]
+        if tables:
+            print()
+            print("jump tables:")
+        for instr in tables:
+            entries = self.jump_table(instr.immediate)
+            targets = ", ".join(hex(entry * 8) for entry in entries[:-1])
+            print(f"\t{hex(instr.address)}: {targets}, default {hex(entries[-1] * 8)}")
+
+    def jump_table(self, offset):
+        """Entries of the jump table at offset in the rodata, the default one last"""
+        (count,) = struct.unpack_from("<I", self.rodata, offset)
+        return list(struct.unpack_from(f"<{count + 1}I", self.rodata, offset + 4))
+
+    @staticmethod
+    def _switch_comparison(instr, register):
+        return (
+            instr is not None
+            and instr.OPCODE in SWITCH_COMPARISONS
+            and instr.dst_register == register
+            and instr.immediate < 0x80000000
+        )
+
+    @staticmethod
+    def _switch_target(by_index, comparisons, first, value):
+        """Instruction the value ends at after the comparisons, None when they loop"""
+        index = first
+        for _ in range(len(comparisons) + 1):
+            if index not in comparisons:
+                return index
+            instr = by_index[index]
+            if SWITCH_COMPARISONS[instr.OPCODE](value, instr.immediate):
+                index += 1 + instr.offset
+            else:
+                index += 1
+        return None
+
+    def lower_switches(self):
+        """
+        Replace the comparisons clang emits for a switch with a jump table, on
+        an application read from an ELF file.
+
+        A switch is a tree of conditional jumps comparing a register to
+        constants, with no other instruction in between. Its first comparison
+        becomes a jump through a table appended to the rodata, with the
+        instruction every value up to the largest constant ends at and the one
+        all the larger values end at. The other comparisons stay in place, the
+        text keeps its layout and the jumps their offsets. The entries are
+        instruction indices, they need no relocation. Returns the number of
+        tables emitted.
+        """
+        by_index = {instr.address // 8: instr for instr in self.instructions}
+        lowered = set()
+        tables = 0
+        for first, instr in sorted(by_index.items()):
+            if first in lowered or not RBF._switch_comparison(instr, instr.dst_register):
+                continue
+            register = instr.dst_register
+            comparisons, todo = set(), [first]
+            while todo:
+                index = todo.pop()
+                node = by_index.get(index)
+                if index in comparisons or not RBF._switch_comparison(node, register):
+                    continue
+                comparisons.add(index)
+                todo += [index + 1, index + 1 + node.offset]
+            if len(comparisons) < JUMP_TABLE_MIN_COMPARISONS:
+                continue
+
+            count = max(by_index[index].immediate for index in comparisons) + 1
+            if count > JUMP_TABLE_MAX_ENTRIES:
+                continue
+            entries = [
+                RBF._switch_target(by_index, comparisons, first, value)
+                for value in range(count + 1)
+            ]
+            if None in entries:
+                continue
+
+            # Appended after the rounded rodata, the table stays 4 bytes aligned
+            offset = len(self.rodata)
+            self.rodata += struct.pack(f"<{count + 2}I", count, *entries)
+            struct.pack_into(
+                "<BBhi",
+                self.text,
+                first * 8,
+                instructions.JumpTableInstruction.OPCODE,
+                register,
+                0,
+                offset,
+            )
+            lowered |= comparisons
+            tables += 1
+            logging.info(
+                f"Replacing the {len(comparisons)} comparisons of r{register} at "
+                f"{hex(first * 8)} with a table of {count} entries at {offset}"
+            )
+
+        if len(self.rodata) % 8:
+            self.rodata += bytes(8 - len(self.rodata) % 8)
+        self.instructions = instructions.parse_text(self.text)
+        return tables
+
+    def format(self):
+        if not self.header:
+            self.header = HEADER(
+                MAGIC,
+                0,
+                0,
+                len(self.data),
+                len(self.rodata),
+                len(self.text),
+                len(self.symbols),
+            )
+
+        data = bytearray(HEADER_STRUCT.pack(*self.header))
+        data += self.data
+        data += self.rodata
+        data += self.text
+        for symbol in self.symbols:
+            data += SYMBOL_STRUCT.pack(*symbol)
+        return data
+
+    def format_compressed(self):
+        compressed_text = bytes().join(instr.compress() for instr in self.instructions)
+        if not self.header:
+            self.header = HEADER(
+                MAGIC,
+                0,
+                COMPRESSED,
+                len(self.data),
+                len(self.rodata),
+                len(compressed_text),
+                len(self.symbols),
+            )
+        header = self.header._replace(
+            flags=self.header.flags | COMPRESSED, text_len=len(compressed_text)
+        )
+        data = bytearray(HEADER_STRUCT.pack(*header))
+        data += self.data
+        data += self.rodata
+        data += compressed_text
+        for symbol in self.symbols:
+            data += SYMBOL_STRUCT.pack(*symbol)
+        return data
+
+    @staticmethod
+    def from_rbf(byte_data):
+        header = HEADER._make(HEADER_STRUCT.unpack_from(byte_data, 0))
+        offset = HEADER_STRUCT.size
+        data_start = offset
+        offset += header.data_len
+        rodata_start = data_end = offset
+        offset += header.rodata_len
+        text_start = rodata_end = offset
+        offset += header.text_len
+        syms_start = text_end = offset
+        rodata = byte_data[rodata_start:rodata_end]
+        data = byte_data[data_start:data_end]
+        text = byte_data[text_start:text_end]
+        syms = byte_data[syms_start:]
+
+        syms_array = []
+        while len(syms):
+            syms_array.append(SYMBOL._make(SYMBOL_STRUCT.unpack_from(syms, 0)))
+            syms = syms[SYMBOL_STRUCT.size :]
+        return RBF(data, rodata, text, syms_array, header)
+
+    @staticmethod
+    def _get_section_lddw_opcode(section):
+        if section == RODATA:
+            return instructions.LDDWR_OPCODE
+        elif section == DATA:
+            return instructions.LDDWD_OPCODE
+
+    @staticmethod
+    def _patch_call(text, symbol, location):
+        # Call of a global function: the immediate becomes the offset of the
+        # function from the instruction following the call, in instructions
+        call = struct.Struct("<BBhi")
+        opcode, registers, offset, immediate = call.unpack_from(text, location)
+        if symbol.entry.st_info.type != "STT_FUNC":
+            logging.error(f"Call at {hex(location)} of {symbol.name}, not a function")
+            return
+        target = symbol.entry.st_value // 8 + immediate + 1
+        immediate = target - location // 8 - 1
+        logging.info(f"Replacing call at {location} with local call {immediate:+}")
+        registers = (registers & 0x0F) | (instructions.CallInstruction.LOCAL_SRC << 4)
+        text[location : location + 8] = call.pack(opcode, registers, offset, immediate)
+
+    @staticmethod
+    def _patch_text(text, elffile, relocation):
+        entry = relocation.entry
+        location = entry.r_offset
+        symbols = elffile.get_section_by_name(SYMBOLS)
+        symbol = symbols.get_symbol(entry.r_info_sym)
+        if text[location] == instructions.CallInstruction.OPCODE:
+            RBF._patch_call(text, symbol, location)
+            return
+        if symbol.entry.st_info.type == "STT_SECTION":
+            # refers to an offset in a section
+            section_name = elffile.get_section(symbol.entry.st_shndx).name
+            offset = 0
+            pass
+        elif symbol.entry.st_info.type == "STT_OBJECT":
+            section_name = elffile.get_section(symbol.entry.st_shndx).name
+            offset = symbol.entry.st_value
+        opcode = RBF._get_section_lddw_opcode(section_name)
+        if text[location] != instructions.LDDW_OPCODE:
+            logging.error(f"No LDDW instruction at {hex(location)}")
+        else:
+            instruction = instructions.LDDW._make(
+                instructions.LDDW_STRUCT.unpack_from(text, location)
+            )
+            logging.info(
+                f"Replacing {instruction} at {location} with {opcode} at {offset}"
+            )
+            text[location : location + 16] = instructions.LDDW_STRUCT.pack(
+                opcode,
+                instruction.registers,
+                instruction.offset,
+                instruction.immediate_l + offset,
+                0,
+                0,
+                0,
+                instruction.immediate_h,
+            )
+
+    @staticmethod
+    def from_elf(elf, relocations=True):
+        # Read data from the input file and construct the RBF object
+        elffile = ELFFile(elf)
+        relocations = elffile.get_section_by_name(RELOCATIONS)
+        elf_text = elffile.get_section_by_name(TEXT)
+        elf_data = elffile.get_section_by_name(DATA)
+        elf_rodata = elffile.get_section_by_name(RODATA)
+        if not elf_rodata:
+            rodata = bytearray()
+        else:
+            rodata = bytearray(elf_rodata.data())
+        if not elf_text:
+            text = bytearray()
+        else:
+            text = bytearray(elf_text.data())
+        if not elf_data:
+            data = bytearray()
+        else:
+            data = bytearray(elf_data.data())
+
+        symbols = elffile.get_section_by_name(SYMBOLS)
+
+        rbf_symbols = []
+        for symbol in symbols.iter_symbols():
+            entry = symbol.entry
+            info = entry["st_info"]
+            if info["type"] == "STT_FUNC" and info["bind"] == "STB_GLOBAL":
+                name = symbol.name
+                text_offset = entry["st_value"]
+                logging.info(f"Found global function {name} at offset {text_offset}")
+                rbf_symbols.append((name, text_offset, 0))  # potential flags
+
+        symbol_structs = []
+        logging.debug(f"rodata length: {len(rodata)}")
+        for name, text_offset, flags in rbf_symbols:
+            offset = len(rodata)
+            rodata += bytes(name, "UTF-8") + b"\00"
+            sym_str = SYMBOL(offset, flags, text_offset)
+            symbol_structs.append(sym_str)
+            logging.debug(
+                f"symbol {sym_str} generated with {name} and appended at {offset}"
+            )
+        logging.info(f"Total rodata size: {len(rodata)}. Total data size: {len(data)}")
+
+        if relocations:
+            for relocation in relocations.iter_relocations():
+                logging.debug(relocation.entry)
+                entry = relocation.entry
+                symbol = symbols.get_symbol(entry["r_info_sym"])
+                if symbol.entry["st_info"]["type"] == "STT_SECTION":
+                    name = elffile.get_section(symbol.entry["st_shndx"]).name
+                    logging.info(
+                        f"relocation at instruction {hex(entry['r_offset'])} for section {name} at offset {symbol.entry.st_value}"
+                    )
+                else:
+                    name = symbol.name
+                    section = elffile.get_section(symbol.entry.st_shndx)
+                    logging.info(
+                        f"relocation at instruction {hex(entry['r_offset'])} for symbol {name} in {section.name} at {symbol.entry.st_value}"
+                    )
+
+                RBF._patch_text(text, elffile, relocation)
+
+        return RBF(data=data, rodata=rodata, text=text, symbols=symbol_structs)
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2023 Inria
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup
+ * @{
+ *
+ * @file
+ *
+ * Parses an Ethernet, IPv4 and UDP frame and returns a hash of its flow, 0
+ * when the frame is not a well formed UDP datagram. The header fields are in
+ * network byte order, the conversions compile to the byte swap instructions.
+ *
+ * @}
+ */
+
+
+#include<stdint.h>
+
+#include "shared.h"
+
+#define ETHERTYPE_IPV4  (0x0800)
+#define IPPROTO_UDP     (17)
+
+/* The frame starts two bytes into a word aligned buffer, so that the IPv4
+ * header is word aligned */
+typedef struct eth_hdr_s
+{
+    uint8_t dst[6];
+    uint8_t src[6];
+    uint16_t type;
+} eth_hdr_t;
+
+typedef struct ipv4_hdr_s
+{
+    uint8_t version_ihl;
+    uint8_t tos;
+    uint16_t len;
+    uint16_t id;
+    uint16_t frag;
+    uint8_t ttl;
+    uint8_t protocol;
+    uint16_t csum;
+    uint32_t src;
+    uint32_t dst;
+} ipv4_hdr_t;
+
+typedef struct udp_hdr_s
+{
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint16_t len;
+    uint16_t csum;
+} udp_hdr_t;
+
+typedef struct hdrparse_ctx_s
+{
+    uint32_t len;
+    __bpf_shared_ptr(const uint8_t *, frame);
+} hdrparse_ctx_t;
+
+static inline uint16_t ntohs(uint16_t v)
+{
+    return __builtin_bswap16(v);
+}
+
+static inline uint32_t ntohl(uint32_t v)
+{
+    return __builtin_bswap32(v);
+}
+
+uint32_t hdrparse(hdrparse_ctx_t *ctx)
+{
+    const uint8_t *frame = ctx->frame;
+    uint32_t len         = ctx->len;
+    const eth_hdr_t *eth = (const eth_hdr_t *)frame;
+    const ipv4_hdr_t *ip = (const ipv4_hdr_t *)(frame + sizeof(eth_hdr_t));
+    const uint16_t *words;
+    const udp_hdr_t *udp;
+    uint32_t ihl;
+    uint32_t index;
+    uint32_t sum = 0;
+
+    if (len < sizeof(eth_hdr_t) + sizeof(ipv4_hdr_t) + sizeof(udp_hdr_t))
+        return 0;
+    if (ntohs(eth->type) != ETHERTYPE_IPV4)
+        return 0;
+
+    ihl = (ip->version_ihl & 0x0fU) * 4U;
+    if ((ip->version_ihl >> 4) != 4U || ihl < sizeof(ipv4_hdr_t))
+        return 0;
+    if (len < sizeof(eth_hdr_t) + ihl + sizeof(udp_hdr_t))
+        return 0;
+    if (ntohs(ip->len) > len - sizeof(eth_hdr_t))
+        return 0;
+
+    /* The ones' complement sum of a valid header, checksum included, is 0xffff */
+    words = (const uint16_t *)ip;
+    for (index = 0U; index < ihl / 2U; index++) {
+        sum += ntohs(words[index]);
+    }
+    sum = (sum & 0xffffU) + (sum >> 16);
+    sum = (sum & 0xffffU) + (sum >> 16);
+    if (sum != 0xffffU || ip->protocol != IPPROTO_UDP)
+        return 0;
+
+    udp = (const udp_hdr_t *)((const uint8_t *)ip + ihl);
+    return ntohl(ip->src) ^ ntohl(ip->dst) ^
+           (((uint32_t)ntohs(udp->src_port) << 16) | ntohs(udp->dst_port));
+}
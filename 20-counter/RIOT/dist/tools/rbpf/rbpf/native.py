@@ -0,0 +1,451 @@
+"""Ahead of time compilation of rBPF applications to native code.
+
+The application text is translated to a single C function, one statement per
+instruction, and compiled with the FAE toolchain. The generated code keeps the
+semantics of the rBPF engine: every load and store is checked against the
+memory regions, the number of taken jumps is limited and the same error codes
+are returned.
+"""
+
+import logging
+import os
+import struct
+import subprocess
+
+INSTRUCTION_STRUCT = struct.Struct("<BBhi")
+
+STACK_SIZE = 512
+BRANCHES_ALLOWED = 10000
+
+# rBPF engine exit codes
+RBPF_OK = 0
+RBPF_ILLEGAL_INSTRUCTION = -1
+RBPF_ILLEGAL_MEM = -2
+RBPF_ILLEGAL_JUMP = -3
+RBPF_ILLEGAL_CALL = -4
+RBPF_ILLEGAL_REGISTER = -6
+RBPF_NO_RETURN = -7
+RBPF_OUT_OF_BRANCHES = -8
+RBPF_ILLEGAL_DIV = -9
+
+CLS_MASK = 0x07
+CLS_LD = 0x00
+CLS_ST = 0x02
+CLS_STX = 0x03
+CLS_LDX = 0x01
+CLS_ALU = 0x04
+CLS_JMP = 0x05
+CLS_ALU64 = 0x07
+SRC_REG = 0x08
+
+LDDW_OPCODE = 0x18
+LDDWD_OPCODE = 0xB8
+LDDWR_OPCODE = 0xD8
+CALL_OPCODE = 0x85
+RETURN_OPCODE = 0x95
+JA_OPCODE = 0x05
+JMP_TABLE_OPCODE = 0x0D
+ATOMICW_OPCODE = 0xC3
+
+# Atomic operations without the fetch flag, XCHG and CMPXCHG imply it
+ATOMIC_FETCH = 0x01
+ATOMIC_BUILTINS = {0x00: "add", 0x40: "or", 0x50: "and", 0xA0: "xor"}
+ATOMIC_XCHG = 0xE1
+ATOMIC_CMPXCHG = 0xF1
+
+MEM_SIZES = {0x00: "uint32_t", 0x08: "uint16_t", 0x10: "uint8_t", 0x18: "uint64_t"}
+
+ALU_OPERATORS = {
+    0x00: "+",
+    0x10: "-",
+    0x20: "*",
+    0x40: "|",
+    0x50: "&",
+    0x60: "<<",
+    0x70: ">>",
+    0xA0: "^",
+}
+ALU_DIV = 0x30
+ALU_NEG = 0x80
+ALU_MOD = 0x90
+ALU_MOV = 0xB0
+ALU_ARSH = 0xC0
+ALU_END = 0xD0
+
+# Jump operation: (signed, C operator)
+JMP_CONDITIONS = {
+    0x10: (False, "=="),
+    0x20: (False, ">"),
+    0x30: (False, ">="),
+    0x40: (False, "&"),
+    0x50: (False, "!="),
+    0x60: (True, ">"),
+    0x70: (True, ">="),
+    0xA0: (False, "<"),
+    0xB0: (False, "<="),
+    0xC0: (True, "<"),
+    0xD0: (True, "<="),
+}
+
+# Flags matching what the FAE Makefiles use
+DEFAULT_CFLAGS = [
+    "-mthumb",
+    "-mcpu=cortex-m4",
+    "-mfloat-abi=hard",
+    "-mfpu=fpv4-sp-d16",
+    "-msingle-pic-base",
+    "-mpic-register=sl",
+    "-mno-pic-data-is-text-relative",
+    "-fPIC",
+    "-ffreestanding",
+    "-Os",
+    "-Wall",
+    "-Wextra",
+    "-Werror",
+]
+
+PROLOGUE = """\
+/*
+ * Generated by gen_rbf.py compile-native, do not edit.
+ *
+ * int {name}(void *ctx, size_t ctx_len, const rbpf_mem_region_t *regions,
+ *            int64_t *result);
+ *
+ * Runs the application with ctx in r1, as rbpf_application_run_ctx() does.
+ * The regions list has the layout of rbpf_mem_region_t, it adds memory
+ * regions on top of the stack, the context and the application data. Returns
+ * the rBPF engine exit code, result receives r0.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct _region {{
+    const struct _region *next;
+    const uint8_t *start;
+    size_t len;
+    uint8_t flags;
+}} _region_t;
+
+#define _READ   0x01
+#define _WRITE  0x02
+
+__attribute__((unused))
+static bool _check(const _region_t *region, intptr_t addr, size_t size, uint8_t type)
+{{
+    const intptr_t end = addr + size;
+
+    for (; region; region = region->next) {{
+        if ((addr >= (intptr_t)(region->start)) &&
+            (end <= (intptr_t)(region->start + region->len)) &&
+            (region->flags & type)) {{
+            return true;
+        }}
+    }}
+    return false;
+}}
+
+#define EXIT(code) \\
+    do {{ \\
+        res = (code); \\
+        goto exit; \\
+    }} while (0)
+
+#define JUMP(label) \\
+    do {{ \\
+        if (--branches == 0) {{ \\
+            EXIT({out_of_branches}); \\
+        }} \\
+        goto label; \\
+    }} while (0)
+
+#define LOAD(dst, type, addr) \\
+    do {{ \\
+        if (!_check(&stack_region, (intptr_t)(addr), sizeof(type), _READ)) {{ \\
+            EXIT({illegal_mem}); \\
+        }} \\
+        dst = *(const type *)(uintptr_t)(addr); \\
+    }} while (0)
+
+#define STORE(type, addr, value) \\
+    do {{ \\
+        if (!_check(&stack_region, (intptr_t)(addr), sizeof(type), _WRITE)) {{ \\
+            EXIT({illegal_mem}); \\
+        }} \\
+        *(type *)(uintptr_t)(addr) = value; \\
+    }} while (0)
+
+#define ATOMIC(type, addr) \\
+    do {{ \\
+        if (((addr) & (sizeof(type) - 1)) || \\
+            !_check(&stack_region, (intptr_t)(addr), sizeof(type), _READ) || \\
+            !_check(&stack_region, (intptr_t)(addr), sizeof(type), _WRITE)) {{ \\
+            EXIT({illegal_mem}); \\
+        }} \\
+    }} while (0)
+
+static uint8_t _stack[{stack_size}] __attribute__((aligned(8)));
+"""
+
+
+class NativeError(Exception):
+    pass
+
+
+def _c_bytes(name, data, const):
+    qualifier = "const " if const else ""
+    values = ", ".join(f"0x{b:02x}" for b in data) or "0"
+    return f"static {qualifier}uint8_t {name}[{max(len(data), 1)}] = {{ {values} }};\n"
+
+
+def _decode(text):
+    if len(text) % 8 or not text:
+        raise NativeError("text length is not a whole number of instructions")
+    return [
+        INSTRUCTION_STRUCT.unpack_from(text, offset) for offset in range(0, len(text), 8)
+    ]
+
+
+def _table(rodata, offset, pc):
+    """Entries of the jump table at offset in the rodata, the default one last,
+    checked as the rBPF pre-flight checks do"""
+    if offset < 0 or offset % 4 or offset + 4 > len(rodata):
+        raise NativeError(f"illegal jump table at instruction {pc}")
+    (count,) = struct.unpack_from("<I", rodata, offset)
+    if offset + 4 * (count + 2) > len(rodata):
+        raise NativeError(f"illegal jump table at instruction {pc}")
+    return list(struct.unpack_from(f"<{count + 1}I", rodata, offset + 4))
+
+
+def _targets(instrs, rodata):
+    """Verify the text as the rBPF pre-flight checks do, return the jump targets"""
+    targets = set()
+    pc = 0
+    while pc < len(instrs):
+        opcode, registers, offset, immediate = instrs[pc]
+        if (registers & 0x0F) > 10 or (registers >> 4) > 10:
+            raise NativeError(f"illegal register at instruction {pc}")
+        if opcode in (LDDW_OPCODE, LDDWD_OPCODE, LDDWR_OPCODE):
+            if pc + 1 >= len(instrs):
+                raise NativeError("truncated double word load")
+            pc += 2
+            continue
+        if opcode == CALL_OPCODE:
+            raise NativeError(f"calls are not supported, instruction {pc}")
+        if opcode == JMP_TABLE_OPCODE:
+            for target in _table(rodata, immediate, pc):
+                if target >= len(instrs):
+                    raise NativeError(f"illegal jump at instruction {pc}")
+                targets.add(target)
+            pc += 1
+            continue
+        if (opcode & CLS_MASK) == CLS_JMP and opcode != RETURN_OPCODE:
+            target = pc + 1 + offset
+            if not 0 <= target < len(instrs):
+                raise NativeError(f"illegal jump at instruction {pc}")
+            targets.add(target)
+        pc += 1
+    if instrs[-1][0] != RETURN_OPCODE:
+        raise NativeError("no return at the end of the application")
+    return targets
+
+
+def _byteswap(opcode, dst, width):
+    """Byte swap statement, the native target is little endian"""
+    if width not in (16, 32, 64):
+        return None
+    if not opcode & SRC_REG:
+        if width == 64:
+            return ";"
+        return f"r{dst} = (uint{width}_t)r{dst};"
+    return f"r{dst} = __builtin_bswap{width}((uint{width}_t)r{dst});"
+
+
+def _alu(opcode, dst, src, imm):
+    is64 = (opcode & CLS_MASK) == CLS_ALU64
+    operation = opcode & 0xF0
+    if not is64 and operation == ALU_END:
+        return _byteswap(opcode, dst, imm)
+    operand = f"r{src}" if opcode & SRC_REG else f"INT64_C({imm})"
+    if is64:
+        a, b = f"r{dst}", operand
+    else:
+        a, b = f"(uint32_t)r{dst}", f"(uint32_t){operand}"
+
+    if operation in ALU_OPERATORS:
+        return f"r{dst} = {a} {ALU_OPERATORS[operation]} {b};"
+    if operation in (ALU_DIV, ALU_MOD):
+        operator = "/" if operation == ALU_DIV else "%"
+        return (
+            f"if ({operand} == 0) {{ EXIT({RBPF_ILLEGAL_DIV}); }} "
+            f"r{dst} = {a} {operator} {b};"
+        )
+    if operation == ALU_NEG:
+        return f"r{dst} = -(int{64 if is64 else 32}_t)r{dst};"
+    if operation == ALU_MOV:
+        return f"r{dst} = {b};"
+    if operation == ALU_ARSH:
+        if is64:
+            return f"r{dst} = (int64_t)r{dst} >> {operand};"
+        return f"r{dst} = (int32_t)r{dst} >> {operand};"
+    return None
+
+
+def _atomic(dst, src, offset, imm):
+    """32 bit atomic operation, 64 bit ones need LDREXD which the M4 lacks"""
+    address = f"r{dst} + INT64_C({offset})"
+    pointer = f"(uint32_t *)(uintptr_t)({address})"
+    check = f"ATOMIC(uint32_t, {address}); "
+    operation = ATOMIC_BUILTINS.get(imm & ~ATOMIC_FETCH)
+    if src == 10 and (imm & ATOMIC_FETCH) and imm != ATOMIC_CMPXCHG:
+        return None
+    if imm == ATOMIC_XCHG:
+        return (
+            check + f"r{src} = __atomic_exchange_n({pointer}, (uint32_t)r{src}, "
+            "__ATOMIC_SEQ_CST);"
+        )
+    if imm == ATOMIC_CMPXCHG:
+        return (
+            check + f"{{ uint32_t expected = (uint32_t)r0; "
+            f"__atomic_compare_exchange_n({pointer}, &expected, (uint32_t)r{src}, "
+            "false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); r0 = expected; }"
+        )
+    if operation is None:
+        return None
+    statement = (
+        f"__atomic_fetch_{operation}({pointer}, (uint32_t)r{src}, __ATOMIC_SEQ_CST);"
+    )
+    if imm & ATOMIC_FETCH:
+        statement = f"r{src} = " + statement
+    return check + statement
+
+
+def _statement(instrs, pc, rodata):
+    opcode, registers, offset, imm = instrs[pc]
+    dst, src = registers & 0x0F, registers >> 4
+    cls = opcode & CLS_MASK
+
+    if opcode in (LDDW_OPCODE, LDDWD_OPCODE, LDDWR_OPCODE):
+        low = imm & 0xFFFFFFFF
+        high = (instrs[pc + 1][3] & 0xFFFFFFFF) << 32
+        if opcode == LDDW_OPCODE:
+            return f"r{dst} = UINT64_C({high | low});"
+        base = "_data" if opcode == LDDWD_OPCODE else "_rodata"
+        return (
+            f"r{dst} = (uint64_t)(intptr_t){base} + INT64_C({imm}) + UINT64_C({high});"
+        )
+    if cls in (CLS_ALU, CLS_ALU64):
+        statement = _alu(opcode, dst, src, imm)
+        if statement:
+            return statement
+    elif cls == CLS_LDX and (opcode & 0xE0) == 0x60 and opcode & 0x18 in MEM_SIZES:
+        return f"LOAD(r{dst}, {MEM_SIZES[opcode & 0x18]}, r{src} + INT64_C({offset}));"
+    elif cls == CLS_ST and (opcode & 0xE0) == 0x60:
+        return f"STORE({MEM_SIZES[opcode & 0x18]}, r{dst} + INT64_C({offset}), INT64_C({imm}));"
+    elif cls == CLS_STX and (opcode & 0xE0) == 0x60:
+        return f"STORE({MEM_SIZES[opcode & 0x18]}, r{dst} + INT64_C({offset}), r{src});"
+    elif opcode == ATOMICW_OPCODE:
+        statement = _atomic(dst, src, offset, imm & 0xFFFFFFFF)
+        if statement:
+            return statement
+    elif opcode == RETURN_OPCODE:
+        return f"EXIT({RBPF_OK});"
+    elif opcode == JMP_TABLE_OPCODE:
+        entries = _table(rodata, imm, pc)
+        cases = " ".join(
+            f"case {index}: JUMP(L{target});" for index, target in enumerate(entries[:-1])
+        )
+        return f"switch (r{dst}) {{ {cases} default: JUMP(L{entries[-1]}); }}"
+    elif cls == CLS_JMP:
+        target = f"L{pc + 1 + offset}"
+        if opcode == JA_OPCODE:
+            return f"JUMP({target});"
+        condition = JMP_CONDITIONS.get(opcode & 0xF0)
+        if condition:
+            signed, operator = condition
+            kind = "int64_t" if signed else "uint64_t"
+            operand = f"r{src}" if opcode & SRC_REG else f"INT64_C({imm})"
+            return f"if (({kind})r{dst} {operator} ({kind}){operand}) {{ JUMP({target}); }}"
+    return f"EXIT({RBPF_ILLEGAL_INSTRUCTION});"
+
+
+def generate_c(rbf_o, name, branches=BRANCHES_ALLOWED):
+    """Translate an RBF object to the C source of a native function"""
+    instrs = _decode(bytes(rbf_o.text))
+    rodata = bytes(rbf_o.rodata)
+    targets = _targets(instrs, rodata)
+
+    lines = [
+        PROLOGUE.format(
+            name=name,
+            stack_size=STACK_SIZE,
+            out_of_branches=RBPF_OUT_OF_BRANCHES,
+            illegal_mem=RBPF_ILLEGAL_MEM,
+        ),
+        _c_bytes("_data", rbf_o.data, const=False),
+        _c_bytes("_rodata", rbf_o.rodata, const=True),
+        "",
+        f"int {name}(void *ctx, size_t ctx_len, const void *regions, int64_t *result);",
+        "",
+        f"int {name}(void *ctx, size_t ctx_len, const void *regions, int64_t *result)",
+        "{",
+        "    const _region_t arg_region = { regions, ctx, ctx_len, _READ | _WRITE };",
+        "    const _region_t rodata_region = { &arg_region, _rodata, "
+        f"{len(rbf_o.rodata)}, _READ }};",
+        "    const _region_t data_region = { &rodata_region, _data, "
+        f"{len(rbf_o.data)}, _READ | _WRITE }};",
+        "    const _region_t stack_region = { &data_region, _stack, sizeof(_stack), "
+        "_READ | _WRITE };",
+        f"    uint32_t branches = {branches};",
+        "    int res;",
+        "    uint64_t r0 = 0, r1 = (uintptr_t)ctx, r2 = 0, r3 = 0, r4 = 0, r5 = 0;",
+        "    uint64_t r6 = 0, r7 = 0, r8 = 0, r9 = 0;",
+        "    uint64_t r10 = (uintptr_t)(_stack + sizeof(_stack));",
+        "",
+    ]
+
+    pc = 0
+    while pc < len(instrs):
+        if pc in targets:
+            lines.append(f"L{pc}:")
+        lines.append(f"    {_statement(instrs, pc, rodata)}")
+        if instrs[pc][0] in (LDDW_OPCODE, LDDWD_OPCODE, LDDWR_OPCODE):
+            if pc + 1 in targets:
+                # Only reachable by a jump, the interpreter fails on it
+                lines.append(f"    goto L{pc + 2};")
+                lines.append(f"L{pc + 1}:")
+                lines.append(f"    EXIT({RBPF_ILLEGAL_INSTRUCTION});")
+                targets.add(pc + 2)
+            pc += 2
+        else:
+            pc += 1
+
+    lines += [
+        "",
+        "exit:",
+        "    (void)r0; (void)r1; (void)r2; (void)r3; (void)r4; (void)r5;",
+        "    (void)r6; (void)r7; (void)r8; (void)r9; (void)r10; (void)branches;",
+        "    (void)stack_region;",
+        "    *result = r0;",
+        "    return res;",
+        "}",
+        "",
+    ]
+    logging.info(f"Generated {name} from {len(instrs)} instructions")
+    return "\n".join(lines)
+
+
+def compile_c(source, output, cc, cflags):
+    """Compile the generated C source to an object file"""
+    command = [cc] + cflags + ["-x", "c", "-c", "-", "-o", output]
+    logging.info(" ".join(command))
+    try:
+        subprocess.run(command, input=source.encode(), check=True)
+    except (OSError, subprocess.CalledProcessError) as error:
+        raise NativeError(f"failed to compile the generated code: {error}")
+
+
+def default_name(output):
+    base = os.path.splitext(os.path.basename(output))[0]
+    return "".join(c if c.isalnum() else "_" for c in base)
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2023 Inria
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup
+ * @{
+ *
+ * @file
+ *
+ * Counts the runs of the application per key, given as the integer context,
+ * in its local key/value store, and all of them in the global store. Returns
+ * the number of runs with the key, 0 if a store is full.
+ *
+ * @}
+ */
+
+
+#include<stdint.h>
+
+#include "helpers.h"
+
+#define TOTAL_KEY   (0)
+
+uint32_t counter(const uint64_t *ctx)
+{
+    uint32_t key = (uint32_t)*ctx;
+    uint32_t count;
+    uint32_t total;
+
+    bpf_fetch_local(key, &count);
+    if (bpf_store_local(key, count + 1) != 0)
+        return 0;
+
+    bpf_fetch_global(TOTAL_KEY, &total);
+    if (bpf_store_global(TOTAL_KEY, total + 1) != 0)
+        return 0;
+
+    return count + 1;
+}
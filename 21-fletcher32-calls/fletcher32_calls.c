@@ -0,0 +1,77 @@
+/*
+ * Copyright 2015 Eistec AB
+ * Copyright 2021 Koen Zandberg <koen@bergzand.net>
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     sys_checksum_fletcher32
+ * @{
+ *
+ * @file
+ * @brief       Fletcher32 implementation for rBPF, split in local functions
+ *
+ * The same checksum as the fletcher32 application, the block sums and the
+ * reductions are functions of their own which the application calls with the
+ * BPF to BPF call instruction.
+ *
+ * @}
+ */
+
+#include <stddef.h>
+
+#include "shared.h"
+#include "unaligned.h"
+
+typedef struct {
+    __bpf_shared_ptr(const uint16_t *, data);
+    uint32_t words;
+} fletcher32_ctx_t;
+
+/* Sums of a block, kept in the stack frame of the caller */
+typedef struct {
+    uint32_t sum1;
+    uint32_t sum2;
+} fletcher32_sums_t;
+
+static uint32_t reduce(uint32_t sum) __attribute__((noinline));
+static void block(fletcher32_sums_t *sums, const uint16_t *data, unsigned tlen)
+    __attribute__((noinline));
+
+/* Entry point, placed first in the text */
+uint32_t fletcher32_calls(fletcher32_ctx_t *ctx)
+{
+    uint32_t words = ctx->words;
+    const uint16_t *data = ctx->data;
+    fletcher32_sums_t sums = { 0xffff, 0xffff };
+
+    while (words) {
+        unsigned tlen = words > 359 ? 359 : words;
+        words -= tlen;
+        block(&sums, data, tlen);
+        data += tlen;
+    }
+    /* Second reduction step to reduce sums to 16 bits */
+    sums.sum1 = reduce(sums.sum1);
+    sums.sum2 = reduce(sums.sum2);
+    return (sums.sum2 << 16) | sums.sum1;
+}
+
+static uint32_t reduce(uint32_t sum)
+{
+    return (sum & 0xffff) + (sum >> 16);
+}
+
+static void block(fletcher32_sums_t *sums, const uint16_t *data, unsigned tlen)
+{
+    uint32_t sum1 = sums->sum1, sum2 = sums->sum2;
+
+    do {
+        sum2 += sum1 += unaligned_get_u16(data++);
+    } while (--tlen);
+    sums->sum1 = reduce(sum1);
+    sums->sum2 = reduce(sum2);
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2023 Inria
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup
+ * @{
+ *
+ * @file
+ *
+ * One stage of a pipeline of filters chained by tail calls. Every stage mixes
+ * its number into the checksum of the context and starts the next stage, the
+ * application at index 0 of its tail call array, until no stage is left. The
+ * last stage returns the checksum.
+ *
+ * @}
+ */
+
+
+#include<stdint.h>
+
+#include "helpers.h"
+
+typedef struct chain_ctx_s
+{
+    uint32_t stages;
+    uint32_t sum;
+} chain_ctx_t;
+
+uint32_t chain(chain_ctx_t *ctx)
+{
+    ctx->sum = ctx->sum * 31 + ctx->stages;
+    if (--ctx->stages != 0)
+        bpf_tail_call(0);
+    return ctx->sum;
+}
@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+# vim:fenc=utf-8
+
+# Copyright (C) 2021 Inria
+# Copyright (C) 2021 Koen Zandberg <koen@bergzand.net>
+#
+# This file is subject to the terms and conditions of the GNU Lesser
+# General Public License v2.1. See the file LICENSE in the top level
+# directory for more details.
+
+import argparse
+import logging
+import shlex
+import sys
+from rbpf import rbf, instructions, native, profile
+
+
+def test_instr(arguments):
+    instruction = bytes.fromhex("0f02000100000000")
+    instr = instructions.from_bytes(instruction)
+    print(instr.full_print())
+
+
+def dump(arguments):
+    rbf_content = arguments.file.read()
+    rbf_o = rbf.RBF.from_rbf(rbf_content)
+    rbf_o.dump(compressed=arguments.compress)
+
+
+def generate(arguments):
+    rbf_o = rbf.RBF.from_elf(arguments.input)
+    if arguments.jump_tables and not rbf_o.lower_switches():
+        logging.warning("no switch to replace with a jump table")
+    if arguments.compress:
+        data = rbf_o.format_compressed()
+    else:
+        data = rbf_o.format()
+    arguments.output.write(data)
+
+
+def profile_dump(arguments):
+    rbf_o = rbf.RBF.from_rbf(arguments.file.read())
+    counters = profile.parse(arguments.counters)
+    if not counters:
+        logging.error("no profile lines found")
+        sys.exit(1)
+    profile.dump(rbf_o, counters, compressed=arguments.compress)
+
+
+def compile_native(arguments):
+    if arguments.input.read(4) == b"\x7fELF":
+        arguments.input.seek(0)
+        rbf_o = rbf.RBF.from_elf(arguments.input)
+        if arguments.jump_tables:
+            rbf_o.lower_switches()
+    else:
+        arguments.input.seek(0)
+        rbf_o = rbf.RBF.from_rbf(arguments.input.read())
+    name = arguments.name or native.default_name(arguments.output)
+    try:
+        source = native.generate_c(rbf_o, name, branches=arguments.branches)
+        if arguments.output.endswith(".c"):
+            with open(arguments.output, "w") as output:
+                output.write(source)
+        else:
+            cflags = native.DEFAULT_CFLAGS + shlex.split(arguments.cflags)
+            native.compile_c(source, arguments.output, arguments.cc, cflags)
+    except native.NativeError as error:
+        logging.error(error)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser("RIOT BPF format utility")
+    parser.add_argument(
+        "--verbose", "-v", help="Verbose output", action="store_true", default=False
+    )
+    parser.add_argument(
+        "--debug", "-d", help="All debug output", action="store_true", default=False
+    )
+
+    subparsers = parser.add_subparsers(help="sub commands")
+
+    parser_dump = subparsers.add_parser("dump")
+    parser_dump.set_defaults(func=dump)
+    parser_dump.add_argument("--compress", "-c", action="store_true", default=False)
+    parser_dump.add_argument(
+        "file", type=argparse.FileType("rb"), help="RBF file to dump"
+    )
+
+    parser_test = subparsers.add_parser("test")
+    parser_test.set_defaults(func=test_instr)
+
+    parser_gen = subparsers.add_parser("generate")
+    parser_gen.set_defaults(func=generate)
+    parser_gen.add_argument("--compress", "-c", action="store_true", default=False)
+    parser_gen.add_argument(
+        "--jump-tables",
+        "-j",
+        action="store_true",
+        default=False,
+        help="Replace the comparisons of the switches with jump tables",
+    )
+    parser_gen.add_argument(
+        "input", type=argparse.FileType("rb"), help="ELF file to read"
+    )
+    parser_gen.add_argument(
+        "output", type=argparse.FileType("wb"), help="RBF file to write"
+    )
+
+    parser_profile = subparsers.add_parser("profile")
+    parser_profile.set_defaults(func=profile_dump)
+    parser_profile.add_argument("--compress", "-c", action="store_true", default=False)
+    parser_profile.add_argument(
+        "file", type=argparse.FileType("rb"), help="RBF file that was profiled"
+    )
+    parser_profile.add_argument(
+        "counters",
+        type=argparse.FileType("r"),
+        help="Console output of a run built with RBPF_PROFILE=1",
+    )
+
+    parser_native = subparsers.add_parser("compile-native")
+    parser_native.set_defaults(func=compile_native)
+    parser_native.add_argument(
+        "--name", "-n", help="Name of the generated function (default: output name)"
+    )
+    parser_native.add_argument(
+        "--cc", default="arm-none-eabi-gcc", help="Compiler for the generated code"
+    )
+    parser_native.add_argument(
+        "--cflags", default="", help="Extra flags for the compiler"
+    )
+    parser_native.add_argument(
+        "--jump-tables",
+        "-j",
+        action="store_true",
+        default=False,
+        help="Replace the comparisons of the switches of an ELF file with jump tables",
+    )
+    parser_native.add_argument(
+        "--branches",
+        type=int,
+        default=native.BRANCHES_ALLOWED,
+        help="Number of taken jumps allowed",
+    )
+    parser_native.add_argument(
+        "input", type=argparse.FileType("rb"), help="ELF or RBF file to read"
+    )
+    parser_native.add_argument(
+        "output", help="Object file to write, or C file if it ends with .c"
+    )
+
+    args = parser.parse_args()
+
+    logging.basicConfig(format="%(message)s")
+    logger = logging.getLogger()
+    if args.debug:
+        logger.setLevel(logging.DEBUG)
+    elif args.verbose:
+        logger.setLevel(logging.INFO)
+    else:
+        logger.setLevel(logging.WARNING)
+
+    args.func(args)
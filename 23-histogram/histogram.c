@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2023 Inria
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup
+ * @{
+ *
+ * @file
+ *
+ * Adds the bytes of a buffer to a histogram of eight bins shared by all the
+ * instances of the application, and returns the number of bytes counted so
+ * far. The bins are only updated with the atomic instructions, so several
+ * threads may run the application on the same histogram.
+ *
+ * @}
+ */
+
+
+#include<stdint.h>
+
+#include "shared.h"
+
+#define HISTOGRAM_BINS  (8)
+
+typedef struct histogram_ctx_s
+{
+    __bpf_shared_ptr(const uint8_t *, data);
+    uint32_t len;
+    /* HISTOGRAM_BINS bins followed by the total */
+    __bpf_shared_ptr(uint32_t *, bins);
+} histogram_ctx_t;
+
+uint32_t histogram(histogram_ctx_t *ctx)
+{
+    const uint8_t *data = ctx->data;
+    uint32_t *bins      = ctx->bins;
+    uint32_t len        = ctx->len;
+    uint32_t index;
+
+    for (index = 0U; index < len; index++) {
+        __sync_fetch_and_add(&bins[data[index] >> 5], 1U);
+    }
+    return __sync_fetch_and_add(&bins[HISTOGRAM_BINS], len) + len;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2023 Inria
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup
+ * @{
+ *
+ * @file
+ *
+ * Adds the digits of the values of the context written in its base. Every
+ * digit takes a 64 bit division and a 64 bit modulo, most of the values fit
+ * in 32 bits and the last ones don't.
+ *
+ * @}
+ */
+
+
+#include<stdint.h>
+
+#define DIVIDE_VALUES   (16)
+
+typedef struct divide_ctx_s
+{
+    uint64_t base;
+    uint64_t values[DIVIDE_VALUES];
+} divide_ctx_t;
+
+uint64_t divide(divide_ctx_t *ctx)
+{
+    uint64_t base = ctx->base;
+    uint64_t sum  = 0;
+
+    for (unsigned index = 0U; index < DIVIDE_VALUES; index++) {
+        uint64_t value = ctx->values[index];
+
+        while (value != 0) {
+            sum += value % base;
+            value /= base;
+        }
+    }
+    return sum;
+}
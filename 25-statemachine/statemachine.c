@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2023 Inria
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup
+ * @{
+ *
+ * @file
+ *
+ * Parses the "key=value;" records of the context, one character at a time,
+ * and adds up their numeric values. Every character goes through a switch on
+ * the state of the parser, which gen_rbf.py turns into a jump table.
+ *
+ * @}
+ */
+
+
+#include<stdint.h>
+
+#define STATEMACHINE_DATA_LEN   (256)
+
+typedef struct statemachine_ctx_s
+{
+    uint32_t len;
+    uint8_t data[STATEMACHINE_DATA_LEN];
+} statemachine_ctx_t;
+
+enum {
+    STATE_KEY,
+    STATE_VALUE,
+    STATE_NUMBER,
+    STATE_HEX,
+    STATE_QUOTED,
+    STATE_ESCAPE,
+    STATE_COMMENT,
+    STATE_SKIP,
+};
+
+static inline int _is_digit(uint8_t c)
+{
+    return c >= '0' && c <= '9';
+}
+
+uint64_t statemachine(statemachine_ctx_t *ctx)
+{
+    uint32_t len = ctx->len < STATEMACHINE_DATA_LEN ? ctx->len : STATEMACHINE_DATA_LEN;
+    unsigned state = STATE_KEY;
+    uint64_t value = 0;
+    uint64_t sum = 0;
+    uint64_t records = 0;
+
+    for (uint32_t index = 0U; index < len; index++) {
+        uint8_t c = ctx->data[index];
+
+        switch (state) {
+            case STATE_KEY:
+                if (c == '=') {
+                    state = STATE_VALUE;
+                }
+                else if (c == '#') {
+                    state = STATE_COMMENT;
+                }
+                break;
+            case STATE_VALUE:
+                value = 0;
+                if (c == '"') {
+                    state = STATE_QUOTED;
+                }
+                else if (c == '$') {
+                    state = STATE_HEX;
+                }
+                else if (_is_digit(c)) {
+                    value = c - '0';
+                    state = STATE_NUMBER;
+                }
+                else {
+                    state = STATE_SKIP;
+                }
+                break;
+            case STATE_NUMBER:
+                if (_is_digit(c)) {
+                    value = value * 10 + (c - '0');
+                }
+                else if (c == ';') {
+                    sum += value;
+                    records++;
+                    state = STATE_KEY;
+                }
+                else {
+                    state = STATE_SKIP;
+                }
+                break;
+            case STATE_HEX:
+                if (_is_digit(c)) {
+                    value = (value << 4) | (c - '0');
+                }
+                else if (c >= 'a' && c <= 'f') {
+                    value = (value << 4) | (c - 'a' + 10);
+                }
+                else if (c == ';') {
+                    sum += value;
+                    records++;
+                    state = STATE_KEY;
+                }
+                else {
+                    state = STATE_SKIP;
+                }
+                break;
+            case STATE_QUOTED:
+                if (c == '\\') {
+                    state = STATE_ESCAPE;
+                }
+                else if (c == '"') {
+                    sum += value;
+                    records++;
+                    state = STATE_SKIP;
+                }
+                else {
+                    value += c;
+                }
+                break;
+            case STATE_ESCAPE:
+                value += c;
+                state = STATE_QUOTED;
+                break;
+            case STATE_COMMENT:
+                if (c == '\n') {
+                    state = STATE_KEY;
+                }
+                break;
+            case STATE_SKIP:
+                if (c == ';') {
+                    state = STATE_KEY;
+                }
+                break;
+        }
+    }
+    return (records << 32) | (sum & 0xffffffff);
+}
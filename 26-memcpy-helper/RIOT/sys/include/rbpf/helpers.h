@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2023 Inria
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup     sys_rbpf
+ * @brief       Functions of the virtual machine callable by the applications
+ * @experimental
+ */
+
+#ifndef RBPF_HELPERS_H
+#define RBPF_HELPERS_H
+
+#include <stdint.h>
+
+#include "builtin_shared.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @name Key/value store, return 0 on success
+ *
+ * A fetched key never stored reads as 0.
+ * @{
+ */
+static int (*bpf_store_local)(uint32_t key, uint32_t value) = (void *)BPF_FUNC_BPF_STORE_LOCAL;
+static int (*bpf_store_global)(uint32_t key, uint32_t value) = (void *)BPF_FUNC_BPF_STORE_GLOBAL;
+static int (*bpf_fetch_local)(uint32_t key, uint32_t *value) = (void *)BPF_FUNC_BPF_FETCH_LOCAL;
+static int (*bpf_fetch_global)(uint32_t key, uint32_t *value) = (void *)BPF_FUNC_BPF_FETCH_GLOBAL;
+/** @} */
+
+/**
+ * @brief Start the application at @p index of the tail call array instead of
+ *        continuing, returns -1 only when it can't be started
+ */
+static long (*bpf_tail_call)(uint32_t index) = (void *)BPF_FUNC_BPF_TAIL_CALL;
+
+/**
+ * @name Bulk memory, every range is checked once per call
+ *
+ * bpf_memcpy() and bpf_memset() return 0 on success, bpf_memcmp() the sign
+ * of the first difference and bpf_memchr() the offset of the first byte equal
+ * to @p value or -1. They all return -2 when a range may not be accessed.
+ * @{
+ */
+static int (*bpf_memcpy)(void *dst, const void *src, uint32_t len) = (void *)BPF_FUNC_BPF_MEMCPY;
+static int (*bpf_memset)(void *dst, int value, uint32_t len) = (void *)BPF_FUNC_BPF_MEMSET;
+static int (*bpf_memcmp)(const void *a, const void *b, uint32_t len) = (void *)BPF_FUNC_BPF_MEMCMP;
+static int (*bpf_memchr)(const void *s, int value, uint32_t len) = (void *)BPF_FUNC_BPF_MEMCHR;
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* RBPF_HELPERS_H */
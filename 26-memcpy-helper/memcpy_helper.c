@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2023 Inria
+ *
+ * This file is subject to the terms and conditions of the GNU Lesser
+ * General Public License v2.1. See the file LICENSE in the top level
+ * directory for more details.
+ */
+
+/**
+ * @ingroup
+ * @{
+ *
+ * @file
+ *
+ * The copy of 15-memcpy through the memory copy function of the virtual
+ * machine, which checks both buffers once and copies them natively instead
+ * of running a load and a store per byte.
+ *
+ * @}
+ */
+
+
+#include<stdint.h>
+
+#include "shared.h"
+#include "helpers.h"
+
+typedef struct memcpy_ctx_s
+{
+    __bpf_shared_ptr(char*, src);
+    __bpf_shared_ptr(char*, dst);
+    uint32_t len;
+} memcpy_ctx_t;
+
+uint32_t memcpy_helper(memcpy_ctx_t *ctx)
+{
+    return bpf_memcpy(ctx->dst, ctx->src, ctx->len);
+}